@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "treasure_store.h"
+#include "treasure_commit.h"
+#include "treasure_query.h"
+
+// Measures how fast concurrent writers can add to one hunt. For each
+// writer count, that many processes add treasures one at a time, the way
+// separate treasure_manager add calls do, and the hunt is then checked for
+// lost or duplicated IDs. --direct skips the group commit and has every
+// add append under the hunt lock on its own, for comparison.
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int addOne(const char *huntPath, int writer, int i, int direct)
+{
+    Treasure treasure;
+    memset(&treasure, 0, sizeof(treasure));
+    snprintf(treasure.userName, sizeof(treasure.userName), "writer%d", writer);
+    treasure.coord.x = writer;
+    treasure.coord.y = i;
+    snprintf(treasure.clue, sizeof(treasure.clue), "bench clue %d from writer %d", i, writer);
+    treasure.value = 1 + i % 100;
+
+    if (reserveTreasureIds(huntPath, 1, &treasure.id) != 0) {
+        return -1;
+    }
+    if (!direct) {
+        return commitTreasures(huntPath, &treasure, 1);
+    }
+    int lockFile = lockHunt(huntPath, 1);
+    off_t offset;
+    int result = appendTreasures(huntPath, &treasure, 1, &offset);
+    unlockHunt(lockFile);
+    return result;
+}
+
+// Every live ID must appear exactly once.
+static int countDuplicateIds(const char *huntPath)
+{
+    char dataPath[1100];
+    snprintf(dataPath, sizeof(dataPath), "%s/treasures.dat", huntPath);
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL, &map) != 0) {
+        return -1;
+    }
+
+    int maxId = 0;
+    TreasureCursor cursor;
+    TreasureRecord record;
+    startTreasureCursor(&map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (abs(record.id) > maxId)
+            maxId = abs(record.id);
+    }
+    char *seen = calloc(maxId + 1, 1);
+    if (seen == NULL) {
+        closeTreasureMap(&map);
+        return -1;
+    }
+    int duplicates = 0;
+    startTreasureCursor(&map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (seen[abs(record.id)]++)
+            duplicates++;
+    }
+    free(seen);
+    closeTreasureMap(&map);
+    return duplicates;
+}
+
+static int runWriters(const char *huntPath, int writers, int adds, int direct)
+{
+    TreasureCounts before, after;
+    if (readTreasureCounts(huntPath, &before) != 0) {
+        perror("Error reading treasure file");
+        return 1;
+    }
+
+    double start = now();
+    for (int writer = 0; writer < writers; writer++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            for (int i = 0; i < adds; i++) {
+                if (addOne(huntPath, writer, i, direct) != 0) {
+                    perror("Error adding treasure");
+                    _exit(1);
+                }
+            }
+            _exit(0);
+        }
+        if (pid < 0) {
+            perror("Error creating writer process");
+            return 1;
+        }
+    }
+    int failed = 0, status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    double seconds = now() - start;
+
+    if (readTreasureCounts(huntPath, &after) != 0) {
+        perror("Error reading treasure file");
+        return 1;
+    }
+    int added = after.liveCount - before.liveCount;
+    int duplicates = countDuplicateIds(huntPath);
+    printf("%7d %8d %9.3f %10.0f %s\n", writers, added, seconds, added / seconds,
+           failed == 0 && added == writers * adds && duplicates == 0 ? "ok" : "MISMATCH");
+    if (failed != 0 || added != writers * adds || duplicates != 0) {
+        printf("  expected %d treasures, %d writer(s) failed, %d duplicate ID(s)\n", writers * adds, failed,
+               duplicates);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int direct = 0;
+    int adds = 1000;
+    int writerCounts[32] = {1, 2, 4, 8};
+    int countsGiven = 0, runs = 4;
+    char *huntID = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--direct") == 0) {
+            direct = 1;
+        } else if (strcmp(argv[i], "--adds") == 0 && i + 1 < argc) {
+            adds = atoi(argv[++i]);
+        } else if (huntID == NULL) {
+            huntID = argv[i];
+        } else if (countsGiven < 32 && atoi(argv[i]) > 0) {
+            writerCounts[countsGiven++] = atoi(argv[i]);
+        } else {
+            huntID = NULL;
+            break;
+        }
+    }
+    if (countsGiven > 0)
+        runs = countsGiven;
+    if (huntID == NULL || !isHuntName(huntID) || adds <= 0) {
+        printf("Usage: %s <HuntID> [--adds N] [--direct] [writers...]\n", argv[0]);
+        return 1;
+    }
+
+    char huntPath[1024];
+    snprintf(huntPath, sizeof(huntPath), "Hunts/%s", huntID);
+    mkdir("Hunts", 0755);
+    mkdir(huntPath, 0755);
+
+    printf("Hunt %s, %d adds per writer, %s\n", huntID, adds, direct ? "direct appends" : "group commit");
+    printf("writers  treasures  seconds   adds/sec\n");
+    int failed = 0;
+    for (int i = 0; i < runs; i++) {
+        failed |= runWriters(huntPath, writerCounts[i], adds, direct);
+    }
+    return failed;
+}
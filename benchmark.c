@@ -0,0 +1,336 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+// Times the real binaries, the way a user runs them, on hunts written by
+// generate_hunts. Each size gets its own hunt, Hunt9<size>, and every
+// operation is run --iterations times against it; the hub's list_hunts
+// goes through one long-lived treasure_hub session. Results are written
+// as JSON, one object per operation and size, so runs can be compared.
+
+#define MAX_SIZES 16
+#define MAX_RESULTS 128
+
+typedef struct
+{
+    const char *operation;
+    int records;
+    int count;
+    int errors;
+    double seconds;
+    double *samples;
+} BenchResult;
+
+static const char *binDir = ".";
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs a binary from binDir with its output discarded. Returns the time
+// it took, or -1 if it could not be run or exited with an error.
+static double runTool(const char *tool, char *const args[])
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", binDir, tool);
+    char *argv[16];
+    int argc = 0;
+    argv[argc++] = path;
+    for (int i = 0; args[i] != NULL && argc < 15; i++)
+        argv[argc++] = args[i];
+    argv[argc] = NULL;
+
+    double start = now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull != -1) {
+            dup2(devNull, STDOUT_FILENO);
+            dup2(devNull, STDERR_FILENO);
+            close(devNull);
+        }
+        execv(path, argv);
+        _exit(127);
+    }
+    if (pid < 0) {
+        return -1;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+    double elapsed = now() - start;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double left = *(const double *)a, right = *(const double *)b;
+    return (left > right) - (left < right);
+}
+
+// Nearest-rank percentile of sorted samples, in microseconds.
+static double percentile(const double *sorted, int count, double fraction)
+{
+    if (count == 0)
+        return 0;
+    int rank = (int)(fraction * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return sorted[rank - 1] * 1e6;
+}
+
+static void addSample(BenchResult *result, double seconds)
+{
+    if (seconds < 0) {
+        result->errors++;
+        return;
+    }
+    result->samples[result->count++] = seconds;
+    result->seconds += seconds;
+}
+
+// A treasure_hub child with pipes on both ends.
+typedef struct
+{
+    pid_t pid;
+    int input;
+    int output;
+} HubSession;
+
+// Reads hub output until it stops at its "> " prompt.
+static int waitForPrompt(HubSession *hub)
+{
+    char buffer[4096];
+    char last[2] = {0, 0};
+    while (1) {
+        ssize_t bytes = read(hub->output, buffer, sizeof(buffer));
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        if (bytes >= 2) {
+            last[0] = buffer[bytes - 2];
+            last[1] = buffer[bytes - 1];
+        } else {
+            last[0] = last[1];
+            last[1] = buffer[0];
+        }
+        if (last[0] == '>' && last[1] == ' ')
+            return 0;
+    }
+}
+
+static double hubCommand(HubSession *hub, const char *command)
+{
+    double start = now();
+    size_t length = strlen(command);
+    if (write(hub->input, command, length) != (ssize_t)length || waitForPrompt(hub) != 0) {
+        return -1;
+    }
+    return now() - start;
+}
+
+static int startHub(HubSession *hub)
+{
+    int toHub[2], fromHub[2];
+    if (pipe(toHub) != 0 || pipe(fromHub) != 0) {
+        return -1;
+    }
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/treasure_hub", binDir);
+    hub->pid = fork();
+    if (hub->pid == 0) {
+        dup2(toHub[0], STDIN_FILENO);
+        dup2(fromHub[1], STDOUT_FILENO);
+        close(toHub[0]);
+        close(toHub[1]);
+        close(fromHub[0]);
+        close(fromHub[1]);
+        execl(path, path, (char *)NULL);
+        _exit(127);
+    }
+    close(toHub[0]);
+    close(fromHub[1]);
+    hub->input = toHub[1];
+    hub->output = fromHub[0];
+    if (hub->pid < 0) {
+        return -1;
+    }
+    if (waitForPrompt(hub) != 0 || hubCommand(hub, "start_monitor\n") < 0) {
+        kill(hub->pid, SIGTERM);
+        waitpid(hub->pid, NULL, 0);
+        return -1;
+    }
+    return 0;
+}
+
+static void stopHub(HubSession *hub)
+{
+    hubCommand(hub, "stop_monitor\n");
+    if (write(hub->input, "exit\n", 5) != 5)
+        kill(hub->pid, SIGTERM);
+    close(hub->input);
+    close(hub->output);
+    waitpid(hub->pid, NULL, 0);
+}
+
+static BenchResult *newResult(BenchResult *results, int *resultCount, const char *operation, int records,
+                              int iterations)
+{
+    BenchResult *result = &results[(*resultCount)++];
+    memset(result, 0, sizeof(*result));
+    result->operation = operation;
+    result->records = records;
+    result->samples = malloc(iterations * sizeof(double));
+    return result;
+}
+
+static int benchSize(int records, int iterations, HubSession *hub, BenchResult *results, int *resultCount)
+{
+    char huntID[64], recordText[32], idText[32];
+    snprintf(huntID, sizeof(huntID), "Hunt9%d", records);
+    snprintf(recordText, sizeof(recordText), "%d", records);
+
+    fprintf(stderr, "Generating %s (%d treasures)...\n", huntID, records);
+    char *generateArgs[] = {"--records", recordText, "--replace", huntID, NULL};
+    if (runTool("generate_hunts", generateArgs) < 0) {
+        fprintf(stderr, "Error: generate_hunts failed for %s.\n", huntID);
+        return -1;
+    }
+    if (*resultCount + 6 > MAX_RESULTS) {
+        return -1;
+    }
+
+    fprintf(stderr, "Timing %s...\n", huntID);
+    BenchResult *add = newResult(results, resultCount, "add", records, iterations);
+    BenchResult *list = newResult(results, resultCount, "list", records, iterations);
+    BenchResult *view = newResult(results, resultCount, "view", records, iterations);
+    BenchResult *score = newResult(results, resultCount, "calculate_score", records, iterations);
+    BenchResult *listHunts = newResult(results, resultCount, "monitor_list_hunts", records, iterations);
+    BenchResult *removeResult = newResult(results, resultCount, "remove", records, iterations);
+
+    srand(records);
+    for (int i = 0; i < iterations; i++) {
+        char *addArgs[] = {"add", huntID, "--user", "benchuser", "--x", "1.5", "--y", "-2.5",
+                           "--clue", "benchmark clue", "--value", "7", NULL};
+        addSample(add, runTool("treasure_manager", addArgs));
+
+        char *listArgs[] = {"list", huntID, NULL};
+        addSample(list, runTool("treasure_manager", listArgs));
+
+        snprintf(idText, sizeof(idText), "%d", 1 + rand() % records);
+        char *viewArgs[] = {"view", huntID, idText, NULL};
+        addSample(view, runTool("treasure_manager", viewArgs));
+
+        char *scoreArgs[] = {huntID, NULL};
+        addSample(score, runTool("calculate_score", scoreArgs));
+
+        addSample(listHunts, hub != NULL ? hubCommand(hub, "list_hunts\n") : -1);
+    }
+    // Removes go last and spread over the hunt, so they do not change
+    // what the other operations see.
+    for (int i = 0; i < iterations; i++) {
+        snprintf(idText, sizeof(idText), "%d", 1 + (int)((long)i * records / iterations));
+        char *removeArgs[] = {"remove", huntID, idText, NULL};
+        addSample(removeResult, runTool("treasure_manager", removeArgs));
+    }
+    return 0;
+}
+
+static void writeResults(FILE *out, const BenchResult *results, int resultCount, int iterations)
+{
+    fprintf(out, "{\n  \"timestamp\": %ld,\n  \"iterations\": %d,\n  \"results\": [\n", (long)time(NULL),
+            iterations);
+    for (int i = 0; i < resultCount; i++) {
+        const BenchResult *result = &results[i];
+        qsort(result->samples, result->count, sizeof(double), compareDoubles);
+        double mean = result->count > 0 ? result->seconds / result->count * 1e6 : 0;
+        double perSecond = result->seconds > 0 ? result->count / result->seconds : 0;
+        fprintf(out,
+                "    {\"operation\": \"%s\", \"records\": %d, \"count\": %d, \"errors\": %d, "
+                "\"ops_per_sec\": %.1f, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+                "\"p99_us\": %.1f, \"max_us\": %.1f}%s\n",
+                result->operation, result->records, result->count, result->errors, perSecond, mean,
+                percentile(result->samples, result->count, 0.50), percentile(result->samples, result->count, 0.90),
+                percentile(result->samples, result->count, 0.99), percentile(result->samples, result->count, 1.0),
+                i + 1 < resultCount ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int sizes[MAX_SIZES] = {1000, 10000, 100000};
+    int sizeCount = 3, iterations = 50;
+    const char *outputPath = NULL;
+    int valid = 1;
+    for (int i = 1; i < argc && valid; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizeCount = 0;
+            char *copy = strdup(argv[++i]);
+            for (char *token = strtok(copy, ","); token != NULL && valid; token = strtok(NULL, ",")) {
+                int size = atoi(token);
+                valid = size > 0 && sizeCount < MAX_SIZES;
+                if (valid)
+                    sizes[sizeCount++] = size;
+            }
+            free(copy);
+            valid = valid && sizeCount > 0;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+            valid = iterations > 0;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            outputPath = argv[++i];
+        } else if (strcmp(argv[i], "--bin") == 0 && i + 1 < argc) {
+            binDir = argv[++i];
+        } else {
+            valid = 0;
+        }
+    }
+    if (!valid) {
+        printf("Usage: %s [--sizes 1000,10000,100000] [--iterations N] [--output FILE] [--bin DIR]\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    HubSession hubSession;
+    HubSession *hub = &hubSession;
+    if (startHub(hub) != 0) {
+        fprintf(stderr, "Warning: could not start treasure_hub; monitor timings will show as errors.\n");
+        hub = NULL;
+    }
+
+    BenchResult results[MAX_RESULTS];
+    int resultCount = 0, failed = 0;
+    for (int i = 0; i < sizeCount; i++) {
+        if (benchSize(sizes[i], iterations, hub, results, &resultCount) != 0)
+            failed = 1;
+    }
+    if (hub != NULL)
+        stopHub(hub);
+
+    FILE *out = stdout;
+    if (outputPath != NULL && (out = fopen(outputPath, "w")) == NULL) {
+        perror("Error opening output file");
+        return 1;
+    }
+    writeResults(out, results, resultCount, iterations);
+    if (out != stdout)
+        fclose(out);
+    for (int i = 0; i < resultCount; i++)
+        free(results[i].samples);
+    return failed;
+}
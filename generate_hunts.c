@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "treasure_store.h"
+#include "treasure_index.h"
+
+// Writes synthetic hunts through the same append path as treasure_manager
+// import, so they carry scores, the clue index and treasures.idx like any
+// other hunt. The same seed always produces the same hunts.
+
+#define GENERATE_BATCH 4096
+
+typedef struct
+{
+    int records;
+    int users;
+    int clueMin;
+    int clueMax;
+    int skewed;
+    uint64_t seed;
+    int replace;
+} GenerateOptions;
+
+static const char *clueWords[] = {
+    "under", "the", "old", "oak", "tree", "rock", "river", "bridge", "north", "south", "east", "west",
+    "cave", "stone", "well", "tower", "mill", "gate", "hill", "lake", "behind", "near", "buried", "beneath",
+    "red", "door", "church", "bell", "steps", "garden", "fence", "path", "shadow", "noon", "lamp", "post",
+};
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 2685821657736338717ULL;
+}
+
+static double randomUnit(uint64_t *state)
+{
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Uniform clue lengths between the bounds, or with --skewed mostly short
+// ones and a long tail up to the maximum.
+static int clueLength(const GenerateOptions *options, uint64_t *state)
+{
+    double unit = randomUnit(state);
+    if (options->skewed)
+        unit = unit * unit * unit;
+    return options->clueMin + (int)(unit * (options->clueMax - options->clueMin + 1));
+}
+
+static void makeTreasure(const GenerateOptions *options, uint64_t *state, int id, Treasure *treasure)
+{
+    memset(treasure, 0, sizeof(*treasure));
+    treasure->id = id;
+    snprintf(treasure->userName, sizeof(treasure->userName), "user%d", (int)(nextRandom(state) % options->users));
+    treasure->coord.x = randomUnit(state) * 2000.0 - 1000.0;
+    treasure->coord.y = randomUnit(state) * 2000.0 - 1000.0;
+    treasure->value = 1 + nextRandom(state) % 100;
+
+    int length = clueLength(options, state);
+    int used = 0;
+    while (used < length) {
+        const char *word = clueWords[nextRandom(state) % (sizeof(clueWords) / sizeof(clueWords[0]))];
+        used += snprintf(treasure->clue + used, sizeof(treasure->clue) - used, "%s%s", used > 0 ? " " : "", word);
+        if (used >= (int)sizeof(treasure->clue) - 1)
+            break;
+    }
+    if (length < (int)sizeof(treasure->clue))
+        treasure->clue[length] = '\0';
+}
+
+// Empties a hunt directory (and its pending/ folder) for --replace.
+static int clearHunt(const char *huntPath)
+{
+    char pendingPath[1100];
+    snprintf(pendingPath, sizeof(pendingPath), "%s/pending", huntPath);
+    const char *dirs[] = {pendingPath, huntPath};
+    for (int i = 0; i < 2; i++) {
+        DIR *dir = opendir(dirs[i]);
+        if (dir == NULL)
+            continue;
+        struct dirent *entry;
+        char path[1400];
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+                strcmp(entry->d_name, "pending") == 0)
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", dirs[i], entry->d_name);
+            if (unlink(path) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(pendingPath);
+    return 0;
+}
+
+static int generateHunt(const char *huntID, const GenerateOptions *options, uint64_t seed)
+{
+    char huntPath[1024], dataPath[1100];
+    snprintf(huntPath, sizeof(huntPath), "Hunts/%s", huntID);
+    snprintf(dataPath, sizeof(dataPath), "%s/treasures.dat", huntPath);
+    if (mkdir(huntPath, 0755) != 0 && errno != EEXIST) {
+        perror("Error creating hunt directory");
+        return -1;
+    }
+    struct stat st;
+    if (stat(dataPath, &st) == 0) {
+        if (!options->replace) {
+            printf("Hunt %s already exists; use --replace to overwrite it.\n", huntID);
+            return -1;
+        }
+        if (clearHunt(huntPath) != 0) {
+            perror("Error clearing hunt");
+            return -1;
+        }
+    }
+
+    Treasure *batch = malloc(GENERATE_BATCH * sizeof(Treasure));
+    if (batch == NULL) {
+        perror("Error allocating treasures");
+        return -1;
+    }
+    int lockFile = lockHunt(huntPath, 1);
+    int firstId;
+    int result = reserveTreasureIds(huntPath, options->records, &firstId);
+    uint64_t state = seed != 0 ? seed : 1;
+    for (int written = 0; result == 0 && written < options->records;) {
+        int count = options->records - written < GENERATE_BATCH ? options->records - written : GENERATE_BATCH;
+        for (int i = 0; i < count; i++)
+            makeTreasure(options, &state, firstId + written + i, &batch[i]);
+        off_t offset;
+        result = appendTreasures(huntPath, batch, count, &offset);
+        written += count;
+    }
+    if (result == 0)
+        result = rebuildTreasureIndex(huntPath);
+    unlockHunt(lockFile);
+    free(batch);
+
+    if (result != 0) {
+        printf("Error writing hunt %s: %s\n", huntID, strerror(errno));
+        return -1;
+    }
+    printf("Generated Hunt %s: %d treasure(s) from %d user(s).\n", huntID, options->records, options->users);
+    return 0;
+}
+
+// treasure_manager only accepts Hunt followed by digits.
+static int isNumberedHunt(const char *name)
+{
+    if (strncmp(name, "Hunt", 4) != 0 || name[4] == '\0')
+        return 0;
+    for (int i = 4; name[i] != '\0'; i++) {
+        if (name[i] < '0' || name[i] > '9')
+            return 0;
+    }
+    return 1;
+}
+
+static int parsePositive(const char *text, int *value)
+{
+    char *end;
+    long parsed = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || parsed <= 0 || parsed > 100000000) {
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+static void printUsage(const char *program)
+{
+    printf("Usage: %s [options] <HuntID> [HuntID...]\n", program);
+    printf("       %s [options] --hunts N [--first N]   (Hunt<first>, Hunt<first+1>, ...)\n", program);
+    printf("Options: --records N (1000)  --users N (50)  --clue-min N (8)  --clue-max N (64)\n");
+    printf("         --skewed  --seed N (1)  --jobs N (1)  --replace\n");
+}
+
+int main(int argc, char *argv[])
+{
+    GenerateOptions options = {1000, 50, 8, 64, 0, 1, 0};
+    int hunts = 0, jobs = 1, first = 1000;
+    char **huntIDs = malloc(argc * sizeof(char *));
+    int huntCount = 0;
+    int valid = huntIDs != NULL;
+    for (int i = 1; i < argc && valid; i++) {
+        const char *arg = argv[i];
+        int hasValue = i + 1 < argc;
+        if (strcmp(arg, "--records") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &options.records) == 0;
+        } else if (strcmp(arg, "--users") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &options.users) == 0;
+        } else if (strcmp(arg, "--clue-min") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &options.clueMin) == 0;
+        } else if (strcmp(arg, "--clue-max") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &options.clueMax) == 0;
+        } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "--hunts") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &hunts) == 0;
+        } else if (strcmp(arg, "--first") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &first) == 0;
+        } else if (strcmp(arg, "--jobs") == 0 && hasValue) {
+            valid = parsePositive(argv[++i], &jobs) == 0;
+        } else if (strcmp(arg, "--skewed") == 0) {
+            options.skewed = 1;
+        } else if (strcmp(arg, "--replace") == 0) {
+            options.replace = 1;
+        } else if (isNumberedHunt(arg)) {
+            huntIDs[huntCount++] = argv[i];
+        } else {
+            valid = 0;
+        }
+    }
+    if (options.clueMax > 1023)
+        options.clueMax = 1023;
+    if (!valid || options.clueMin > options.clueMax || (huntCount == 0) == (hunts == 0)) {
+        printUsage(argv[0]);
+        free(huntIDs);
+        return 1;
+    }
+
+    if (mkdir("Hunts", 0755) != 0 && errno != EEXIST) {
+        perror("Error creating Hunts directory");
+        free(huntIDs);
+        return 1;
+    }
+
+    char (*names)[100] = NULL;
+    if (hunts > 0) {
+        names = malloc(hunts * sizeof(*names));
+        huntIDs = realloc(huntIDs, hunts * sizeof(char *));
+        if (names == NULL || huntIDs == NULL) {
+            perror("Error allocating hunt names");
+            return 1;
+        }
+        for (int i = 0; i < hunts; i++) {
+            snprintf(names[i], sizeof(names[i]), "Hunt%d", first + i);
+            huntIDs[i] = names[i];
+        }
+        huntCount = hunts;
+    }
+
+    // Each hunt gets its own seed, so the output does not depend on --jobs.
+    int failed = 0, running = 0, status;
+    for (int i = 0; i < huntCount; i++) {
+        uint64_t seed = options.seed * 1000003 + i;
+        if (jobs == 1) {
+            failed |= generateHunt(huntIDs[i], &options, seed) != 0;
+            continue;
+        }
+        if (running == jobs && wait(&status) > 0) {
+            failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+            running--;
+        }
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            int result = generateHunt(huntIDs[i], &options, seed);
+            fflush(stdout);
+            _exit(result != 0);
+        }
+        if (pid < 0) {
+            perror("Error starting generator");
+            failed = 1;
+            break;
+        }
+        running++;
+    }
+    while (running > 0 && wait(&status) > 0) {
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        running--;
+    }
+
+    free(names);
+    free(huntIDs);
+    return failed;
+}
@@ -0,0 +1,447 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "treasure_cache.h"
+
+#define HUNT_WATCH_EVENTS (IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+                           IN_MOVE_SELF | IN_ONLYDIR)
+#define FOLDER_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+typedef struct
+{
+    char huntsDir[1024];
+    int notifyFd;
+    int rootWatch;
+    size_t budget;
+    size_t bytes;
+    // newest is the most recently used hunt; eviction starts at oldest.
+    CachedHunt *newest, *oldest;
+    unsigned long long hits, loads, reloads, evictions;
+    pthread_mutex_t lock;
+} HuntCache;
+
+static HuntCache *cache = NULL;
+
+static void unlinkHunt(CachedHunt *hunt)
+{
+    if (hunt->newer != NULL)
+        hunt->newer->older = hunt->older;
+    else
+        cache->newest = hunt->older;
+    if (hunt->older != NULL)
+        hunt->older->newer = hunt->newer;
+    else
+        cache->oldest = hunt->newer;
+    hunt->newer = hunt->older = NULL;
+}
+
+static void pushNewest(CachedHunt *hunt)
+{
+    hunt->older = cache->newest;
+    hunt->newer = NULL;
+    if (cache->newest != NULL)
+        cache->newest->newer = hunt;
+    cache->newest = hunt;
+    if (cache->oldest == NULL)
+        cache->oldest = hunt;
+}
+
+// Frees what was read from the hunt's files; the entry and its watch stay
+// so the next query reloads it. The cache lock is held and nobody has the
+// hunt pinned.
+static void unloadHunt(CachedHunt *hunt)
+{
+    if (hunt->loaded) {
+        closeTreasureMap(&hunt->map);
+        free(hunt->rows);
+        free(hunt->scores);
+        hunt->rows = NULL;
+        hunt->scores = NULL;
+        hunt->rowCount = hunt->scoreCount = 0;
+        cache->bytes -= hunt->bytes;
+        hunt->bytes = 0;
+        hunt->loaded = 0;
+    }
+    hunt->stale = 0;
+}
+
+static void freeHunt(CachedHunt *hunt)
+{
+    unloadHunt(hunt);
+    unlinkHunt(hunt);
+    if (hunt->watch != -1)
+        inotify_rm_watch(cache->notifyFd, hunt->watch);
+    pthread_mutex_destroy(&hunt->lock);
+    free(hunt);
+}
+
+static void evictHunt(CachedHunt *hunt)
+{
+    freeHunt(hunt);
+    cache->evictions++;
+}
+
+static void trimCache(void)
+{
+    CachedHunt *hunt = cache->oldest;
+    while (cache->bytes > cache->budget && hunt != NULL) {
+        CachedHunt *newer = hunt->newer;
+        if (hunt->pins == 0 && hunt->loaded)
+            evictHunt(hunt);
+        hunt = newer;
+    }
+}
+
+// Called when the hunt's files changed: drop it now, or once the last
+// query using it lets go.
+static void invalidateHunt(CachedHunt *hunt)
+{
+    if (hunt->pins > 0)
+        hunt->stale = 1;
+    else
+        unloadHunt(hunt);
+}
+
+static CachedHunt *findHunt(const char *name)
+{
+    for (CachedHunt *hunt = cache->newest; hunt != NULL; hunt = hunt->older) {
+        if (strcmp(hunt->name, name) == 0)
+            return hunt;
+    }
+    return NULL;
+}
+
+static CachedHunt *findWatch(int watch)
+{
+    for (CachedHunt *hunt = cache->newest; hunt != NULL; hunt = hunt->older) {
+        if (hunt->watch == watch)
+            return hunt;
+    }
+    return NULL;
+}
+
+int startHuntCache(const char *huntsDir)
+{
+    size_t megabytes = DEFAULT_CACHE_MB;
+    const char *setting = getenv("TREASURE_CACHE_MB");
+    if (setting != NULL && *setting != '\0')
+        megabytes = strtoull(setting, NULL, 10);
+    if (megabytes == 0 || cache != NULL) {
+        return -1;
+    }
+
+    cache = calloc(1, sizeof(HuntCache));
+    if (cache == NULL) {
+        return -1;
+    }
+    snprintf(cache->huntsDir, sizeof(cache->huntsDir), "%s", huntsDir);
+    cache->budget = megabytes * 1024 * 1024;
+    cache->notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    // Without a watch on Hunts/ a deleted and recreated hunt could be missed.
+    cache->rootWatch = cache->notifyFd == -1 ? -1 : inotify_add_watch(cache->notifyFd, huntsDir, FOLDER_EVENTS | IN_ONLYDIR);
+    if (cache->rootWatch == -1) {
+        if (cache->notifyFd != -1)
+            close(cache->notifyFd);
+        free(cache);
+        cache = NULL;
+        return -1;
+    }
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache->notifyFd;
+}
+
+void stopHuntCache(void)
+{
+    if (cache == NULL) {
+        return;
+    }
+    while (cache->newest != NULL)
+        freeHunt(cache->newest);
+    close(cache->notifyFd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+    cache = NULL;
+}
+
+static int isHuntFile(const char *name)
+{
+    return strcmp(name, "treasures.dat") == 0 || strncmp(name, "clues-", 6) == 0 || strncmp(name, "rows-", 5) == 0;
+}
+
+void processHuntCacheEvents(void)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    pthread_mutex_lock(&cache->lock);
+    while (1) {
+        ssize_t length = read(cache->notifyFd, buffer, sizeof(buffer));
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length <= 0)
+            break;
+
+        for (char *at = buffer; at < buffer + length;) {
+            const struct inotify_event *event = (const struct inotify_event *)at;
+            at += sizeof(struct inotify_event) + event->len;
+            const char *name = event->len > 0 ? event->name : "";
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost; trust nothing.
+                for (CachedHunt *hunt = cache->newest; hunt != NULL; hunt = hunt->older)
+                    invalidateHunt(hunt);
+                continue;
+            }
+            if (event->wd == cache->rootWatch) {
+                // A hunt folder came, went or was renamed.
+                CachedHunt *hunt = findHunt(name);
+                if (hunt != NULL)
+                    invalidateHunt(hunt);
+                continue;
+            }
+
+            CachedHunt *hunt = findWatch(event->wd);
+            if (hunt == NULL)
+                continue;
+            if (event->mask & IN_IGNORED) {
+                hunt->watch = -1;
+                invalidateHunt(hunt);
+            } else if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+                invalidateHunt(hunt);
+            } else if (isHuntFile(name)) {
+                invalidateHunt(hunt);
+            } else if (event->mask & FOLDER_EVENTS) {
+                // Only the folder's time changed.
+                hunt->timeStale = 1;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+static int32_t rowIdAt(const TreasureMap *map, size_t offset)
+{
+    int32_t id;
+    memcpy(&id, treasureRecordAt(map, offset), sizeof(id));
+    return id;
+}
+
+static int compareRowIds(const void *a, const void *b, void *map)
+{
+    int32_t first = rowIdAt(map, *(const size_t *)a);
+    int32_t second = rowIdAt(map, *(const size_t *)b);
+    return (first > second) - (first < second);
+}
+
+// Reads the hunt's files into memory. The watch goes on first, so a change
+// made while they are being read is never missed.
+static int loadHunt(CachedHunt *hunt)
+{
+    char huntPath[1200], dataPath[1300];
+    snprintf(huntPath, sizeof(huntPath), "%s/%s", cache->huntsDir, hunt->name);
+    snprintf(dataPath, sizeof(dataPath), "%s/treasures.dat", huntPath);
+
+    if (hunt->watch == -1) {
+        pthread_mutex_lock(&cache->lock);
+        hunt->watch = inotify_add_watch(cache->notifyFd, huntPath, HUNT_WATCH_EVENTS);
+        pthread_mutex_unlock(&cache->lock);
+        if (hunt->watch == -1) {
+            return -1;
+        }
+    }
+
+    struct stat huntStat;
+    if (stat(huntPath, &huntStat) != 0 || !S_ISDIR(huntStat.st_mode) ||
+        openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL | TREASURE_WITH_CLUES | TREASURE_RESIDENT, &hunt->map) != 0) {
+        return -1;
+    }
+    hunt->modified = huntStat.st_mtime;
+    hunt->timeStale = 0;
+
+    int capacity = 0;
+    TreasureCursor cursor;
+    TreasureRecord record;
+    startTreasureCursor(&hunt->map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (!TREASURE_IS_LIVE(&record))
+            continue;
+        if (hunt->rowCount == capacity) {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            size_t *grown = realloc(hunt->rows, capacity * sizeof(size_t));
+            if (grown == NULL) {
+                free(hunt->rows);
+                hunt->rows = NULL;
+                hunt->rowCount = 0;
+                closeTreasureMap(&hunt->map);
+                return -1;
+            }
+            hunt->rows = grown;
+        }
+        hunt->rows[hunt->rowCount++] = record.offset;
+    }
+    qsort_r(hunt->rows, hunt->rowCount, sizeof(size_t), compareRowIds, &hunt->map);
+
+    hunt->bytes = sizeof(CachedHunt) + hunt->map.length + hunt->map.clueLength + capacity * sizeof(size_t);
+    hunt->loaded = 1;
+    return 0;
+}
+
+CachedHunt *acquireCachedHunt(const char *huntID)
+{
+    if (cache == NULL || strlen(huntID) >= sizeof(((CachedHunt *)0)->name)) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    CachedHunt *hunt = findHunt(huntID);
+    int known = hunt != NULL;
+    if (hunt == NULL) {
+        hunt = calloc(1, sizeof(CachedHunt));
+        if (hunt == NULL) {
+            pthread_mutex_unlock(&cache->lock);
+            return NULL;
+        }
+        strcpy(hunt->name, huntID);
+        hunt->watch = -1;
+        pthread_mutex_init(&hunt->lock, NULL);
+        pushNewest(hunt);
+    } else if (hunt->stale) {
+        // Changed while another query still holds the old copy; that query
+        // keeps it, and this one reads the files.
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    } else {
+        unlinkHunt(hunt);
+        pushNewest(hunt);
+    }
+    hunt->pins++;
+    pthread_mutex_unlock(&cache->lock);
+
+    // Loading happens outside the cache lock, so score workers read
+    // different hunts in parallel; the hunt's own lock stops two of them
+    // reading the same one.
+    pthread_mutex_lock(&hunt->lock);
+    int loaded = hunt->loaded, failed = 0;
+    if (!loaded) {
+        failed = loadHunt(hunt) != 0;
+    } else if (hunt->timeStale) {
+        // Something besides the treasure files came or went; one stat.
+        char huntPath[1200];
+        snprintf(huntPath, sizeof(huntPath), "%s/%s", cache->huntsDir, hunt->name);
+        struct stat huntStat;
+        if (stat(huntPath, &huntStat) == 0)
+            hunt->modified = huntStat.st_mtime;
+        hunt->timeStale = 0;
+    }
+    pthread_mutex_unlock(&hunt->lock);
+
+    pthread_mutex_lock(&cache->lock);
+    if (failed) {
+        hunt->pins--;
+        if (hunt->pins == 0)
+            freeHunt(hunt);
+        pthread_mutex_unlock(&cache->lock);
+        return NULL;
+    }
+    if (loaded) {
+        cache->hits++;
+    } else {
+        cache->bytes += hunt->bytes;
+        if (known)
+            cache->reloads++;
+        else
+            cache->loads++;
+        // A hunt bigger than the whole budget is dropped on release instead
+        // of pushing everything else out.
+        if (hunt->bytes <= cache->budget)
+            trimCache();
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return hunt;
+}
+
+void releaseCachedHunt(CachedHunt *hunt)
+{
+    if (hunt == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    hunt->pins--;
+    if (hunt->pins == 0) {
+        if (hunt->stale)
+            unloadHunt(hunt);
+        else if (hunt->bytes > cache->budget)
+            evictHunt(hunt);
+        else
+            trimCache();
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int findCachedTreasure(const CachedHunt *hunt, int id, Treasure *treasure)
+{
+    int low = 0, high = hunt->rowCount - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        int32_t rowId = rowIdAt(&hunt->map, hunt->rows[middle]);
+        if (rowId < id) {
+            low = middle + 1;
+        } else if (rowId > id) {
+            high = middle - 1;
+        } else {
+            TreasureCursor cursor;
+            TreasureRecord record;
+            seekTreasureCursor(&hunt->map, hunt->rows[middle], &cursor);
+            if (!nextTreasure(&cursor, &record))
+                return 0;
+            recordToTreasure(&record, treasure);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void setCachedScores(CachedHunt *hunt, ScoreFileEntry *entries, int count)
+{
+    pthread_mutex_lock(&hunt->lock);
+    if (hunt->scores != NULL) {
+        pthread_mutex_unlock(&hunt->lock);
+        free(entries);
+        return;
+    }
+    hunt->scores = entries;
+    hunt->scoreCount = count;
+    pthread_mutex_unlock(&hunt->lock);
+
+    pthread_mutex_lock(&cache->lock);
+    size_t bytes = count * sizeof(ScoreFileEntry);
+    hunt->bytes += bytes;
+    cache->bytes += bytes;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void printHuntCacheStats(FILE *out)
+{
+    if (cache == NULL) {
+        fprintf(out, "Hunt cache: off\n");
+        return;
+    }
+    pthread_mutex_lock(&cache->lock);
+    int loaded = 0;
+    for (CachedHunt *hunt = cache->newest; hunt != NULL; hunt = hunt->older)
+        loaded += hunt->loaded;
+    fprintf(out, "Hunt cache: %d hunt(s) loaded, %zu of %zu KB used\n", loaded, cache->bytes / 1024,
+            cache->budget / 1024);
+    fprintf(out, "            %llu hit(s), %llu load(s), %llu reload(s) after a change, %llu eviction(s)\n",
+            cache->hits, cache->loads, cache->reloads, cache->evictions);
+    pthread_mutex_unlock(&cache->lock);
+}
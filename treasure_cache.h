@@ -0,0 +1,60 @@
+#ifndef TREASURE_CACHE_H
+#define TREASURE_CACHE_H
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "treasure_store.h"
+#include "treasure_scores.h"
+
+// The hub monitor keeps the hunts it has recently answered for in memory:
+// their rows and clues, the hunt folder's time, an ID lookup table and
+// (once scored) every user's total. inotify watches Hunts/ and the folder
+// of every cached hunt; a change to a hunt's treasures.dat or segment
+// files drops just that hunt, and it is read again the next time it is asked
+// for. Past the budget (TREASURE_CACHE_MB, 64 by default, 0 turns the
+// cache off) the least recently used hunts are evicted. Programs that never
+// start the cache read the files on every query, as before.
+#define DEFAULT_CACHE_MB 64
+
+typedef struct CachedHunt
+{
+    char name[64];
+    TreasureMap map;
+    time_t modified;
+    // Offsets of the live records in map, sorted by treasure ID.
+    size_t *rows;
+    int rowCount;
+    // Filled in by the first score query; guarded by lock.
+    ScoreFileEntry *scores;
+    int scoreCount;
+    size_t bytes;
+    int loaded;
+    int stale;
+    int timeStale;
+    int pins;
+    int watch;
+    pthread_mutex_t lock;
+    struct CachedHunt *newer, *older;
+} CachedHunt;
+
+// Starts the cache for the hunts in huntsDir and returns the inotify
+// descriptor to wait on, or -1 if the cache is off.
+int startHuntCache(const char *huntsDir);
+void stopHuntCache(void);
+// Drains pending inotify events without blocking.
+void processHuntCacheEvents(void);
+
+// Returns the hunt loaded and pinned until releaseCachedHunt, or NULL when
+// the cache is off or the hunt cannot be read (the caller then goes to the
+// files and reports the error itself).
+CachedHunt *acquireCachedHunt(const char *huntID);
+void releaseCachedHunt(CachedHunt *hunt);
+int findCachedTreasure(const CachedHunt *hunt, int id, Treasure *treasure);
+// Keeps a copy of the hunt's per-user totals; takes ownership of entries.
+void setCachedScores(CachedHunt *hunt, ScoreFileEntry *entries, int count);
+
+void printHuntCacheStats(FILE *out);
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "treasure_catalog.h"
+#include "treasure_store.h"
+
+#define CATALOG_VERSION 1
+
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+    int64_t dirSeconds;
+    int64_t dirNanoseconds;
+} CatalogHeader;
+
+static int compareEntries(const void *a, const void *b)
+{
+    return strcmp(((const CatalogEntry *)a)->name, ((const CatalogEntry *)b)->name);
+}
+
+// Fills entry for the hunt called name inside the folder dirFd refers
+// to. Returns -1 if it has no treasure file.
+static int statHunt(int dirFd, const char *huntsDir, const char *name, CatalogEntry *entry)
+{
+    if (strncmp(name, "Hunt", 4) != 0 || strlen(name) >= CATALOG_NAME_LENGTH) {
+        return -1;
+    }
+    int huntFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY);
+    if (huntFd == -1) {
+        return -1;
+    }
+    struct stat st;
+    int result = fstatat(huntFd, "treasures.dat", &st, 0);
+    close(huntFd);
+    if (result != 0) {
+        return -1;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    strcpy(entry->name, name);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    char huntPath[1200];
+    snprintf(huntPath, sizeof(huntPath), "%s/%s", huntsDir, name);
+    TreasureCounts counts;
+    if (readTreasureCounts(huntPath, &counts) == 0)
+        entry->treasures = counts.liveCount;
+    return 0;
+}
+
+static int scanHunts(const char *huntsDir, CatalogEntry **entries, int *count)
+{
+    *entries = NULL;
+    *count = 0;
+    int dirFd = open(huntsDir, O_RDONLY | O_DIRECTORY);
+    if (dirFd == -1) {
+        return -1;
+    }
+    int listFd = dup(dirFd);
+    DIR *dir = listFd != -1 ? fdopendir(listFd) : NULL;
+    if (dir == NULL) {
+        if (listFd != -1)
+            close(listFd);
+        close(dirFd);
+        return -1;
+    }
+
+    int capacity = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (*count == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            CatalogEntry *grown = realloc(*entries, capacity * sizeof(CatalogEntry));
+            if (grown == NULL)
+                break;
+            *entries = grown;
+        }
+        if (statHunt(dirFd, huntsDir, entry->d_name, &(*entries)[*count]) == 0)
+            (*count)++;
+    }
+    closedir(dir);
+    close(dirFd);
+
+    qsort(*entries, *count, sizeof(CatalogEntry), compareEntries);
+    return 0;
+}
+
+// Replaces the catalog, then stamps it with the time of Hunts/ as the
+// rename left it. The caller holds the catalog lock.
+static int writeCatalog(const char *huntsDir, const CatalogEntry *entries, int count)
+{
+    char catalogPath[1100], tempPath[1200];
+    snprintf(catalogPath, sizeof(catalogPath), "%s/catalog", huntsDir);
+    snprintf(tempPath, sizeof(tempPath), "%s/catalog.%d", huntsDir, (int)getpid());
+
+    CatalogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CATALOG_MAGIC, 4);
+    header.version = CATALOG_VERSION;
+    header.count = count;
+
+    int fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = 0;
+    if (pwriteFull(fd, &header, sizeof(header), 0) != 0 ||
+        pwriteFull(fd, entries, count * sizeof(CatalogEntry), sizeof(header)) != 0 ||
+        rename(tempPath, catalogPath) != 0) {
+        unlink(tempPath);
+        result = -1;
+    }
+
+    struct stat dirStat;
+    if (result == 0 && stat(huntsDir, &dirStat) == 0) {
+        header.dirSeconds = dirStat.st_mtim.tv_sec;
+        header.dirNanoseconds = dirStat.st_mtim.tv_nsec;
+        result = pwriteFull(fd, &header, sizeof(header), 0);
+    }
+    close(fd);
+    return result;
+}
+
+// Opens the catalog if it is intact and no hunt folder has come or gone
+// since it was written.
+static int openCurrentCatalog(const char *huntsDir, int flags, CatalogHeader *header)
+{
+    char catalogPath[1100];
+    snprintf(catalogPath, sizeof(catalogPath), "%s/catalog", huntsDir);
+    int fd = open(catalogPath, flags);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st, dirStat;
+    if (fstat(fd, &st) != 0 || stat(huntsDir, &dirStat) != 0 ||
+        preadFull(fd, header, sizeof(*header), 0) != 0 || memcmp(header->magic, CATALOG_MAGIC, 4) != 0 ||
+        header->version != CATALOG_VERSION ||
+        (uint64_t)st.st_size != sizeof(*header) + (uint64_t)header->count * sizeof(CatalogEntry) ||
+        header->dirSeconds != dirStat.st_mtim.tv_sec || header->dirNanoseconds != dirStat.st_mtim.tv_nsec) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int lockCatalog(const char *huntsDir)
+{
+    char lockPath[1100];
+    snprintf(lockPath, sizeof(lockPath), "%s/catalog.lock", huntsDir);
+    int lockFile = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lockFile == -1) {
+        return -1;
+    }
+    while (flock(lockFile, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(lockFile);
+            return -1;
+        }
+    }
+    return lockFile;
+}
+
+static int readEntries(int fd, const CatalogHeader *header, CatalogEntry **entries, int *count)
+{
+    *count = header->count;
+    *entries = malloc((*count > 0 ? *count : 1) * sizeof(CatalogEntry));
+    if (*entries == NULL || preadFull(fd, *entries, *count * sizeof(CatalogEntry), sizeof(*header)) != 0) {
+        free(*entries);
+        *entries = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int readHuntCatalog(const char *huntsDir, CatalogEntry **entries, int *count)
+{
+    CatalogHeader header;
+    int fd = openCurrentCatalog(huntsDir, O_RDONLY, &header);
+    if (fd != -1) {
+        int result = readEntries(fd, &header, entries, count);
+        close(fd);
+        if (result == 0) {
+            return 0;
+        }
+    }
+
+    // Stale or missing: rescan, and save the result when the catalog can be
+    // locked (it cannot in a read-only Hunts folder).
+    int lockFile = lockCatalog(huntsDir);
+    if (lockFile != -1 && (fd = openCurrentCatalog(huntsDir, O_RDONLY, &header)) != -1) {
+        // Someone else rebuilt it while we waited.
+        int result = readEntries(fd, &header, entries, count);
+        close(fd);
+        if (result == 0) {
+            close(lockFile);
+            return 0;
+        }
+    }
+    int result = scanHunts(huntsDir, entries, count);
+    if (result == 0 && lockFile != -1)
+        writeCatalog(huntsDir, *entries, *count);
+    if (lockFile != -1)
+        close(lockFile);
+    return result;
+}
+
+void updateHuntCatalog(const char *huntPath)
+{
+    char huntsDir[1024];
+    snprintf(huntsDir, sizeof(huntsDir), "%s", huntPath);
+    char *slash = strrchr(huntsDir, '/');
+    const char *name = huntPath;
+    if (slash != NULL) {
+        *slash = '\0';
+        name = huntPath + (slash - huntsDir) + 1;
+    } else {
+        strcpy(huntsDir, ".");
+    }
+
+    int lockFile = lockCatalog(huntsDir);
+    if (lockFile == -1) {
+        return;
+    }
+
+    CatalogHeader header;
+    CatalogEntry *entries = NULL;
+    int count = 0;
+    int fd = openCurrentCatalog(huntsDir, O_RDWR, &header);
+    if (fd == -1 || readEntries(fd, &header, &entries, &count) != 0) {
+        // A full rebuild picks this hunt up with the rest.
+        if (fd != -1)
+            close(fd);
+        if (scanHunts(huntsDir, &entries, &count) == 0)
+            writeCatalog(huntsDir, entries, count);
+        free(entries);
+        close(lockFile);
+        return;
+    }
+
+    CatalogEntry key, fresh;
+    memset(&key, 0, sizeof(key));
+    snprintf(key.name, sizeof(key.name), "%s", name);
+    CatalogEntry *found = bsearch(&key, entries, count, sizeof(CatalogEntry), compareEntries);
+    int dirFd = open(huntsDir, O_RDONLY | O_DIRECTORY);
+    int present = dirFd != -1 && statHunt(dirFd, huntsDir, name, &fresh) == 0;
+    if (dirFd != -1)
+        close(dirFd);
+    if (found != NULL && present) {
+        pwriteFull(fd, &fresh, sizeof(fresh), sizeof(header) + (found - entries) * sizeof(CatalogEntry));
+    } else if (found != NULL) {
+        memmove(found, found + 1, (entries + count - found - 1) * sizeof(CatalogEntry));
+        writeCatalog(huntsDir, entries, count - 1);
+    } else if (present) {
+        CatalogEntry *grown = realloc(entries, (count + 1) * sizeof(CatalogEntry));
+        if (grown != NULL) {
+            entries = grown;
+            entries[count] = fresh;
+            qsort(entries, count + 1, sizeof(CatalogEntry), compareEntries);
+            writeCatalog(huntsDir, entries, count + 1);
+        }
+    }
+    close(fd);
+    free(entries);
+    close(lockFile);
+}
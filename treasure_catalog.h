@@ -0,0 +1,32 @@
+#ifndef TREASURE_CATALOG_H
+#define TREASURE_CATALOG_H
+
+#include <stdint.h>
+
+// Hunts/catalog lists every hunt with a treasure file: its name, live
+// treasure count, treasures.dat size and modification time, sorted by
+// name, so listing the hunts is one sequential read. Every write to a hunt
+// updates its entry (in place unless a hunt appears or disappears). The
+// header remembers the modification time of Hunts/ itself, so hunts
+// created or deleted behind the tools' backs make it stale, and the next
+// reader rebuilds it from a scan of the folder.
+#define CATALOG_MAGIC "TCAT"
+#define CATALOG_NAME_LENGTH 64
+
+typedef struct
+{
+    char name[CATALOG_NAME_LENGTH];
+    int32_t treasures;
+    uint32_t reserved;
+    int64_t size;
+    int64_t mtime;
+} CatalogEntry;
+
+// Fills *entries with a malloc'd array of the hunts in huntsDir.
+int readHuntCatalog(const char *huntsDir, CatalogEntry **entries, int *count);
+
+// Refreshes the entry for the hunt at huntPath (e.g. Hunts/Hunt001) after
+// a change to it, dropping it if the hunt is gone.
+void updateHuntCatalog(const char *huntPath);
+
+#endif
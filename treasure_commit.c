@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "treasure_commit.h"
+#include "treasure_index.h"
+
+// A batch stops growing at this many treasures; anything left waits for
+// the next lock holder.
+#define MAX_COMMIT_BATCH 8192
+
+// Pending files are named <pid>.<sequence> and written under a dotted name
+// first, so a lock holder never picks up half of one.
+static int writePending(const char *huntPath, const Treasure *treasures, int count, char *pendingPath)
+{
+    static int sequence;
+    char pendingDir[1100], tempPath[1200];
+    sprintf(pendingDir, "%s/pending", huntPath);
+    if (mkdir(pendingDir, 0755) != 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    int seq = __sync_fetch_and_add(&sequence, 1);
+    sprintf(tempPath, "%s/.%d.%d", pendingDir, (int)getpid(), seq);
+    sprintf(pendingPath, "%s/%d.%d", pendingDir, (int)getpid(), seq);
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = writeFull(fd, treasures, count * sizeof(Treasure));
+    if (close(fd) != 0)
+        result = -1;
+    if (result == 0 && rename(tempPath, pendingPath) != 0)
+        result = -1;
+    if (result != 0)
+        unlink(tempPath);
+    return result;
+}
+
+typedef struct
+{
+    Treasure *treasures;
+    int count;
+    int capacity;
+    char **paths;
+    int pathCount;
+    int pathCapacity;
+} CommitBatch;
+
+static void freeCommitBatch(CommitBatch *batch)
+{
+    for (int i = 0; i < batch->pathCount; i++)
+        free(batch->paths[i]);
+    free(batch->paths);
+    free(batch->treasures);
+}
+
+// Adds one pending file to the batch. Files that cannot be read whole are
+// left for their writer to retry.
+static int loadPending(CommitBatch *batch, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % sizeof(Treasure) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    int count = st.st_size / sizeof(Treasure);
+    if (batch->count + count > batch->capacity) {
+        int capacity = batch->capacity > 0 ? batch->capacity : 64;
+        while (capacity < batch->count + count)
+            capacity *= 2;
+        Treasure *treasures = realloc(batch->treasures, capacity * sizeof(Treasure));
+        if (treasures == NULL) {
+            close(fd);
+            return -1;
+        }
+        batch->treasures = treasures;
+        batch->capacity = capacity;
+    }
+    if (batch->pathCount == batch->pathCapacity) {
+        int capacity = batch->pathCapacity > 0 ? batch->pathCapacity * 2 : 16;
+        char **paths = realloc(batch->paths, capacity * sizeof(char *));
+        if (paths == NULL) {
+            close(fd);
+            return -1;
+        }
+        batch->paths = paths;
+        batch->pathCapacity = capacity;
+    }
+    char *pathCopy = strdup(path);
+    if (pathCopy == NULL || pread(fd, batch->treasures + batch->count, st.st_size, 0) != st.st_size) {
+        free(pathCopy);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    batch->paths[batch->pathCount++] = pathCopy;
+    batch->count += count;
+    return 0;
+}
+
+// A lock holder that died between its append and its unlinks leaves
+// pending files that are already written. Their IDs are below the header's
+// nextId and present in the hunt, so they are dropped here rather than
+// added twice.
+static int dropCommitted(const char *huntPath, CommitBatch *batch)
+{
+    TreasureCounts counts;
+    int nextId = readTreasureCounts(huntPath, &counts) == 0 ? counts.nextId : INT_MAX;
+
+    int *ids = malloc(batch->count * sizeof(int));
+    int *positions = malloc(batch->count * sizeof(int));
+    if (ids == NULL || positions == NULL) {
+        free(ids);
+        free(positions);
+        return -1;
+    }
+    int checkCount = 0;
+    for (int i = 0; i < batch->count; i++) {
+        if (batch->treasures[i].id < nextId) {
+            ids[checkCount] = batch->treasures[i].id;
+            positions[checkCount++] = i;
+        }
+    }
+
+    int result = 0;
+    if (checkCount > 0) {
+        Treasure *existing = malloc(checkCount * sizeof(Treasure));
+        char *found = malloc(checkCount);
+        if (existing == NULL || found == NULL ||
+            lookupTreasures(huntPath, ids, checkCount, existing, found) < 0) {
+            result = -1;
+        } else {
+            for (int i = 0; i < checkCount; i++) {
+                if (found[i])
+                    batch->treasures[positions[i]].id = 0;
+            }
+            int kept = 0;
+            for (int i = 0; i < batch->count; i++) {
+                if (batch->treasures[i].id != 0)
+                    batch->treasures[kept++] = batch->treasures[i];
+            }
+            batch->count = kept;
+        }
+        free(existing);
+        free(found);
+    }
+    free(ids);
+    free(positions);
+    return result;
+}
+
+static int appendAndIndex(const char *huntPath, const Treasure *treasures, int count)
+{
+    off_t offset;
+    if (appendTreasures(huntPath, treasures, count, &offset) != 0) {
+        return -1;
+    }
+    int *ids = malloc(count * sizeof(int));
+    if (ids == NULL) {
+        rebuildTreasureIndex(huntPath);
+        return 0;
+    }
+    for (int i = 0; i < count; i++)
+        ids[i] = treasures[i].id;
+    recordTreasureIndexes(huntPath, ids, count, offset, sizeof(HotRow));
+    free(ids);
+    return 0;
+}
+
+// Appends the caller's pending file and as many others as fit in one
+// batch. The caller holds the hunt lock.
+static int commitPending(const char *huntPath, const char *ownPath)
+{
+    CommitBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    if (loadPending(&batch, ownPath) != 0) {
+        freeCommitBatch(&batch);
+        unlink(ownPath);
+        return -1;
+    }
+
+    char pendingDir[1100];
+    sprintf(pendingDir, "%s/pending", huntPath);
+    DIR *dir = opendir(pendingDir);
+    if (dir != NULL) {
+        struct dirent *entry;
+        char path[1400];
+        while (batch.count < MAX_COMMIT_BATCH && (entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
+            snprintf(path, sizeof(path), "%s/%s", pendingDir, entry->d_name);
+            if (strcmp(path, ownPath) != 0)
+                loadPending(&batch, path);
+        }
+        closedir(dir);
+    }
+
+    int result = dropCommitted(huntPath, &batch);
+    if (result == 0 && batch.count > 0)
+        result = appendAndIndex(huntPath, batch.treasures, batch.count);
+    // On failure the other writers' files stay for them to retry.
+    for (int i = 0; i < batch.pathCount; i++) {
+        if (result == 0 || strcmp(batch.paths[i], ownPath) == 0)
+            unlink(batch.paths[i]);
+    }
+    freeCommitBatch(&batch);
+    return result;
+}
+
+int commitTreasures(const char *huntPath, const Treasure *treasures, int count)
+{
+    char pendingPath[1200];
+    if (writePending(huntPath, treasures, count, pendingPath) != 0) {
+        // Without a pending file this writer appends on its own.
+        int lockFile = lockHunt(huntPath, 1);
+        if (lockFile == -1)
+            return -1;
+        int result = appendAndIndex(huntPath, treasures, count);
+        unlockHunt(lockFile);
+        return result;
+    }
+
+    int lockFile = lockHunt(huntPath, 1);
+    if (lockFile == -1) {
+        // Withdraw the records so no later leader commits what we report as failed.
+        unlink(pendingPath);
+        return -1;
+    }
+    int result = 0;
+    if (access(pendingPath, F_OK) == 0) {
+        result = commitPending(huntPath, pendingPath);
+    }
+    unlockHunt(lockFile);
+    return result;
+}
@@ -0,0 +1,19 @@
+#ifndef TREASURE_COMMIT_H
+#define TREASURE_COMMIT_H
+
+#include "treasure_store.h"
+
+// Group commit for writers adding to the same hunt. Each writer reserves
+// its IDs with reserveTreasureIds, drops its treasures into
+// Hunts/<id>/pending/ and then waits for the hunt lock. Whoever gets the
+// lock appends everything pending in one batch, so writers queued behind
+// it usually find their treasures already written and leave at once.
+// The scores, clue index and ID index are updated once per batch instead
+// of once per treasure, which is what lets throughput grow with the
+// number of writers.
+
+// Adds treasures whose IDs were reserved by the caller. Returns once they
+// are in treasures.dat, 0 on success and -1 on failure.
+int commitTreasures(const char *huntPath, const Treasure *treasures, int count);
+
+#endif
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_grid.h"
+
+#define GRID_MAGIC 0x44524754 // "TGRD"
+#define GRID_VERSION 1
+#define GRID_PER_CELL 4
+#define GRID_MAX_SIDE 2048
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t dataIno;
+    int64_t dataSize;
+    double minX, minY;
+    double cellWidth, cellHeight;
+    int32_t columns;
+    int32_t rows;
+    int32_t entryCount;
+    int32_t reserved;
+} GridHeader;
+
+// The file is the header, columns * rows + 1 cell start indexes (cell c
+// holds entries cellStart[c] up to cellStart[c + 1]), then the entries,
+// aligned for their 64-bit offsets.
+static size_t entriesOffset(int cellCount)
+{
+    size_t offset = sizeof(GridHeader) + ((size_t)cellCount + 1) * sizeof(uint32_t);
+    return (offset + 7) & ~(size_t)7;
+}
+
+static size_t imageLength(int cellCount, int entryCount)
+{
+    return entriesOffset(cellCount) + (size_t)entryCount * sizeof(GridEntry);
+}
+
+static void gridPath(const char *huntPath, char *path)
+{
+    sprintf(path, "%s/treasures.grid", huntPath);
+}
+
+static void attachImage(TreasureGrid *grid, void *base, size_t length, int mapped)
+{
+    const GridHeader *header = base;
+    grid->base = base;
+    grid->length = length;
+    grid->mapped = mapped;
+    grid->minX = header->minX;
+    grid->minY = header->minY;
+    grid->cellWidth = header->cellWidth;
+    grid->cellHeight = header->cellHeight;
+    grid->columns = header->columns;
+    grid->rows = header->rows;
+    grid->cellStart = (const uint32_t *)((const char *)base + sizeof(GridHeader));
+    grid->entries = (const GridEntry *)((const char *)base + entriesOffset(header->columns * header->rows));
+}
+
+static int columnOf(const TreasureGrid *grid, double x)
+{
+    double column = floor((x - grid->minX) / grid->cellWidth);
+    if (column < 0)
+        return 0;
+    if (column >= grid->columns)
+        return grid->columns - 1;
+    return (int)column;
+}
+
+static int rowOf(const TreasureGrid *grid, double y)
+{
+    double row = floor((y - grid->minY) / grid->cellHeight);
+    if (row < 0)
+        return 0;
+    if (row >= grid->rows)
+        return grid->rows - 1;
+    return (int)row;
+}
+
+// Maps the grid file if it was built from exactly this data file.
+static int openCurrentGrid(const char *path, const TreasureMap *map, TreasureGrid *grid)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(GridHeader)) {
+        close(fd);
+        return -1;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    const GridHeader *header = base;
+    if (header->magic != GRID_MAGIC || header->version != GRID_VERSION || header->dataIno != map->inode ||
+        header->dataSize != (int64_t)map->length || header->columns <= 0 || header->rows <= 0 ||
+        header->columns > GRID_MAX_SIDE || header->rows > GRID_MAX_SIDE || header->entryCount < 0 ||
+        (size_t)st.st_size != imageLength(header->columns * header->rows, header->entryCount)) {
+        munmap(base, st.st_size);
+        return -1;
+    }
+    attachImage(grid, base, st.st_size, 1);
+    return 0;
+}
+
+// Lays out a grid image in memory from the live records of map. Records
+// with coordinates that are not finite numbers cannot match any search and
+// are left out.
+static void *buildGridImage(const TreasureMap *map, size_t *length)
+{
+    TreasureCursor cursor;
+    TreasureRecord record;
+    int entryCount = 0;
+    double minX = 0, minY = 0, maxX = 0, maxY = 0;
+    startTreasureCursor(map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (!TREASURE_IS_LIVE(&record) || !isfinite(record.coord.x) || !isfinite(record.coord.y))
+            continue;
+        if (entryCount == 0 || record.coord.x < minX)
+            minX = record.coord.x;
+        if (entryCount == 0 || record.coord.y < minY)
+            minY = record.coord.y;
+        if (entryCount == 0 || record.coord.x > maxX)
+            maxX = record.coord.x;
+        if (entryCount == 0 || record.coord.y > maxY)
+            maxY = record.coord.y;
+        entryCount++;
+    }
+
+    int side = (int)ceil(sqrt((double)entryCount / GRID_PER_CELL));
+    if (side < 1)
+        side = 1;
+    if (side > GRID_MAX_SIDE)
+        side = GRID_MAX_SIDE;
+    int cellCount = side * side;
+
+    *length = imageLength(cellCount, entryCount);
+    char *image = calloc(1, *length);
+    uint32_t *cells = calloc((size_t)entryCount + 1, sizeof(uint32_t));
+    if (image == NULL || cells == NULL) {
+        free(image);
+        free(cells);
+        return NULL;
+    }
+
+    GridHeader *header = (GridHeader *)image;
+    header->magic = GRID_MAGIC;
+    header->version = GRID_VERSION;
+    header->dataIno = map->inode;
+    header->dataSize = map->length;
+    header->minX = minX;
+    header->minY = minY;
+    header->cellWidth = maxX > minX ? (maxX - minX) / side : 1.0;
+    header->cellHeight = maxY > minY ? (maxY - minY) / side : 1.0;
+    header->columns = side;
+    header->rows = side;
+    header->entryCount = entryCount;
+
+    TreasureGrid grid;
+    attachImage(&grid, image, *length, 0);
+    uint32_t *cellStart = (uint32_t *)grid.cellStart;
+    GridEntry *entries = (GridEntry *)grid.entries;
+
+    // Counting sort by cell: count, turn the counts into start indexes,
+    // then drop each record into the next free slot of its cell.
+    int index = 0;
+    startTreasureCursor(map, &cursor);
+    while (nextTreasure(&cursor, &record) && index < entryCount) {
+        if (!TREASURE_IS_LIVE(&record) || !isfinite(record.coord.x) || !isfinite(record.coord.y))
+            continue;
+        cells[index] = rowOf(&grid, record.coord.y) * side + columnOf(&grid, record.coord.x);
+        cellStart[cells[index] + 1]++;
+        index++;
+    }
+    for (int cell = 0; cell < cellCount; cell++) {
+        cellStart[cell + 1] += cellStart[cell];
+    }
+
+    index = 0;
+    startTreasureCursor(map, &cursor);
+    while (nextTreasure(&cursor, &record) && index < entryCount) {
+        if (!TREASURE_IS_LIVE(&record) || !isfinite(record.coord.x) || !isfinite(record.coord.y))
+            continue;
+        // cellStart[c] is used as the fill position and ends up at the
+        // start of cell c + 1, so shift everything back afterwards.
+        GridEntry *entry = &entries[cellStart[cells[index]]++];
+        entry->x = record.coord.x;
+        entry->y = record.coord.y;
+        entry->offset = record.offset;
+        index++;
+    }
+    memmove(cellStart + 1, cellStart, cellCount * sizeof(uint32_t));
+    cellStart[0] = 0;
+
+    free(cells);
+    return image;
+}
+
+static int writeGridImage(const char *path, const void *image, size_t length)
+{
+    // Several readers may rebuild at once; each writes its own file.
+    static unsigned int sequence = 0;
+    char tempPath[1200];
+    sprintf(tempPath, "%s.%d.%u", path, (int)getpid(), __sync_fetch_and_add(&sequence, 1));
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int result = 0;
+    size_t done = 0;
+    while (done < length) {
+        ssize_t bytes = write(fd, (const char *)image + done, length - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0) {
+            result = -1;
+            break;
+        }
+        done += bytes;
+    }
+    if (close(fd) != 0)
+        result = -1;
+    if (result == 0 && rename(tempPath, path) != 0)
+        result = -1;
+    if (result != 0)
+        unlink(tempPath);
+    return result;
+}
+
+int openTreasureGrid(const char *huntPath, const TreasureMap *map, TreasureGrid *grid)
+{
+    char path[1100];
+    gridPath(huntPath, path);
+    memset(grid, 0, sizeof(*grid));
+    if (openCurrentGrid(path, map, grid) == 0) {
+        return 0;
+    }
+
+    size_t length;
+    void *image = buildGridImage(map, &length);
+    if (image == NULL) {
+        return -1;
+    }
+    // The grid is only a cache: a hunt we cannot write to is still searched.
+    writeGridImage(path, image, length);
+    attachImage(grid, image, length, 0);
+    return 0;
+}
+
+void closeTreasureGrid(TreasureGrid *grid)
+{
+    if (grid->base != NULL) {
+        if (grid->mapped)
+            munmap(grid->base, grid->length);
+        else
+            free(grid->base);
+    }
+    memset(grid, 0, sizeof(*grid));
+}
+
+static int isLiveAt(const TreasureMap *map, int64_t offset)
+{
+    int32_t id;
+    const void *record = treasureRecordAt(map, offset);
+    if (record == NULL) {
+        return 0;
+    }
+    memcpy(&id, record, sizeof(id));
+    return id > 0;
+}
+
+typedef struct
+{
+    GridMatch *items;
+    int count;
+    int capacity;
+} MatchList;
+
+static int addMatch(MatchList *list, int64_t offset, double distance)
+{
+    if (list->count == list->capacity) {
+        int capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+        GridMatch *items = realloc(list->items, capacity * sizeof(GridMatch));
+        if (items == NULL) {
+            return -1;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count].offset = offset;
+    list->items[list->count].distance = distance;
+    list->count++;
+    return 0;
+}
+
+static int compareOffsets(const void *a, const void *b)
+{
+    const GridMatch *left = a, *right = b;
+    return (left->offset > right->offset) - (left->offset < right->offset);
+}
+
+static int compareDistances(const void *a, const void *b)
+{
+    const GridMatch *left = a, *right = b;
+    if (left->distance != right->distance)
+        return left->distance < right->distance ? -1 : 1;
+    return compareOffsets(a, b);
+}
+
+// Visits the cells overlapping the box and keeps the live entries inside
+// it, or within radius of (x, y) when radius is not negative.
+static int searchBox(const TreasureGrid *grid, const TreasureMap *map, double x1, double y1, double x2, double y2,
+                     double x, double y, double radius, MatchList *list)
+{
+    int column1 = columnOf(grid, x1), column2 = columnOf(grid, x2);
+    int row1 = rowOf(grid, y1), row2 = rowOf(grid, y2);
+    for (int row = row1; row <= row2; row++) {
+        for (int column = column1; column <= column2; column++) {
+            int cell = row * grid->columns + column;
+            for (uint32_t i = grid->cellStart[cell]; i < grid->cellStart[cell + 1]; i++) {
+                const GridEntry *entry = &grid->entries[i];
+                if (entry->x < x1 || entry->x > x2 || entry->y < y1 || entry->y > y2)
+                    continue;
+                double distance = 0;
+                if (radius >= 0) {
+                    distance = hypot(entry->x - x, entry->y - y);
+                    if (distance > radius)
+                        continue;
+                }
+                if (isLiveAt(map, entry->offset) && addMatch(list, entry->offset, distance) != 0)
+                    return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int findTreasuresWithin(const TreasureGrid *grid, const TreasureMap *map, double x1, double y1, double x2, double y2,
+                        GridMatch **matches, int *count)
+{
+    MatchList list = {NULL, 0, 0};
+    if (searchBox(grid, map, fmin(x1, x2), fmin(y1, y2), fmax(x1, x2), fmax(y1, y2), 0, 0, -1, &list) != 0) {
+        free(list.items);
+        return -1;
+    }
+    qsort(list.items, list.count, sizeof(GridMatch), compareOffsets);
+    *matches = list.items;
+    *count = list.count;
+    return 0;
+}
+
+int findTreasuresNearby(const TreasureGrid *grid, const TreasureMap *map, double x, double y, double radius,
+                        GridMatch **matches, int *count)
+{
+    MatchList list = {NULL, 0, 0};
+    if (searchBox(grid, map, x - radius, y - radius, x + radius, y + radius, x, y, radius, &list) != 0) {
+        free(list.items);
+        return -1;
+    }
+    qsort(list.items, list.count, sizeof(GridMatch), compareDistances);
+    *matches = list.items;
+    *count = list.count;
+    return 0;
+}
+
+// Max-heap on distance holding the best k matches so far.
+static void siftDownFarthest(GridMatch *heap, int count, int index)
+{
+    while (1) {
+        int largest = index, left = 2 * index + 1, right = left + 1;
+        if (left < count && compareDistances(&heap[left], &heap[largest]) > 0)
+            largest = left;
+        if (right < count && compareDistances(&heap[right], &heap[largest]) > 0)
+            largest = right;
+        if (largest == index)
+            return;
+        GridMatch swap = heap[index];
+        heap[index] = heap[largest];
+        heap[largest] = swap;
+        index = largest;
+    }
+}
+
+static void offerMatch(GridMatch *heap, int *count, int k, int64_t offset, double distance)
+{
+    GridMatch match = {offset, distance};
+    if (*count < k) {
+        int index = (*count)++;
+        heap[index] = match;
+        while (index > 0 && compareDistances(&heap[(index - 1) / 2], &heap[index]) < 0) {
+            GridMatch swap = heap[index];
+            heap[index] = heap[(index - 1) / 2];
+            heap[(index - 1) / 2] = swap;
+            index = (index - 1) / 2;
+        }
+    } else if (compareDistances(&match, &heap[0]) < 0) {
+        heap[0] = match;
+        siftDownFarthest(heap, *count, 0);
+    }
+}
+
+// Searches rings of cells outwards from the one holding (x, y). After ring
+// r everything unvisited lies outside the square of cells searched so far,
+// so once the k-th best is no farther than that square's nearest edge the
+// answer cannot change.
+int findNearestTreasures(const TreasureGrid *grid, const TreasureMap *map, double x, double y, int k,
+                         GridMatch **matches, int *count)
+{
+    int entryCount = grid->cellStart[grid->columns * grid->rows];
+    if (k > entryCount)
+        k = entryCount;
+    GridMatch *heap = malloc((k > 0 ? k : 1) * sizeof(GridMatch));
+    if (heap == NULL) {
+        return -1;
+    }
+    int found = 0;
+    int centerColumn = columnOf(grid, x), centerRow = rowOf(grid, y);
+    int maxRing = grid->columns > grid->rows ? grid->columns : grid->rows;
+
+    for (int ring = 0; ring < maxRing && k > 0; ring++) {
+        for (int row = centerRow - ring; row <= centerRow + ring; row++) {
+            if (row < 0 || row >= grid->rows)
+                continue;
+            int onEdge = row == centerRow - ring || row == centerRow + ring;
+            int step = onEdge ? 1 : 2 * ring;
+            for (int column = centerColumn - ring; column <= centerColumn + ring; column += step > 0 ? step : 1) {
+                if (column < 0 || column >= grid->columns)
+                    continue;
+                int cell = row * grid->columns + column;
+                for (uint32_t i = grid->cellStart[cell]; i < grid->cellStart[cell + 1]; i++) {
+                    const GridEntry *entry = &grid->entries[i];
+                    if (isLiveAt(map, entry->offset))
+                        offerMatch(heap, &found, k, entry->offset, hypot(entry->x - x, entry->y - y));
+                }
+            }
+        }
+
+        if (found < k)
+            continue;
+        double bound = INFINITY;
+        if (centerColumn - ring > 0)
+            bound = fmin(bound, x - (grid->minX + (centerColumn - ring) * grid->cellWidth));
+        if (centerColumn + ring < grid->columns - 1)
+            bound = fmin(bound, grid->minX + (centerColumn + ring + 1) * grid->cellWidth - x);
+        if (centerRow - ring > 0)
+            bound = fmin(bound, y - (grid->minY + (centerRow - ring) * grid->cellHeight));
+        if (centerRow + ring < grid->rows - 1)
+            bound = fmin(bound, grid->minY + (centerRow + ring + 1) * grid->cellHeight - y);
+        if (heap[0].distance <= bound)
+            break;
+    }
+
+    qsort(heap, found, sizeof(GridMatch), compareDistances);
+    *matches = heap;
+    *count = found;
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef TREASURE_GRID_H
+#define TREASURE_GRID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "treasure_store.h"
+
+// treasures.grid sits next to treasures.dat and buckets the live treasures
+// by coordinate into a uniform grid over their bounding box, sized so a
+// cell holds a handful of treasures. Like treasures.idx it remembers the
+// inode and size of the data file it was built from and is rebuilt on the
+// next query after any append or rewrite. Removes leave it alone: entries
+// point at records, and tombstoned ones are skipped when they are read.
+typedef struct
+{
+    float x, y;
+    int64_t offset;
+} GridEntry;
+
+typedef struct
+{
+    void *base;
+    size_t length;
+    int mapped;
+    double minX, minY;
+    double cellWidth, cellHeight;
+    int columns, rows;
+    const uint32_t *cellStart;
+    const GridEntry *entries;
+} TreasureGrid;
+
+// A live treasure found by a search: its record offset in the map and its
+// distance from the search point (0 for box searches).
+typedef struct
+{
+    int64_t offset;
+    double distance;
+} GridMatch;
+
+// Opens the grid for the data file behind map, building it first if it is
+// missing or stale.
+int openTreasureGrid(const char *huntPath, const TreasureMap *map, TreasureGrid *grid);
+void closeTreasureGrid(TreasureGrid *grid);
+
+// Each search fills *matches with a malloc'd array. Box matches come in
+// record order, radius and nearest matches closest first.
+int findTreasuresWithin(const TreasureGrid *grid, const TreasureMap *map, double x1, double y1, double x2, double y2,
+                        GridMatch **matches, int *count);
+int findTreasuresNearby(const TreasureGrid *grid, const TreasureMap *map, double x, double y, double radius,
+                        GridMatch **matches, int *count);
+int findNearestTreasures(const TreasureGrid *grid, const TreasureMap *map, double x, double y, int k,
+                         GridMatch **matches, int *count);
+
+#endif
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 199309L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,281 +7,1065 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "treasure_query.h"
+#include "treasure_log.h"
+#include "treasure_stats.h"
+#include "treasure_cache.h"
 
 #define MAX_COMMAND_LEN 2048
-#define MAX_RESPONSE_LEN 4096
-#define COMMAND_FILE "monitor_command.txt"
-#define RESPONSE_FILE "monitor_response.txt"
+#define MONITOR_TIMEOUT_MS 10000
+#define MONITOR_CHUNK_LEN 4096
+#define MONITOR_SOCKET "treasure_monitor.sock"
+// A client whose unsent replies pass this is not read from until it
+// catches up.
+#define MONITOR_OUTPUT_LIMIT (1024 * 1024)
 
-pid_t monitor_pid = -1;
+pid_t monitor_pid = -1; // Our own monitor, if this hub started it
 int monitor_running = 0;
-int waiting_for_monitor = 0;
+int monitor_fd = -1; // Connection to the monitor
+uint32_t next_request_id = 0; // Tags our requests so late replies can be told apart
+char socket_path[108];
 
-int mon_to_main_pipe[2]; // Monitor to Main process pipe
-int main_to_mon_pipe[2]; // Main to Monitor process pipe
+// Requests and replies travel as frames: a uint32_t byte count, a uint32_t
+// request ID chosen by the client, then that many bytes. Each side knows
+// exactly where a message ends, so nobody has to signal the other or guess
+// how much to read. A request is one frame; a reply is any number of data
+// frames of at most MONITOR_CHUNK_LEN bytes carrying the request's ID,
+// ended by an empty one. Replies to different requests may interleave and
+// finish in any order.
+typedef struct {
+    uint32_t len;
+    uint32_t id;
+} FrameHeader;
 
-void monitor_response_handler(int signum) {
-    char buffer[MAX_RESPONSE_LEN];
-    ssize_t bytes_read = read(mon_to_main_pipe[0], buffer, sizeof(buffer) - 1);
-    
-    if (bytes_read > 0) {
-        buffer[bytes_read] = '\0';
-        printf("%s", buffer);
+int write_all(int fd, const void *data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t bytes = write(fd, (const char *)data + done, len - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        done += bytes;
     }
-    
-    waiting_for_monitor = 0;
+    return 0;
 }
 
-void monitor_terminated_handler(int signum) {
-    int status;
-    pid_t pid;
-    
-    pid = waitpid(monitor_pid, &status, WNOHANG);
-    if (pid == monitor_pid) {
-        printf("Monitor process has terminated.\n");
-        monitor_running = 0;
-        waiting_for_monitor = 0;
-        monitor_pid = -1;
+int write_frame(int fd, uint32_t id, const char *data, uint32_t len) {
+    FrameHeader header = { len, id };
+    if (write_all(fd, &header, sizeof(header)) != 0 || write_all(fd, data, len) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Reads exactly len bytes. Gives up with ETIMEDOUT if the socket stays silent
+// for timeout_ms (-1 waits forever); EOF is reported as EPIPE.
+int read_all(int fd, void *data, size_t len, int timeout_ms) {
+    size_t done = 0;
+    while (done < len) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
+            return -1;
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
         
-        close(mon_to_main_pipe[0]);
-        close(main_to_mon_pipe[1]);
+        ssize_t bytes = read(fd, (char *)data + done, len - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -1;
+        if (bytes == 0) {
+            errno = EPIPE;
+            return -1;
+        }
+        done += bytes;
     }
+    return 0;
 }
 
-void handle_command(int signum) {
-    // Not needed anymore as we use pipes directly
+// Reads one frame into buffer and returns its length. Only the wait for a
+// frame to start can time out; once it has, the rest is already on its way.
+ssize_t read_frame(int fd, uint32_t *id, char *buffer, uint32_t max_len, int timeout_ms) {
+    FrameHeader header;
+    if (read_all(fd, &header, sizeof(header), timeout_ms) != 0) {
+        return -1;
+    }
+    if (header.len > max_len) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (read_all(fd, buffer, header.len, -1) != 0) {
+        return -1;
+    }
+    *id = header.id;
+    return header.len;
 }
 
-void monitor_process() {
-    struct sigaction sa;
-    
-    sa.sa_handler = SIG_IGN;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = 0;
-    sigaction(SIGUSR1, &sa, NULL);
-    
-    sa.sa_handler = handle_command;
-    sigaction(SIGUSR2, &sa, NULL);
-    
-    close(mon_to_main_pipe[0]); 
-    close(main_to_mon_pipe[1]);
+// The monitor is a server on a Unix domain socket (TREASURE_MONITOR_SOCKET,
+// or treasure_monitor.sock in the working folder). Each hub, dashboard or
+// script connects and speaks the frames above. One epoll loop reads
+// requests from every client without blocking on any of them and queues
+// them for a fixed pool of workers, so a quick view_treasure is answered
+// while a long calculate_score is still running. Workers print straight
+// into the client's output buffer, which goes out as its socket takes it.
+typedef struct MonitorClient {
+    int fd;
+    char in[sizeof(FrameHeader) + MAX_COMMAND_LEN];
+    size_t in_len;
+    // Guards everything below; drained is signalled as output goes out.
+    pthread_mutex_t lock;
+    pthread_cond_t drained;
+    char *out;
+    size_t out_len, out_sent, out_cap;
+    int broken;
+    int refs; // One for the connection, one per request in flight
+    int active; // Requests queued or running
+    int paused; // Not read from until one of them finishes
+    struct MonitorClient *next;
+} MonitorClient;
+
+typedef struct {
+    MonitorClient *client;
+    uint32_t id;
+    struct timespec queued;
+    char command[MAX_COMMAND_LEN];
+} MonitorRequest;
+
+typedef struct {
+    MonitorRequest *queue;
+    int capacity, head, count;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    pthread_t *workers;
+    int worker_count;
+    int busy;
+    // No client has more requests than this in flight, so one that is
+    // slow to read its replies cannot hold every worker.
+    int client_limit;
+    int wake_fd; // Tells the loop a paused client can go on
+    MonitorStats stats;
+    pthread_mutex_t stats_lock;
+} MonitorPool;
+
+int epoll_fd = -1;
+MonitorClient *clients = NULL;
+MonitorPool pool;
+static int listen_marker, cache_marker, wake_marker;
+
+// Sends what the socket takes now; the rest waits for EPOLLOUT. Called
+// with the client's lock held.
+int flush_client(MonitorClient *client) {
+    while (client->out_sent < client->out_len) {
+        ssize_t bytes = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent,
+                             MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (bytes <= 0) {
+            client->broken = 1;
+            pthread_cond_broadcast(&client->drained);
+            return -1;
+        }
+        client->out_sent += bytes;
+    }
+    client->out_len = client->out_sent = 0;
+    pthread_cond_broadcast(&client->drained);
+    return 0;
+}
+
+int queue_output(MonitorClient *client, const void *data, size_t len) {
+    if (client->broken) {
+        return -1;
+    }
+    if (client->out_len + len > client->out_cap) {
+        size_t cap = client->out_cap == 0 ? MONITOR_CHUNK_LEN * 4 : client->out_cap;
+        while (cap < client->out_len + len)
+            cap *= 2;
+        char *grown = realloc(client->out, cap);
+        if (grown == NULL) {
+            client->broken = 1;
+            return -1;
+        }
+        client->out = grown;
+        client->out_cap = cap;
+    }
+    memcpy(client->out + client->out_len, data, len);
+    client->out_len += len;
+    return 0;
+}
+
+// Queues and starts sending one frame. Called with the client's lock held.
+int queue_frame(MonitorClient *client, uint32_t id, const char *data, uint32_t len) {
+    FrameHeader header = { len, id };
+    if (queue_output(client, &header, sizeof(header)) != 0 || queue_output(client, data, len) != 0) {
+        return -1;
+    }
+    return flush_client(client);
+}
+
+void send_reply(MonitorClient *client, uint32_t id, const char *text) {
+    pthread_mutex_lock(&client->lock);
+    if (queue_frame(client, id, text, strlen(text)) == 0)
+        queue_frame(client, id, "", 0);
+    pthread_mutex_unlock(&client->lock);
+}
+
+void release_client(MonitorClient *client) {
+    pthread_mutex_lock(&client->lock);
+    int last = --client->refs == 0;
+    pthread_mutex_unlock(&client->lock);
+    if (last) {
+        close(client->fd);
+        pthread_mutex_destroy(&client->lock);
+        pthread_cond_destroy(&client->drained);
+        free(client->out);
+        free(client);
+    }
+}
+
+typedef struct {
+    MonitorClient *client;
+    uint32_t id;
+    size_t bytes;
+} ReplyStream;
+
+// A worker prints its reply into a stdio stream whose buffer becomes one
+// data frame at a time in the client's output. A client that is not
+// reading holds up only the worker writing to it.
+ssize_t reply_stream_write(void *cookie, const char *data, size_t len) {
+    ReplyStream *reply = cookie;
+    MonitorClient *client = reply->client;
+    pthread_mutex_lock(&client->lock);
+    while (!client->broken && client->out_len - client->out_sent > MONITOR_OUTPUT_LIMIT)
+        pthread_cond_wait(&client->drained, &client->lock);
+    size_t done = 0;
+    while (done < len) {
+        // Never send an empty frame here: that would end the reply.
+        uint32_t chunk = len - done < MONITOR_CHUNK_LEN ? len - done : MONITOR_CHUNK_LEN;
+        if (queue_frame(client, reply->id, data + done, chunk) != 0 && client->broken) {
+            pthread_mutex_unlock(&client->lock);
+            return -1;
+        }
+        done += chunk;
+    }
+    pthread_mutex_unlock(&client->lock);
+    reply->bytes += len;
+    return len;
+}
+
+FILE *open_reply_stream(ReplyStream *reply) {
+    cookie_io_functions_t io = { .write = reply_stream_write };
+    FILE *out = fopencookie(reply, "w", io);
+    if (out != NULL) {
+        setvbuf(out, NULL, _IOFBF, MONITOR_CHUNK_LEN);
+    }
+    return out;
+}
+
+// Flushes what is left of the reply and queues the closing empty frame.
+int end_reply_stream(FILE *out, ReplyStream *reply) {
+    int failed = ferror(out);
+    if (fclose(out) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        return -1;
+    }
+    pthread_mutex_lock(&reply->client->lock);
+    int result = queue_frame(reply->client, reply->id, "", 0);
+    pthread_mutex_unlock(&reply->client->lock);
+    return result;
+}
+
+void print_pool_stats(FILE *out) {
+    pthread_mutex_lock(&pool.lock);
+    fprintf(out, "Workers: %d (%d busy), queued requests: %d of %d\n", pool.worker_count, pool.busy, pool.count,
+            pool.capacity);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Runs one request, printing the reply into out. Returns 1 if it failed.
+int handle_request(const char *command, FILE *out, const char **name) {
+    int failed = 0;
+    if (strcmp(command, "stats") == 0) {
+        *name = "stats";
+        pthread_mutex_lock(&pool.stats_lock);
+        printMonitorStats(&pool.stats, out);
+        pthread_mutex_unlock(&pool.stats_lock);
+        print_pool_stats(out);
+        printHuntCacheStats(out);
+    }
+    else if (strcmp(command, "stats reset") == 0) {
+        *name = "stats";
+        pthread_mutex_lock(&pool.stats_lock);
+        resetMonitorStats(&pool.stats);
+        pthread_mutex_unlock(&pool.stats_lock);
+        fprintf(out, "Monitor statistics reset.\n");
+    }
+    else if (strncmp(command, "list_hunts", 10) == 0) {
+        *name = "list_hunts";
+        failed = queryListHunts(out);
+    } 
+    else if (strncmp(command, "list_treasures", 14) == 0) {
+        *name = "list_treasures";
+        char args[MAX_COMMAND_LEN];
+        char *list_argv[64];
+        int list_argc = 0;
+        strcpy(args, command + 14);
+        char *save;
+        for (char *token = strtok_r(args, " \t", &save); token != NULL && list_argc < 64;
+             token = strtok_r(NULL, " \t", &save)) {
+            list_argv[list_argc++] = token;
+        }
+        
+        ListRequest request;
+        if (parseListRequest(list_argc, list_argv, &request) == 0) {
+            failed = queryListTreasures(&request, out);
+        } else {
+            fprintf(out, "Invalid command format. Use: list_treasures <HuntID> [--offset N] [--limit N] [--user NAME] [--min-value V] [--fields id,user,coord,clue,value]\n");
+            failed = 1;
+        }
+    }
+    else if (strncmp(command, "view_treasure", 13) == 0) {
+        *name = "view_treasure";
+        char hunt_id[100];
+        int treasure_id;
+        if (sscanf(command, "view_treasure %99s %d", hunt_id, &treasure_id) == 2) {
+            failed = queryViewTreasure(hunt_id, treasure_id, out);
+        } else {
+            fprintf(out, "Invalid command format. Use: view_treasure <HuntID> <TreasureID>\n");
+            failed = 1;
+        }
+    }
+    else if (strncmp(command, "calculate_score", 15) == 0) {
+        *name = "calculate_score";
+        // Every argument is passed on, so one request can cover several
+        // hunts (calculate_score HuntA HuntB ... or calculate_score --all).
+        char args[MAX_COMMAND_LEN];
+        char *score_argv[64];
+        int score_argc = 0;
+        strcpy(args, command + 15);
+        char *save;
+        for (char *token = strtok_r(args, " \t", &save); token != NULL && score_argc < 64;
+             token = strtok_r(NULL, " \t", &save)) {
+            score_argv[score_argc++] = token;
+        }
+        
+        ScoreRequest request;
+        if (parseScoreRequest(score_argc, score_argv, &request) == 0) {
+            if (queryScores(&request, out) != 0) {
+                fprintf(out, "Score calculation failed.\n");
+                failed = 1;
+            }
+            freeScoreRequest(&request);
+        } else {
+            fprintf(out, "Invalid command format. Use: calculate_score <HuntID> [HuntID...] | --all [--top K] [--breakdown]\n");
+            failed = 1;
+        }
+    }
+    else if (strncmp(command, "nearby", 6) == 0) {
+        *name = "nearby";
+        char hunt_id[100];
+        double x, y, radius;
+        if (sscanf(command, "nearby %99s %lf %lf %lf", hunt_id, &x, &y, &radius) == 4 && radius >= 0) {
+            failed = queryNearby(hunt_id, x, y, radius, out);
+        } else {
+            fprintf(out, "Invalid command format. Use: nearby <HuntID> <x> <y> <radius>\n");
+            failed = 1;
+        }
+    }
+    else if (strncmp(command, "within", 6) == 0) {
+        *name = "within";
+        char hunt_id[100];
+        double x1, y1, x2, y2;
+        if (sscanf(command, "within %99s %lf %lf %lf %lf", hunt_id, &x1, &y1, &x2, &y2) == 5) {
+            failed = queryWithin(hunt_id, x1, y1, x2, y2, out);
+        } else {
+            fprintf(out, "Invalid command format. Use: within <HuntID> <x1> <y1> <x2> <y2>\n");
+            failed = 1;
+        }
+    }
+    else if (strncmp(command, "nearest", 7) == 0) {
+        *name = "nearest";
+        char hunt_id[100];
+        double x, y;
+        int k;
+        if (sscanf(command, "nearest %99s %lf %lf %d", hunt_id, &x, &y, &k) == 4 && k > 0) {
+            failed = queryNearest(hunt_id, x, y, k, out);
+        } else {
+            fprintf(out, "Invalid command format. Use: nearest <HuntID> <x> <y> <k>\n");
+            failed = 1;
+        }
+    }
+    else if (strncmp(command, "search", 6) == 0) {
+        *name = "search";
+        char args[MAX_COMMAND_LEN];
+        char *search_argv[64];
+        int search_argc = 0;
+        strcpy(args, command + 6);
+        char *save;
+        for (char *token = strtok_r(args, " \t", &save); token != NULL && search_argc < 64;
+             token = strtok_r(NULL, " \t", &save)) {
+            search_argv[search_argc++] = token;
+        }
+        
+        if (search_argc >= 2) {
+            failed = querySearch(search_argv[0], search_argv + 1, search_argc - 1, out);
+        } else {
+            fprintf(out, "Invalid command format. Use: search <HuntID> <terms...>\n");
+            failed = 1;
+        }
+    }
+    else {
+        fprintf(out, "Unknown command: %s\n", command);
+        failed = 1;
+    }
+    return failed;
+}
+
+void run_request(MonitorRequest *request) {
+    pthread_mutex_lock(&request->client->lock);
+    int gone = request->client->broken;
+    pthread_mutex_unlock(&request->client->lock);
+    if (gone) {
+        return;
+    }
+    // Anything written before this request was sent is reported by now.
+    processHuntCacheEvents();
+    const char *name = "unknown";
     
-    printf("Monitor process started (PID: %d)\n", getpid());
+    // Queries run in this process and print straight into the reply.
+    ReplyStream reply = { request->client, request->id, 0 };
+    FILE *out = open_reply_stream(&reply);
+    if (out == NULL) {
+        send_reply(request->client, request->id, "Error: Monitor could not allocate a response.\n");
+        return;
+    }
+    int failed = handle_request(request->command, out, &name);
+    end_reply_stream(out, &reply);
     
+    // Timed from the request arriving, so waiting in the queue counts.
+    struct timespec finished;
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    uint64_t micros = (finished.tv_sec - request->queued.tv_sec) * 1000000ULL +
+                      (finished.tv_nsec - request->queued.tv_nsec) / 1000;
+    pthread_mutex_lock(&pool.stats_lock);
+    recordCommand(&pool.stats, name, failed, reply.bytes, micros);
+    pthread_mutex_unlock(&pool.stats_lock);
+}
+
+// Drops the request's hold on its client, waking the loop if the client
+// was waiting for a free slot.
+void finish_request(MonitorClient *client) {
+    pthread_mutex_lock(&client->lock);
+    client->active--;
+    int resume = client->paused && !client->broken;
+    pthread_mutex_unlock(&client->lock);
+    if (resume) {
+        uint64_t one = 1;
+        if (write(pool.wake_fd, &one, sizeof(one)) < 0) {
+            // Already pending; the loop wakes either way.
+        }
+    }
+    release_client(client);
+}
+
+void *monitor_worker(void *arg) {
+    (void)arg;
     while (1) {
-        char command[MAX_COMMAND_LEN];
-        memset(command, 0, sizeof(command));
+        pthread_mutex_lock(&pool.lock);
+        while (pool.count == 0 && !pool.stopping)
+            pthread_cond_wait(&pool.ready, &pool.lock);
+        if (pool.count == 0) {
+            pthread_mutex_unlock(&pool.lock);
+            return NULL;
+        }
+        MonitorRequest request = pool.queue[pool.head];
+        pool.head = (pool.head + 1) % pool.capacity;
+        pool.count--;
+        pool.busy++;
+        pthread_mutex_unlock(&pool.lock);
         
-        // Read command from the pipe
-        ssize_t bytes_read = read(main_to_mon_pipe[0], command, sizeof(command) - 1);
-        if (bytes_read <= 0) {
-            continue;
+        run_request(&request);
+        finish_request(request.client);
+        
+        pthread_mutex_lock(&pool.lock);
+        pool.busy--;
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+int read_setting(const char *name, int fallback) {
+    const char *value = getenv(name);
+    int parsed = value != NULL ? atoi(value) : 0;
+    return parsed > 0 ? parsed : fallback;
+}
+
+// TREASURE_MONITOR_WORKERS threads (by default one per core, and at least
+// two so a short query can overtake a long one) take requests from a queue
+// of TREASURE_MONITOR_QUEUE (64) entries.
+int start_pool() {
+    memset(&pool, 0, sizeof(pool));
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = read_setting("TREASURE_MONITOR_WORKERS", cores > 2 ? (int)cores : 2);
+    pool.capacity = read_setting("TREASURE_MONITOR_QUEUE", 64);
+    pool.client_limit = workers > 1 ? workers - 1 : 1;
+    pool.queue = malloc(pool.capacity * sizeof(MonitorRequest));
+    pool.workers = malloc(workers * sizeof(pthread_t));
+    pool.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool.queue == NULL || pool.workers == NULL || pool.wake_fd == -1) {
+        free(pool.queue);
+        free(pool.workers);
+        if (pool.wake_fd != -1)
+            close(pool.wake_fd);
+        return -1;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.ready, NULL);
+    pthread_mutex_init(&pool.stats_lock, NULL);
+    resetMonitorStats(&pool.stats);
+    for (; pool.worker_count < workers; pool.worker_count++) {
+        if (pthread_create(&pool.workers[pool.worker_count], NULL, monitor_worker, NULL) != 0)
+            break;
+    }
+    return pool.worker_count > 0 ? 0 : -1;
+}
+
+// Lets the workers finish what is queued, then waits for them.
+void stop_pool() {
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    pthread_cond_broadcast(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < pool.worker_count; i++) {
+        pthread_join(pool.workers[i], NULL);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.ready);
+    pthread_mutex_destroy(&pool.stats_lock);
+    close(pool.wake_fd);
+    free(pool.queue);
+    free(pool.workers);
+}
+
+// Hands a request to the workers, or turns it away if the queue is full.
+void queue_request(MonitorClient *client, uint32_t id, const char *command) {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.count == pool.capacity) {
+        pthread_mutex_unlock(&pool.lock);
+        send_reply(client, id, "Error: Monitor is busy; try again.\n");
+        pthread_mutex_lock(&pool.stats_lock);
+        recordCommand(&pool.stats, "busy", 1, 0, 0);
+        pthread_mutex_unlock(&pool.stats_lock);
+        return;
+    }
+    MonitorRequest *request = &pool.queue[(pool.head + pool.count) % pool.capacity];
+    request->client = client;
+    request->id = id;
+    clock_gettime(CLOCK_MONOTONIC, &request->queued);
+    snprintf(request->command, sizeof(request->command), "%s", command);
+    pool.count++;
+    pthread_mutex_lock(&client->lock);
+    client->refs++;
+    client->active++;
+    pthread_mutex_unlock(&client->lock);
+    pthread_cond_signal(&pool.ready);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Takes the complete requests out of the client's input, up to its limit
+// in flight. Returns 1 if the client asked the monitor to stop.
+int serve_client(MonitorClient *client) {
+    size_t used = 0;
+    int stop = 0;
+    while (!stop) {
+        pthread_mutex_lock(&client->lock);
+        client->paused = client->active >= pool.client_limit;
+        int paused = client->paused;
+        pthread_mutex_unlock(&client->lock);
+        if (paused)
+            break;
+        
+        FrameHeader header;
+        if (client->in_len - used < sizeof(header))
+            break;
+        memcpy(&header, client->in + used, sizeof(header));
+        if (header.len >= MAX_COMMAND_LEN) {
+            pthread_mutex_lock(&client->lock);
+            client->broken = 1;
+            pthread_mutex_unlock(&client->lock);
+            break;
         }
+        if (client->in_len - used < sizeof(header) + header.len)
+            break;
         
-        command[bytes_read] = '\0';
+        char command[MAX_COMMAND_LEN];
+        memcpy(command, client->in + used + sizeof(header), header.len);
+        command[header.len] = '\0';
+        used += sizeof(header) + header.len;
         
-        char response[MAX_RESPONSE_LEN];
-        memset(response, 0, sizeof(response));
+        if (strcmp(command, "stop_monitor") == 0) {
+            send_reply(client, header.id, "Monitor process stopping...\n");
+            stop = 1;
+        } else {
+            queue_request(client, header.id, command);
+        }
+    }
+    memmove(client->in, client->in + used, client->in_len - used);
+    client->in_len -= used;
+    return stop;
+}
+
+void accept_clients(int listen_fd) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        // Edge-triggered: input is read until the socket runs dry, and
+        // EPOLLOUT fires once after a send found the socket full.
+        MonitorClient *client = calloc(1, sizeof(MonitorClient));
+        struct epoll_event event = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = client };
+        if (client == NULL || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            free(client);
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->refs = 1;
+        pthread_mutex_init(&client->lock, NULL);
+        pthread_cond_init(&client->drained, NULL);
+        client->next = clients;
+        clients = client;
+    }
+}
+
+// paused and broken are also set by workers, under the client's lock.
+int client_paused(MonitorClient *client) {
+    pthread_mutex_lock(&client->lock);
+    int paused = client->paused;
+    pthread_mutex_unlock(&client->lock);
+    return paused;
+}
+
+int client_broken(MonitorClient *client) {
+    pthread_mutex_lock(&client->lock);
+    int broken = client->broken;
+    pthread_mutex_unlock(&client->lock);
+    return broken;
+}
+
+// Reads and queues what the client has sent until it runs dry or has to
+// wait for its requests in flight. Returns -1 once it has hung up, 1 if it
+// asked the monitor to stop.
+int read_client(MonitorClient *client) {
+    while (1) {
+        if (serve_client(client))
+            return 1;
+        if (client_broken(client))
+            return -1;
+        if (client_paused(client))
+            return 0;
+        ssize_t bytes = read(client->fd, client->in + client->in_len, sizeof(client->in) - client->in_len);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (bytes <= 0)
+            return -1;
+        client->in_len += bytes;
+    }
+}
+
+// Unhooks a client that hung up. Replies still being written for it have
+// nowhere to go, and its workers give up on them.
+void close_client(MonitorClient *client) {
+    for (MonitorClient **link = &clients; *link != NULL; link = &(*link)->next) {
+        if (*link == client) {
+            *link = client->next;
+            break;
+        }
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+    pthread_mutex_lock(&client->lock);
+    client->broken = 1;
+    pthread_cond_broadcast(&client->drained);
+    pthread_mutex_unlock(&client->lock);
+    release_client(client);
+}
+
+void monitor_server(int listen_fd) {
+    printf("Monitor process started (PID: %d)\n", getpid());
+    fflush(stdout);
+    
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1 || start_pool() != 0) {
+        perror("Failed to start the monitor");
+        return;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &listen_marker };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    int cache_fd = startHuntCache("Hunts");
+    if (cache_fd != -1) {
+        // Changes are applied while idle too, so the queue never overflows.
+        event.data.ptr = &cache_marker;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, cache_fd, &event);
+    }
+    event.data.ptr = &wake_marker;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pool.wake_fd, &event);
+    
+    MonitorClient *stopper = NULL;
+    while (stopper == NULL) {
+        struct epoll_event events[64];
+        int ready = epoll_wait(epoll_fd, events, 64, -1);
+        if (ready < 0 && errno == EINTR)
+            continue;
+        if (ready < 0)
+            break;
         
-        if (strncmp(command, "list_hunts", 10) == 0) {
-            snprintf(response, sizeof(response), "=== Available Hunts ===\n");
-            
-            char buffer[1024];
-            FILE *fp = popen("ls -1 Hunts/ 2>/dev/null", "r");
-            if (fp != NULL) {
-                int count = 0;
-                while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-                    buffer[strcspn(buffer, "\n")] = '\0';
-                    char treasure_path[2048];
-                    snprintf(treasure_path, sizeof(treasure_path), "Hunts/%s/treasures.dat", buffer);
-                    
-                    struct stat st;
-                    if (stat(treasure_path, &st) == 0) {
-                        int treasures = st.st_size / sizeof(struct {
-                            int id;
-                            char userName[20];
-                            struct { float x, y; } coord;
-                            char clue[1024];
-                            int value;
-                        });
-                        
-                        char temp[2048];
-                        snprintf(temp, sizeof(temp), "Hunt: %s, Treasures: %d\n", buffer, treasures);
-                        strcat(response, temp);
-                        count++;
-                    }
-                }
-                pclose(fp);
-                
-                char temp[256];
-                snprintf(temp, sizeof(temp), "\nTotal Hunts: %d\n", count);
-                strcat(response, temp);
-            } else {
-                strcat(response, "No hunts found or error accessing directory.\n");
+        for (int i = 0; i < ready && stopper == NULL; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &listen_marker) {
+                accept_clients(listen_fd);
+                continue;
             }
-        } 
-        else if (strncmp(command, "list_treasures", 14) == 0) {
-            char hunt_id[100];
-            if (sscanf(command, "list_treasures %s", hunt_id) == 1) {
-                char cmd[2048];
-                snprintf(cmd, sizeof(cmd), "./treasure_manager list %s 2>&1", hunt_id);
-                
-                FILE *fp = popen(cmd, "r");
-                if (fp != NULL) {
-                    char buffer[1024];
-                    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-                        strcat(response, buffer);
-                    }
-                    pclose(fp);
-                } else {
-                    strcat(response, "Error executing command.\n");
-                }
-            } else {
-                strcat(response, "Invalid command format. Use: list_treasures <HuntID>\n");
+            if (ptr == &cache_marker) {
+                processHuntCacheEvents();
+                continue;
             }
-        }
-        else if (strncmp(command, "view_treasure", 13) == 0) {
-            char hunt_id[100];
-            int treasure_id;
-            if (sscanf(command, "view_treasure %s %d", hunt_id, &treasure_id) == 2) {
-                char cmd[2048];
-                snprintf(cmd, sizeof(cmd), "./treasure_manager view %s %d 2>&1", hunt_id, treasure_id);
-                
-                FILE *fp = popen(cmd, "r");
-                if (fp != NULL) {
-                    char buffer[1024];
-                    while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-                        strcat(response, buffer);
-                    }
-                    pclose(fp);
-                } else {
-                    strcat(response, "Error executing command.\n");
+            if (ptr == &wake_marker) {
+                uint64_t count;
+                if (read(pool.wake_fd, &count, sizeof(count)) < 0) {
+                    // Nothing pending after all.
                 }
-            } else {
-                strcat(response, "Invalid command format. Use: view_treasure <HuntID> <TreasureID>\n");
-            }
-        }
-        else if (strncmp(command, "calculate_score", 15) == 0) {
-            char hunt_id[100];
-            if (sscanf(command, "calculate_score %s", hunt_id) == 1) {
-                int score_pipe[2];
-                if (pipe(score_pipe) != 0) {
-                    strcat(response, "Error creating pipe for score calculation.\n");
-                } else {
-                    pid_t score_pid = fork();
-                    
-                    if (score_pid < 0) {
-                        strcat(response, "Error forking process for score calculation.\n");
-                        close(score_pipe[0]);
-                        close(score_pipe[1]);
-                    } else if (score_pid == 0) {
-                        close(score_pipe[0]); 
-                        
-                        dup2(score_pipe[1], STDOUT_FILENO);
-                        close(score_pipe[1]);
-                        
-                        execl("./calculate_score", "./calculate_score", hunt_id, NULL);
-                        
-                        fprintf(stderr, "Failed to execute score calculator\n");
-                        exit(1);
-                    } else {
-                        close(score_pipe[1]);
-                        
-                        char buffer[4096];
-                        ssize_t bytes_read;
-                        
-                        while ((bytes_read = read(score_pipe[0], buffer, sizeof(buffer) - 1)) > 0) {
-                            buffer[bytes_read] = '\0';
-                            strcat(response, buffer);
-                        }
-                        
-                        close(score_pipe[0]);
-                        
-                        int status;
-                        waitpid(score_pid, &status, 0);
-                        
-                        if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
-                            strcat(response, "Score calculation failed.\n");
-                        }
+                // Go on with the clients that have a free slot again.
+                MonitorClient *client = clients;
+                while (client != NULL && stopper == NULL) {
+                    MonitorClient *next = client->next;
+                    int status = client_paused(client) ? read_client(client) : 0;
+                    if (status == 1) {
+                        stopper = client;
+                    } else if (status < 0) {
+                        close_client(client);
                     }
+                    client = next;
                 }
-            } else {
-                strcat(response, "Invalid command format. Use: calculate_score <HuntID>\n");
+                continue;
             }
-        }
-        else if (strcmp(command, "stop_monitor") == 0) {
-            strcpy(response, "Monitor process stopping...\n");
             
-            write(mon_to_main_pipe[1], response, strlen(response));
-            
-            close(mon_to_main_pipe[1]);
-            close(main_to_mon_pipe[0]);
-            
-            kill(getppid(), SIGUSR1);
-            sleep(1);
-            
-            exit(0);
+            MonitorClient *client = ptr;
+            if (events[i].events & EPOLLOUT) {
+                pthread_mutex_lock(&client->lock);
+                flush_client(client);
+                pthread_mutex_unlock(&client->lock);
+            }
+            int status = 0;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                status = read_client(client);
+            }
+            if (status == 1) {
+                stopper = client;
+            } else if (status < 0 || client_broken(client)) {
+                close_client(client);
+            }
         }
-        else {
-            snprintf(response, sizeof(response), "Unknown command: %s\n", command);
+    }
+    
+    // Whoever asked us to stop gets its reply before we go; replies still
+    // being written for anyone else are cut short.
+    if (stopper != NULL) {
+        pthread_mutex_lock(&stopper->lock);
+        fcntl(stopper->fd, F_SETFL, fcntl(stopper->fd, F_GETFL) & ~O_NONBLOCK);
+        flush_client(stopper);
+        pthread_mutex_unlock(&stopper->lock);
+    }
+    while (clients != NULL) {
+        close_client(clients);
+    }
+    stop_pool();
+    stopHuntCache();
+    close(epoll_fd);
+    close(listen_fd);
+}
+
+const char *monitor_socket_path() {
+    if (socket_path[0] == '\0') {
+        const char *path = getenv("TREASURE_MONITOR_SOCKET");
+        snprintf(socket_path, sizeof(socket_path), "%s", path != NULL && *path != '\0' ? path : MONITOR_SOCKET);
+    }
+    return socket_path;
+}
+
+int fill_socket_address(struct sockaddr_un *address) {
+    const char *path = monitor_socket_path();
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address->sun_path, path);
+    return 0;
+}
+
+// Connects to a monitor already listening on the socket, or returns -1.
+int connect_monitor() {
+    struct sockaddr_un address;
+    if (fill_socket_address(&address) != 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Binds the monitor's socket. A socket file nobody answers on is left over
+// from a monitor that died, and is replaced.
+int listen_monitor() {
+    struct sockaddr_un address;
+    if (fill_socket_address(&address) != 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int bound = bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    if (!bound && errno == EADDRINUSE) {
+        int other = connect_monitor();
+        if (other != -1) {
+            close(other);
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
         }
+        unlink(address.sun_path);
+        bound = bind(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+    }
+    if (!bound || listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Reaps our own monitor if it has exited. With wait set, blocks until it does.
+void check_monitor(int wait) {
+    if (!monitor_running || monitor_pid == -1) {
+        return;
+    }
+    
+    int status;
+    if (waitpid(monitor_pid, &status, wait ? 0 : WNOHANG) == monitor_pid) {
+        printf("Monitor process has terminated.\n");
+        monitor_running = 0;
+        monitor_pid = -1;
         
-        write(mon_to_main_pipe[1], response, strlen(response));
-        
-        kill(getppid(), SIGUSR1);
+        close(monitor_fd);
+        monitor_fd = -1;
     }
 }
 
-void send_command_to_monitor(const char *command) {
+void disconnect_monitor() {
+    if (monitor_pid != -1) {
+        check_monitor(1);
+        return;
+    }
+    close(monitor_fd);
+    monitor_fd = -1;
+    monitor_running = 0;
+}
+
+// Returns 0 once the whole reply has been printed, -1 if it never came.
+int send_command_to_monitor(const char *command) {
     if (!monitor_running) {
         printf("Error: Monitor is not running.\n");
-        return;
+        return -1;
     }
     
-    write(main_to_mon_pipe[1], command, strlen(command));
+    uint32_t id = ++next_request_id;
+    if (write_frame(monitor_fd, id, command, strlen(command)) != 0) {
+        printf("Error: Could not reach the monitor.\n");
+        disconnect_monitor();
+        return -1;
+    }
     
-    waiting_for_monitor = 1;
+    // Frames for requests that already timed out may still arrive, before
+    // or amid our own; they carry an older ID and are dropped. Chunks of
+    // our own reply are printed as they arrive.
+    char chunk[MONITOR_CHUNK_LEN];
+    while (1) {
+        uint32_t chunk_id;
+        ssize_t chunk_len = read_frame(monitor_fd, &chunk_id, chunk, sizeof(chunk), MONITOR_TIMEOUT_MS);
+        if (chunk_len < 0) {
+            if (errno == ETIMEDOUT) {
+                printf("Timeout waiting for monitor response.\n");
+            } else {
+                printf("Error: Lost connection to the monitor.\n");
+                disconnect_monitor();
+            }
+            return -1;
+        }
+        
+        if (chunk_id != id) {
+            continue;
+        }
+        if (chunk_len == 0) {
+            return 0;
+        }
+        fwrite(chunk, 1, chunk_len, stdout);
+        fflush(stdout);
+    }
+}
+
+// Connects to the monitor on the socket if one is running (started with
+// treasure_hub --daemon or by another hub); otherwise starts our own.
+void start_monitor() {
+    int fd = connect_monitor();
+    if (fd != -1) {
+        monitor_fd = fd;
+        monitor_pid = -1;
+        monitor_running = 1;
+        printf("Connected to the monitor at %s\n", monitor_socket_path());
+        return;
+    }
+    
+    int listen_fd = listen_monitor();
+    if (listen_fd == -1) {
+        perror("Failed to open the monitor socket");
+        return;
+    }
     
-    kill(monitor_pid, SIGUSR2);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Fork failed");
+        close(listen_fd);
+        unlink(monitor_socket_path());
+        return;
+    } else if (pid == 0) {
+        monitor_server(listen_fd);
+        unlink(monitor_socket_path());
+        // _exit so the hub's buffered stdin is not rewound on our way
+        // out, which also skips atexit: flush the audit log by hand.
+        closeHuntLog();
+        fflush(stdout);
+        _exit(0);
+    }
     
-    int timeout = 10;
-    while (waiting_for_monitor && timeout > 0) {
-        sleep(1);
-        timeout--;
+    // The socket was listening before the fork, so this cannot race it.
+    close(listen_fd);
+    monitor_pid = pid;
+    monitor_running = 1;
+    monitor_fd = connect_monitor();
+    if (monitor_fd == -1) {
+        perror("Failed to connect to the monitor");
+        kill(pid, SIGTERM);
+        check_monitor(1);
+        return;
+    }
+    printf("Monitor started with PID: %d\n", pid);
+}
+
+// Stops our own monitor. One we only connected to keeps running for its
+// other clients; we just hang up.
+void stop_monitor() {
+    if (monitor_pid == -1) {
+        disconnect_monitor();
+        printf("Disconnected from the monitor.\n");
+        return;
     }
     
-    if (waiting_for_monitor) {
-        printf("Timeout waiting for monitor response.\n");
-        waiting_for_monitor = 0;
+    if (send_command_to_monitor("stop_monitor") != 0 && monitor_running) {
+        // It did not answer in time; do not wait on it forever.
+        kill(monitor_pid, SIGTERM);
+    }
+    if (monitor_running) {
+        // The monitor closes the connection as it exits.
+        char byte;
+        while (read(monitor_fd, &byte, 1) > 0) {
+        }
+        check_monitor(1);
     }
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    // A monitor that died shows up as EPIPE on the next write, not as a signal.
     struct sigaction sa;
-    sa.sa_handler = monitor_response_handler;
+    sa.sa_handler = SIG_IGN;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = 0;
-    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGPIPE, &sa, NULL);
     
-    sa.sa_handler = monitor_terminated_handler;
-    sigaction(SIGCHLD, &sa, NULL);
+    if (argc == 2 && strcmp(argv[1], "--daemon") == 0) {
+        // Serve every client on the socket until one sends stop_monitor.
+        int listen_fd = listen_monitor();
+        if (listen_fd == -1) {
+            perror("Failed to open the monitor socket");
+            return 1;
+        }
+        printf("Monitor listening on %s\n", monitor_socket_path());
+        monitor_server(listen_fd);
+        unlink(monitor_socket_path());
+        return 0;
+    } else if (argc != 1) {
+        printf("Usage: %s [--daemon]\n", argv[0]);
+        return 1;
+    }
     
     printf("Treasure Hunt Hub\n");
     printf("=================\n");
     printf("Available commands:\n");
-    printf("  start_monitor - Start the monitor process\n");
+    printf("  start_monitor - Start the monitor process (or connect to a running one)\n");
     printf("  list_hunts - List all available hunts\n");
-    printf("  list_treasures <HuntID> - List treasures in a hunt\n");
+    printf("  list_treasures <HuntID> [--offset N] [--limit N] [--user NAME] [--min-value V] [--fields ...] - List a page of a hunt's treasures\n");
     printf("  view_treasure <HuntID> <TreasureID> - View a specific treasure\n");
-    printf("  calculate_score <HuntID> - Calculate scores for users in a hunt\n");
-    printf("  stop_monitor - Stop the monitor process\n");
+    printf("  calculate_score <HuntID> [HuntID...] - Calculate scores for users in one or more hunts\n");
+    printf("  calculate_score --all - Calculate a leaderboard across all hunts\n");
+    printf("  nearby <HuntID> <x> <y> <radius> - List treasures within a distance of a point\n");
+    printf("  within <HuntID> <x1> <y1> <x2> <y2> - List treasures inside a rectangle\n");
+    printf("  nearest <HuntID> <x> <y> <k> - List the k treasures closest to a point\n");
+    printf("  search <HuntID> <terms...> - List treasures whose clues contain every term\n");
+    printf("  stats [reset] - Show (or clear) the monitor's per-command counters and latencies\n");
+    printf("  stop_monitor - Stop the monitor process (or disconnect from a shared one)\n");
     printf("  exit - Exit the treasure hub\n\n");
     
     char command[MAX_COMMAND_LEN];
     
     while (1) {
+        check_monitor(0);
         printf("> ");
+        fflush(stdout);
         if (fgets(command, sizeof(command), stdin) == NULL) {
             break;
         }
@@ -293,34 +1077,7 @@ int main() {
                 printf("Monitor is already running.\n");
                 continue;
             }
-            
-            if (pipe(mon_to_main_pipe) != 0 || pipe(main_to_mon_pipe) != 0) {
-                perror("Failed to create pipes");
-                continue;
-            }
-            
-            pid_t pid = fork();
-            
-            if (pid < 0) {
-                perror("Fork failed");
-                
-                close(mon_to_main_pipe[0]);
-                close(mon_to_main_pipe[1]);
-                close(main_to_mon_pipe[0]);
-                close(main_to_mon_pipe[1]);
-                continue;
-            } else if (pid == 0) {
-                monitor_process();
-                exit(0);
-            } else {
-                monitor_pid = pid;
-                monitor_running = 1;
-                
-                close(mon_to_main_pipe[1]);
-                close(main_to_mon_pipe[0]);
-                
-                printf("Monitor started with PID: %d\n", pid);
-            }
+            start_monitor();
         }
         else if (strncmp(command, "list_hunts", 10) == 0) {
             if (!monitor_running) {
@@ -350,26 +1107,33 @@ int main() {
             }
             send_command_to_monitor(command);
         }
+        else if (strncmp(command, "nearby", 6) == 0 || strncmp(command, "within", 6) == 0 ||
+                 strncmp(command, "nearest", 7) == 0 || strncmp(command, "search", 6) == 0) {
+            if (!monitor_running) {
+                printf("Error: Monitor is not running. Use 'start_monitor' first.\n");
+                continue;
+            }
+            send_command_to_monitor(command);
+        }
+        else if (strcmp(command, "stats") == 0 || strcmp(command, "stats reset") == 0) {
+            if (!monitor_running) {
+                printf("Error: Monitor is not running. Use 'start_monitor' first.\n");
+                continue;
+            }
+            send_command_to_monitor(command);
+        }
         else if (strcmp(command, "stop_monitor") == 0) {
             if (!monitor_running) {
                 printf("Monitor is not running.\n");
                 continue;
             }
-            send_command_to_monitor("stop_monitor");
+            stop_monitor();
         }
         else if (strcmp(command, "exit") == 0) {
             if (monitor_running) {
-                printf("Stopping monitor process before exit...\n");
-                send_command_to_monitor("stop_monitor");
-                sleep(1);
-                
-                if (monitor_running) {
-                    kill(monitor_pid, SIGTERM);
-                    sleep(1);
-                }
-                
-                close(mon_to_main_pipe[0]);
-                close(main_to_mon_pipe[1]);
+                if (monitor_pid != -1)
+                    printf("Stopping monitor process before exit...\n");
+                stop_monitor();
             }
             break;
         }
@@ -380,4 +1144,4 @@ int main() {
     
     printf("Exiting Treasure Hub.\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+
+#include "treasure_import.h"
+
+#define IMPORT_FIELDS 5
+
+// Field order for CSV; NDJSON objects use the same names as keys.
+static const char *fieldNames[IMPORT_FIELDS] = {"user", "x", "y", "clue", "value"};
+
+static int rewindTreasureImport(TreasureImport *import)
+{
+    import->lineNumber = 0;
+    return fseek(import->file, 0, SEEK_SET);
+}
+
+int openTreasureImport(const char *path, TreasureImport *import)
+{
+    memset(import, 0, sizeof(*import));
+    import->file = fopen(path, "r");
+    if (import->file == NULL) {
+        return -1;
+    }
+
+    int c;
+    while ((c = fgetc(import->file)) != EOF && isspace(c))
+        ;
+    import->ndjson = c == '{';
+    return rewindTreasureImport(import);
+}
+
+void closeTreasureImport(TreasureImport *import)
+{
+    if (import->file != NULL)
+        fclose(import->file);
+    free(import->line);
+    memset(import, 0, sizeof(*import));
+}
+
+// Splits one CSV line in place. Quoted fields are unescaped into the same
+// buffer, which never grows.
+static int splitCsvLine(char *line, char **fields, char *error, size_t errorSize)
+{
+    int count = 0;
+    char *read = line;
+    while (1) {
+        if (count == IMPORT_FIELDS) {
+            snprintf(error, errorSize, "expected %d fields", IMPORT_FIELDS);
+            return -1;
+        }
+        char *write = read;
+        fields[count++] = write;
+        if (*read == '"') {
+            read++;
+            while (1) {
+                if (*read == '\0') {
+                    snprintf(error, errorSize, "unterminated quoted field");
+                    return -1;
+                }
+                if (*read == '"' && read[1] == '"') {
+                    *write++ = '"';
+                    read += 2;
+                } else if (*read == '"') {
+                    read++;
+                    break;
+                } else {
+                    *write++ = *read++;
+                }
+            }
+            if (*read != ',' && *read != '\0') {
+                snprintf(error, errorSize, "text after a quoted field");
+                return -1;
+            }
+        } else {
+            while (*read != ',' && *read != '\0')
+                *write++ = *read++;
+        }
+
+        int last = *read == '\0';
+        *write = '\0';
+        if (last)
+            break;
+        read++;
+    }
+
+    if (count != IMPORT_FIELDS) {
+        snprintf(error, errorSize, "expected %d fields, found %d", IMPORT_FIELDS, count);
+        return -1;
+    }
+    return 0;
+}
+
+// Parses a JSON string starting at the opening quote, unescaping in place.
+// Only the escapes a user name or clue can sensibly contain are accepted.
+static char *parseJsonString(char **cursor, char *error, size_t errorSize)
+{
+    char *read = *cursor + 1;
+    char *start = read, *write = read;
+    while (*read != '"') {
+        if (*read == '\0') {
+            snprintf(error, errorSize, "unterminated string");
+            return NULL;
+        }
+        if (*read == '\\') {
+            read++;
+            switch (*read) {
+            case '"': case '\\': case '/': *write++ = *read; break;
+            case 't': *write++ = '\t'; break;
+            default:
+                snprintf(error, errorSize, "unsupported escape \\%c", *read ? *read : ' ');
+                return NULL;
+            }
+            read++;
+        } else {
+            *write++ = *read++;
+        }
+    }
+    *cursor = read + 1;
+    *write = '\0';
+    return start;
+}
+
+static void skipSpaces(char **cursor)
+{
+    while (isspace((unsigned char)**cursor))
+        (*cursor)++;
+}
+
+// Parses one flat JSON object of string and number values in place.
+static int splitJsonLine(char *line, char **fields, char *error, size_t errorSize)
+{
+    memset(fields, 0, IMPORT_FIELDS * sizeof(char *));
+    char *cursor = line;
+    skipSpaces(&cursor);
+    if (*cursor++ != '{') {
+        snprintf(error, errorSize, "expected a JSON object");
+        return -1;
+    }
+
+    skipSpaces(&cursor);
+    char next = *cursor;
+    if (next == '}')
+        cursor++;
+    while (next != '}') {
+        if (*cursor != '"') {
+            snprintf(error, errorSize, "expected a key");
+            return -1;
+        }
+        char *key = parseJsonString(&cursor, error, errorSize);
+        if (key == NULL)
+            return -1;
+        skipSpaces(&cursor);
+        if (*cursor++ != ':') {
+            snprintf(error, errorSize, "expected ':' after \"%s\"", key);
+            return -1;
+        }
+        skipSpaces(&cursor);
+
+        char *value;
+        if (*cursor == '"') {
+            value = parseJsonString(&cursor, error, errorSize);
+            if (value == NULL)
+                return -1;
+            skipSpaces(&cursor);
+            next = *cursor;
+        } else {
+            // Numbers are cut off in place, so remember what ended them.
+            value = cursor;
+            while (*cursor != '\0' && *cursor != ',' && *cursor != '}' && !isspace((unsigned char)*cursor))
+                cursor++;
+            next = *cursor;
+            *cursor = '\0';
+            if (isspace((unsigned char)next)) {
+                cursor++;
+                skipSpaces(&cursor);
+                next = *cursor;
+            }
+        }
+
+        for (int i = 0; i < IMPORT_FIELDS; i++) {
+            if (strcmp(key, fieldNames[i]) == 0)
+                fields[i] = value;
+        }
+
+        if (next != ',' && next != '}') {
+            snprintf(error, errorSize, "expected ',' or '}'");
+            return -1;
+        }
+        cursor++;
+        skipSpaces(&cursor);
+    }
+
+    for (int i = 0; i < IMPORT_FIELDS; i++) {
+        if (fields[i] == NULL) {
+            snprintf(error, errorSize, "missing \"%s\"", fieldNames[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int parseFloatField(const char *text, float *result)
+{
+    char *end;
+    errno = 0;
+    *result = strtof(text, &end);
+    return end != text && *end == '\0' && errno == 0 && isfinite(*result);
+}
+
+// Applies the checks getTreasureInfo makes on the interactive prompts.
+int parseTreasureFields(char **fields, Treasure *treasure, char *error, size_t errorSize)
+{
+    memset(treasure, 0, sizeof(*treasure));
+
+    const char *userName = fields[0];
+    size_t userNameLength = strlen(userName);
+    if (userNameLength == 0 || userNameLength >= sizeof(treasure->userName)) {
+        snprintf(error, errorSize, "user name must be 1 to %d characters", (int)sizeof(treasure->userName) - 1);
+        return -1;
+    }
+    for (size_t i = 0; i < userNameLength; i++) {
+        if (isspace((unsigned char)userName[i])) {
+            snprintf(error, errorSize, "user name cannot contain spaces");
+            return -1;
+        }
+    }
+    memcpy(treasure->userName, userName, userNameLength);
+
+    if (!parseFloatField(fields[1], &treasure->coord.x) || !parseFloatField(fields[2], &treasure->coord.y)) {
+        snprintf(error, errorSize, "invalid coordinates");
+        return -1;
+    }
+
+    const char *clue = fields[3];
+    size_t clueLength = strlen(clue);
+    if (clueLength == 0 || clueLength >= sizeof(treasure->clue)) {
+        snprintf(error, errorSize, "clue must be 1 to %d characters", (int)sizeof(treasure->clue) - 1);
+        return -1;
+    }
+    memcpy(treasure->clue, clue, clueLength);
+
+    char *end;
+    errno = 0;
+    long value = strtol(fields[4], &end, 10);
+    if (end == fields[4] || *end != '\0' || errno != 0 || value <= 0 || value > 0x7fffffff) {
+        snprintf(error, errorSize, "value must be a positive number");
+        return -1;
+    }
+    treasure->value = (int)value;
+    return 0;
+}
+
+int nextImportedTreasure(TreasureImport *import, Treasure *treasure, char *error, size_t errorSize)
+{
+    while (1) {
+        ssize_t length = getline(&import->line, &import->lineCapacity, import->file);
+        if (length < 0) {
+            return 0;
+        }
+        import->lineNumber++;
+
+        char *line = import->line;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[--length] = '\0';
+        char *first = line;
+        while (isspace((unsigned char)*first))
+            first++;
+        if (*first == '\0')
+            continue;
+
+        char *fields[IMPORT_FIELDS];
+        if (import->ndjson) {
+            if (splitJsonLine(line, fields, error, errorSize) != 0)
+                return -1;
+        } else {
+            if (splitCsvLine(line, fields, error, errorSize) != 0)
+                return -1;
+            if (import->lineNumber == 1 && strcasecmp(fields[0], fieldNames[0]) == 0)
+                continue; // Header line
+        }
+
+        if (parseTreasureFields(fields, treasure, error, errorSize) != 0)
+            return -1;
+        return 1;
+    }
+}
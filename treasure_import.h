@@ -0,0 +1,36 @@
+#ifndef TREASURE_IMPORT_H
+#define TREASURE_IMPORT_H
+
+#include <stdio.h>
+
+#include "treasure_store.h"
+
+// Reads treasures for `treasure_manager import` from either
+//   CSV:    user,x,y,clue,value  (an optional header line naming the
+//           columns; fields may be quoted, with "" for a quote), or
+//   NDJSON: one {"user": ..., "x": ..., "y": ..., "clue": ..., "value": ...}
+//           object per line.
+// The format is chosen from the first non-blank character of the file.
+// Records are checked with the same rules as the interactive add. IDs are
+// left at 0 for the caller to assign.
+typedef struct
+{
+    FILE *file;
+    int ndjson;
+    int lineNumber;
+    char *line;
+    size_t lineCapacity;
+} TreasureImport;
+
+int openTreasureImport(const char *path, TreasureImport *import);
+void closeTreasureImport(TreasureImport *import);
+
+// Returns 1 with *treasure filled, 0 at the end of the file, or -1 with a
+// description of the bad line in error.
+int nextImportedTreasure(TreasureImport *import, Treasure *treasure, char *error, size_t errorSize);
+
+// Builds a treasure from strings in the order user, x, y, clue, value,
+// with the same checks; also used by the non-interactive add.
+int parseTreasureFields(char **fields, Treasure *treasure, char *error, size_t errorSize);
+
+#endif
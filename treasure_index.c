@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "treasure_index.h"
+
+#define INDEX_MAGIC 0x58444954 // "TIDX"
+#define INDEX_VERSION 4
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t dataIno;
+    int64_t dataSize;
+    int32_t maxId;
+    int32_t liveCount;
+    int32_t deadCount;
+    int32_t dataVersion;
+    int32_t clueHeap;
+    int32_t reserved;
+} IndexHeader;
+
+// Entry for ID n lives at sizeof(IndexHeader) + n * sizeof(int64_t); -1 means no such ID.
+#define ENTRY_OFFSET(id) ((off_t)sizeof(IndexHeader) + (off_t)(id) * (off_t)sizeof(int64_t))
+
+static void indexPaths(const char *huntPath, char *dataPath, char *indexPath)
+{
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+    sprintf(indexPath, "%s/treasures.idx", huntPath);
+}
+
+static int headerMatches(const IndexHeader *header, uint64_t dataIno)
+{
+    return header->magic == INDEX_MAGIC && header->version == INDEX_VERSION && header->dataIno == dataIno &&
+           header->maxId >= 0;
+}
+
+// Opens the index only if it describes exactly the records reader sees.
+static int openCurrentIndex(const char *indexPath, const TreasureReader *reader, int flags, IndexHeader *header)
+{
+    int indexFile = open(indexPath, flags);
+    if (indexFile == -1) {
+        return -1;
+    }
+    if (preadFull(indexFile, header, sizeof(*header), 0) != 0 ||
+        !headerMatches(header, reader->inode) || header->dataSize != reader->length) {
+        close(indexFile);
+        return -1;
+    }
+    return indexFile;
+}
+
+int rebuildTreasureIndex(const char *huntPath)
+{
+    char dataPath[1024], indexPath[1024];
+    indexPaths(huntPath, dataPath, indexPath);
+
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL, &map) != 0) {
+        return -1;
+    }
+
+    // Tombstones still count towards maxId so their IDs are not handed out again.
+    int maxId = 0, liveCount = 0, deadCount = 0;
+    TreasureCursor cursor;
+    TreasureRecord record;
+    startTreasureCursor(&map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        int id = abs(record.id);
+        if (id > maxId)
+            maxId = id;
+        if (TREASURE_IS_LIVE(&record))
+            liveCount++;
+        else
+            deadCount++;
+    }
+
+    int64_t *offsets = malloc(((size_t)maxId + 1) * sizeof(int64_t));
+    if (offsets == NULL) {
+        closeTreasureMap(&map);
+        return -1;
+    }
+    memset(offsets, 0xff, ((size_t)maxId + 1) * sizeof(int64_t));
+
+    // Keep the first record for a duplicated ID, as the old linear scan did.
+    startTreasureCursor(&map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (record.id > 0 && offsets[record.id] < 0)
+            offsets[record.id] = record.offset;
+    }
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.dataIno = map.inode;
+    header.dataSize = map.length;
+    header.maxId = maxId;
+    header.liveCount = liveCount;
+    header.deadCount = deadCount;
+    header.dataVersion = map.version;
+    header.clueHeap = map.clueHeap;
+    closeTreasureMap(&map);
+
+    // Readers rebuild without the hunt lock, so two monitor threads may do
+    // it at once; each writes its own file.
+    static unsigned int sequence = 0;
+    char tempPath[1200];
+    sprintf(tempPath, "%s.%d.%u", indexPath, (int)getpid(), __sync_fetch_and_add(&sequence, 1));
+    int indexFile = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (indexFile == -1) {
+        free(offsets);
+        return -1;
+    }
+
+    int result = 0;
+    if (pwriteFull(indexFile, &header, sizeof(header), 0) != 0 ||
+        pwriteFull(indexFile, offsets, ((size_t)maxId + 1) * sizeof(int64_t), sizeof(header)) != 0) {
+        result = -1;
+    }
+    free(offsets);
+    close(indexFile);
+
+    if (result == 0 && rename(tempPath, indexPath) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        unlink(tempPath);
+    }
+    return result;
+}
+
+// Like openCurrentIndex, but rebuilds a missing or stale index first.
+static int openIndexFor(const char *huntPath, const TreasureReader *reader, int flags, IndexHeader *header)
+{
+    char dataPath[1024], indexPath[1024];
+    indexPaths(huntPath, dataPath, indexPath);
+
+    int indexFile = openCurrentIndex(indexPath, reader, flags, header);
+    if (indexFile == -1 && rebuildTreasureIndex(huntPath) == 0) {
+        indexFile = openCurrentIndex(indexPath, reader, flags, header);
+    }
+    return indexFile;
+}
+
+// Records the rows of one append, ids[i] at offset + i * size. IDs may come
+// in any order; slots skipped over are marked unused.
+int recordTreasureIndexes(const char *huntPath, const int *ids, int count, off_t offset, size_t size)
+{
+    char dataPath[1024], indexPath[1024];
+    indexPaths(huntPath, dataPath, indexPath);
+
+    struct stat dataStat;
+    if (stat(dataPath, &dataStat) != 0) {
+        return -1;
+    }
+
+    IndexHeader header;
+    int indexFile = open(indexPath, O_RDWR);
+    if (indexFile == -1 || preadFull(indexFile, &header, sizeof(header), 0) != 0 ||
+        !headerMatches(&header, dataStat.st_ino) || header.dataSize != offset) {
+        // The index did not cover everything before this append; start over.
+        if (indexFile != -1)
+            close(indexFile);
+        return rebuildTreasureIndex(huntPath);
+    }
+
+    int64_t unused[256];
+    memset(unused, 0xff, sizeof(unused));
+    for (int i = 0; i < count; i++) {
+        int id = ids[i];
+        if (id <= 0) {
+            close(indexFile);
+            return rebuildTreasureIndex(huntPath);
+        }
+        for (int next = header.maxId + 1; next < id;) {
+            int batch = id - next < 256 ? id - next : 256;
+            if (pwriteFull(indexFile, unused, batch * sizeof(int64_t), ENTRY_OFFSET(next)) != 0) {
+                close(indexFile);
+                return rebuildTreasureIndex(huntPath);
+            }
+            next += batch;
+        }
+
+        int64_t entry = offset + (off_t)i * size;
+        if (id > header.maxId)
+            header.maxId = id;
+        header.liveCount++;
+        if (pwriteFull(indexFile, &entry, sizeof(entry), ENTRY_OFFSET(id)) != 0) {
+            close(indexFile);
+            return rebuildTreasureIndex(huntPath);
+        }
+    }
+
+    header.dataSize = offset + (off_t)count * size;
+    if (pwriteFull(indexFile, &header, sizeof(header), 0) != 0) {
+        close(indexFile);
+        return rebuildTreasureIndex(huntPath);
+    }
+
+    close(indexFile);
+    return 0;
+}
+
+// Last resort when the index cannot be written (e.g. a read-only hunt).
+static int scanForTreasures(const char *dataPath, const int *ids, int count, Treasure *treasures, char *found)
+{
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL | TREASURE_WITH_CLUES, &map) != 0) {
+        return -1;
+    }
+
+    int foundCount = 0;
+    TreasureCursor cursor;
+    TreasureRecord record;
+    startTreasureCursor(&map, &cursor);
+    while (nextTreasure(&cursor, &record) && foundCount < count) {
+        if (!TREASURE_IS_LIVE(&record))
+            continue;
+        for (int i = 0; i < count; i++) {
+            if (ids[i] == record.id && !found[i]) {
+                recordToTreasure(&record, &treasures[i]);
+                found[i] = 1;
+                foundCount++;
+            }
+        }
+    }
+    closeTreasureMap(&map);
+    return foundCount;
+}
+
+// Reads several treasures with one open of the data file and index; each
+// segment's files are opened once, by the first record read from it.
+// found[i] is set for each treasures[i] that was read; removed and unknown
+// IDs are left unset. Returns the number found, or -1.
+int lookupTreasures(const char *huntPath, const int *ids, int count, Treasure *treasures, char *found)
+{
+    char dataPath[1024], indexPath[1024];
+    indexPaths(huntPath, dataPath, indexPath);
+    memset(found, 0, count);
+
+    TreasureReader reader;
+    if (openTreasureReader(huntPath, 0, &reader) != 0) {
+        return -1;
+    }
+
+    IndexHeader header;
+    int indexFile = openIndexFor(huntPath, &reader, O_RDONLY, &header);
+    if (indexFile == -1) {
+        closeTreasureReader(&reader);
+        return scanForTreasures(dataPath, ids, count, treasures, found);
+    }
+
+    int foundCount = 0;
+    for (int i = 0; i < count; i++) {
+        int id = ids[i];
+        int64_t offset = -1;
+        if (id > 0 && id <= header.maxId &&
+            preadFull(indexFile, &offset, sizeof(offset), ENTRY_OFFSET(id)) == 0 && offset >= 0 &&
+            readTreasureAt(&reader, offset, &treasures[i]) == 0 && treasures[i].id == id) {
+            found[i] = 1;
+            foundCount++;
+        }
+    }
+
+    close(indexFile);
+    closeTreasureReader(&reader);
+    return foundCount;
+}
+
+int lookupTreasure(const char *huntPath, int id, Treasure *treasure)
+{
+    char found;
+    if (lookupTreasures(huntPath, &id, 1, treasure, &found) < 0) {
+        return -1;
+    }
+    return found;
+}
+
+// Marks the record dead in place and drops it from the index. The caller
+// must hold the hunt lock.
+int removeTreasure(const char *huntPath, int id)
+{
+    char dataPath[1024], indexPath[1024];
+    indexPaths(huntPath, dataPath, indexPath);
+
+    TreasureReader reader;
+    if (openTreasureReader(huntPath, 1, &reader) != 0) {
+        return -1;
+    }
+
+    IndexHeader header;
+    int indexFile = openIndexFor(huntPath, &reader, O_RDWR, &header);
+    if (indexFile == -1) {
+        closeTreasureReader(&reader);
+        return -1;
+    }
+
+    int64_t offset = -1;
+    int storedId = 0;
+    if (id <= 0 || id > header.maxId ||
+        preadFull(indexFile, &offset, sizeof(offset), ENTRY_OFFSET(id)) != 0 || offset < 0 ||
+        readTreasureIdAt(&reader, offset, &storedId) != 0 || storedId != id) {
+        close(indexFile);
+        closeTreasureReader(&reader);
+        return 0;
+    }
+
+    int result = 1;
+    int64_t unused = -1;
+    header.liveCount--;
+    header.deadCount++;
+    if (tombstoneTreasure(&reader, offset, id) != 0) {
+        result = -1;
+    } else if (pwriteFull(indexFile, &unused, sizeof(unused), ENTRY_OFFSET(id)) != 0 ||
+               pwriteFull(indexFile, &header, sizeof(header), 0) != 0) {
+        // The data file is already correct; let the next reader rebuild the index.
+        unlink(indexPath);
+    }
+
+    close(indexFile);
+    closeTreasureReader(&reader);
+    return result;
+}
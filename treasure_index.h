@@ -0,0 +1,19 @@
+#ifndef TREASURE_INDEX_H
+#define TREASURE_INDEX_H
+
+#include <sys/types.h>
+
+#include "treasure_store.h"
+
+// treasures.idx sits next to treasures.dat and maps a treasure ID to the
+// offset of its record (counted through the segments in version 4). It
+// remembers the inode of treasures.dat and where its records ended when it
+// was built, so any rewrite or foreign append makes it stale and it is
+// rebuilt on the next lookup.
+int rebuildTreasureIndex(const char *huntPath);
+int recordTreasureIndexes(const char *huntPath, const int *ids, int count, off_t offset, size_t size);
+int lookupTreasure(const char *huntPath, int id, Treasure *treasure);
+int lookupTreasures(const char *huntPath, const int *ids, int count, Treasure *treasures, char *found);
+int removeTreasure(const char *huntPath, int id);
+
+#endif
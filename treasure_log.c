@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "treasure_log.h"
+
+#define LOG_RING_SIZE 1024
+#define LOG_HUNT_ID_MAX 64
+#define LOG_MESSAGE_MAX 1280
+#define LOG_OPEN_FILES 16
+#define LOG_BATCH_BYTES (1 << 16)
+
+typedef struct
+{
+    time_t when;
+    char huntID[LOG_HUNT_ID_MAX];
+    char message[LOG_MESSAGE_MAX];
+} LogEntry;
+
+typedef struct
+{
+    char huntID[LOG_HUNT_ID_MAX];
+    int fd;
+    int dirty;
+    unsigned long lastUsed;
+} LogFile;
+
+// Producers fill ring[head % LOG_RING_SIZE] and the writer drains from
+// tail; both only ever count up. The entries between tail and head belong
+// to the writer, so it formats them without holding the lock. Everything
+// below the lock is touched by the writer thread only.
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t drained;
+    LogEntry *ring;
+    unsigned long head;
+    unsigned long tail;
+    unsigned long dropped;
+    int running;
+    int stopping;
+    int durability;
+    pthread_t thread;
+
+    LogFile files[LOG_OPEN_FILES];
+    unsigned long useClock;
+    time_t lastSync;
+    time_t stampSecond;
+    char stamp[32];
+    char batch[LOG_BATCH_BYTES];
+    size_t batchUsed;
+    LogFile *batchFile;
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .queued = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+};
+
+static int parseDurability(const char *setting)
+{
+    if (setting == NULL)
+        return LOG_DURABILITY_PERIODIC;
+    if (strcmp(setting, "none") == 0)
+        return LOG_DURABILITY_NONE;
+    if (strcmp(setting, "sync") == 0)
+        return LOG_DURABILITY_SYNC;
+    return LOG_DURABILITY_PERIODIC;
+}
+
+// localtime and strftime run at most once per second.
+static const char *timestamp(time_t when)
+{
+    if (when != logger.stampSecond || logger.stamp[0] == '\0') {
+        struct tm tm_info;
+        localtime_r(&when, &tm_info);
+        strftime(logger.stamp, sizeof(logger.stamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        logger.stampSecond = when;
+    }
+    return logger.stamp;
+}
+
+static void syncFile(LogFile *file)
+{
+    if (file->dirty && logger.durability != LOG_DURABILITY_NONE)
+        fdatasync(file->fd);
+    file->dirty = 0;
+}
+
+// Finds the open log for a hunt, opening it (and closing the least
+// recently used one) if needed. A log whose hunt was deleted and made
+// again is reopened.
+static LogFile *openLogFile(const char *huntID)
+{
+    LogFile *victim = &logger.files[0];
+    for (int i = 0; i < LOG_OPEN_FILES; i++) {
+        LogFile *file = &logger.files[i];
+        if (file->fd > 0 && strcmp(file->huntID, huntID) == 0) {
+            struct stat st;
+            if (fstat(file->fd, &st) == 0 && st.st_nlink > 0) {
+                file->lastUsed = ++logger.useClock;
+                return file;
+            }
+            victim = file;
+            break;
+        }
+        if (file->fd <= 0 || file->lastUsed < victim->lastUsed)
+            victim = file;
+    }
+
+    if (victim->fd > 0) {
+        syncFile(victim);
+        close(victim->fd);
+        victim->fd = 0;
+    }
+
+    char logPath[1024];
+    snprintf(logPath, sizeof(logPath), "Hunts/%s/log.txt", huntID);
+    int fd = open(logPath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) {
+        perror("Error opening log file");
+        return NULL;
+    }
+    snprintf(victim->huntID, sizeof(victim->huntID), "%s", huntID);
+    victim->fd = fd;
+    victim->dirty = 0;
+    victim->lastUsed = ++logger.useClock;
+    return victim;
+}
+
+static void writeBatch(void)
+{
+    if (logger.batchFile != NULL && logger.batchUsed > 0) {
+        size_t done = 0;
+        while (done < logger.batchUsed) {
+            ssize_t bytes = write(logger.batchFile->fd, logger.batch + done, logger.batchUsed - done);
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0) {
+                perror("Error writing to log file");
+                break;
+            }
+            done += bytes;
+        }
+        logger.batchFile->dirty = 1;
+        if (logger.durability == LOG_DURABILITY_SYNC)
+            syncFile(logger.batchFile);
+    }
+    logger.batchUsed = 0;
+    logger.batchFile = NULL;
+}
+
+// Consecutive entries for the same hunt go out in a single write.
+static void appendLine(const char *huntID, time_t when, const char *message)
+{
+    if (logger.batchFile == NULL || strcmp(logger.batchFile->huntID, huntID) != 0) {
+        writeBatch();
+        logger.batchFile = openLogFile(huntID);
+        if (logger.batchFile == NULL)
+            return;
+    }
+
+    char line[LOG_MESSAGE_MAX + 64];
+    int length = snprintf(line, sizeof(line), "%s - %s\n", timestamp(when), message);
+    if (length >= (int)sizeof(line))
+        length = sizeof(line) - 1;
+    if (logger.batchUsed + length > sizeof(logger.batch)) {
+        LogFile *file = logger.batchFile;
+        writeBatch();
+        logger.batchFile = file;
+    }
+    memcpy(logger.batch + logger.batchUsed, line, length);
+    logger.batchUsed += length;
+}
+
+static void syncDirtyFiles(void)
+{
+    for (int i = 0; i < LOG_OPEN_FILES; i++) {
+        if (logger.files[i].fd > 0)
+            syncFile(&logger.files[i]);
+    }
+    logger.lastSync = time(NULL);
+}
+
+static void *logWriter(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&logger.lock);
+    while (1) {
+        if (logger.head == logger.tail) {
+            if (logger.stopping)
+                break;
+
+            int dirty = 0;
+            for (int i = 0; i < LOG_OPEN_FILES; i++)
+                dirty |= logger.files[i].fd > 0 && logger.files[i].dirty;
+            if (!dirty || logger.durability != LOG_DURABILITY_PERIODIC) {
+                pthread_cond_wait(&logger.queued, &logger.lock);
+                continue;
+            }
+
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            if (pthread_cond_timedwait(&logger.queued, &logger.lock, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&logger.lock);
+                syncDirtyFiles();
+                pthread_mutex_lock(&logger.lock);
+            }
+            continue;
+        }
+
+        unsigned long start = logger.tail, end = logger.head;
+        unsigned long dropped = logger.dropped;
+        logger.dropped = 0;
+        pthread_mutex_unlock(&logger.lock);
+
+        for (unsigned long i = start; i < end; i++) {
+            const LogEntry *entry = &logger.ring[i % LOG_RING_SIZE];
+            if (dropped > 0) {
+                char note[128];
+                snprintf(note, sizeof(note), "(%lu log entries were dropped while the log was busy)", dropped);
+                appendLine(entry->huntID, entry->when, note);
+                dropped = 0;
+            }
+            appendLine(entry->huntID, entry->when, entry->message);
+        }
+        writeBatch();
+        // A steady stream of entries must not put the periodic sync off forever.
+        if (logger.durability == LOG_DURABILITY_PERIODIC && time(NULL) > logger.lastSync)
+            syncDirtyFiles();
+
+        pthread_mutex_lock(&logger.lock);
+        logger.tail = end;
+        pthread_cond_broadcast(&logger.drained);
+    }
+    pthread_mutex_unlock(&logger.lock);
+
+    for (int i = 0; i < LOG_OPEN_FILES; i++) {
+        if (logger.files[i].fd > 0) {
+            syncFile(&logger.files[i]);
+            close(logger.files[i].fd);
+            logger.files[i].fd = 0;
+        }
+    }
+    return NULL;
+}
+
+static void lockBeforeFork(void)
+{
+    pthread_mutex_lock(&logger.lock);
+}
+
+static void unlockAfterFork(void)
+{
+    pthread_mutex_unlock(&logger.lock);
+}
+
+// The writer thread does not survive fork. The child leaves what is
+// queued to the parent and starts its own writer if it logs.
+static void resetAfterFork(void)
+{
+    logger.tail = logger.head;
+    logger.running = 0;
+    logger.stopping = 0;
+    memset(logger.files, 0, sizeof(logger.files));
+    pthread_mutex_unlock(&logger.lock);
+}
+
+// Called with the lock held.
+static int startLogger(void)
+{
+    static int registered = 0;
+    if (logger.running)
+        return 0;
+
+    if (logger.ring == NULL) {
+        logger.ring = malloc(LOG_RING_SIZE * sizeof(LogEntry));
+        if (logger.ring == NULL)
+            return -1;
+    }
+    logger.durability = parseDurability(getenv("TREASURE_LOG_DURABILITY"));
+    logger.stopping = 0;
+    if (pthread_create(&logger.thread, NULL, logWriter, NULL) != 0)
+        return -1;
+    logger.running = 1;
+
+    if (!registered) {
+        pthread_atfork(lockBeforeFork, unlockAfterFork, resetAfterFork);
+        atexit(closeHuntLog);
+        registered = 1;
+    }
+    return 0;
+}
+
+// Writes one line straight to the file, for when the writer cannot start.
+static void logDirectly(const LogEntry *entry)
+{
+    char logPath[1024];
+    snprintf(logPath, sizeof(logPath), "Hunts/%s/log.txt", entry->huntID);
+    int fd = open(logPath, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) {
+        perror("Error opening log file");
+        return;
+    }
+    char line[LOG_MESSAGE_MAX + 64];
+    int length = snprintf(line, sizeof(line), "%s - %s\n", timestamp(entry->when), entry->message);
+    if (length >= (int)sizeof(line))
+        length = sizeof(line) - 1;
+    if (write(fd, line, length) != length)
+        perror("Error writing to log file");
+    close(fd);
+}
+
+static void queueEntry(const char *huntID, int mayWait, const char *format, va_list args)
+{
+    LogEntry entry;
+    entry.when = time(NULL);
+    snprintf(entry.huntID, sizeof(entry.huntID), "%s", huntID);
+    vsnprintf(entry.message, sizeof(entry.message), format, args);
+
+    pthread_mutex_lock(&logger.lock);
+    if (startLogger() != 0) {
+        logDirectly(&entry);
+        pthread_mutex_unlock(&logger.lock);
+        return;
+    }
+    while (logger.head - logger.tail == LOG_RING_SIZE) {
+        if (!mayWait) {
+            logger.dropped++;
+            pthread_mutex_unlock(&logger.lock);
+            return;
+        }
+        pthread_cond_wait(&logger.drained, &logger.lock);
+    }
+    logger.ring[logger.head % LOG_RING_SIZE] = entry;
+    logger.head++;
+    pthread_cond_signal(&logger.queued);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+void logHuntEvent(const char *huntID, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    queueEntry(huntID, 1, format, args);
+    va_end(args);
+}
+
+void logHuntAccess(const char *huntID, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    queueEntry(huntID, 0, format, args);
+    va_end(args);
+}
+
+void flushHuntLog(void)
+{
+    pthread_mutex_lock(&logger.lock);
+    unsigned long target = logger.head;
+    while (logger.running && logger.tail < target)
+        pthread_cond_wait(&logger.drained, &logger.lock);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+void closeHuntLog(void)
+{
+    pthread_mutex_lock(&logger.lock);
+    if (!logger.running) {
+        pthread_mutex_unlock(&logger.lock);
+        return;
+    }
+    logger.stopping = 1;
+    pthread_cond_signal(&logger.queued);
+    pthread_mutex_unlock(&logger.lock);
+
+    pthread_join(logger.thread, NULL);
+
+    pthread_mutex_lock(&logger.lock);
+    logger.running = 0;
+    logger.stopping = 0;
+    pthread_mutex_unlock(&logger.lock);
+}
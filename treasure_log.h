@@ -0,0 +1,30 @@
+#ifndef TREASURE_LOG_H
+#define TREASURE_LOG_H
+
+// The per-hunt audit log, Hunts/<id>/log.txt. Entries are queued in memory
+// and written by a background thread that keeps the log files open and
+// writes everything queued for a file at once. TREASURE_LOG_DURABILITY
+// picks how hard it tries to get them onto disk:
+//   none     - plain writes; the kernel flushes when it likes
+//   periodic - fdatasync the logs written to, about once a second (default)
+//   sync     - fdatasync after every batch; flushHuntLog waits for it
+#define LOG_DURABILITY_NONE 0
+#define LOG_DURABILITY_PERIODIC 1
+#define LOG_DURABILITY_SYNC 2
+
+// Records a change to a hunt. Waits for room if the queue is full.
+void logHuntEvent(const char *huntID, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Records a read. Never waits: with the queue full the entry is dropped,
+// and the number dropped is noted in the log once there is room again.
+void logHuntAccess(const char *huntID, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Waits until everything queued so far is written (and synced in sync mode).
+void flushHuntLog(void);
+
+// Flushes and stops the writer. Runs at exit; call it before _exit().
+void closeHuntLog(void);
+
+#endif
@@ -4,23 +4,19 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <math.h>
 
-typedef struct
-{
-    float x, y;
-} Coordinate;
-
-typedef struct
-{
-    int id;
-    char userName[20];
-    Coordinate coord;
-    char clue[1024];
-    int value;
-} Treasure;
+#include "treasure_store.h"
+#include "treasure_index.h"
+#include "treasure_commit.h"
+#include "treasure_query.h"
+#include "treasure_import.h"
+#include "treasure_log.h"
+#include "treasure_catalog.h"
 
 int hasWritePermission(const char *path)
 {
@@ -145,58 +141,31 @@ void makeSymbolicLink(char *path, char *linkPath)
     }
 }
 
-void addTreasure(char *huntID, int id, char *userName, Coordinate coord, char *clue, int value)
+// The ID is reserved up front and the treasure handed to the hunt's group
+// commit, so concurrent adds to one hunt neither share an ID nor wait for
+// each other's writes one at a time.
+void addTreasure(char *huntID, char *userName, Coordinate coord, char *clue, int value)
 {
-    char path[1024];
-    sprintf(path, "%s/treasures.dat", huntID);
-    int treasureFile = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
-    if (treasureFile == -1)
-    {
-        perror("Error opening treasure file.\n");
-        return;
-    }
-
     Treasure treasure;
-    treasure.id = id;
+    memset(&treasure, 0, sizeof(treasure));
     strcpy(treasure.userName, userName);
     treasure.coord = coord;
     strcpy(treasure.clue, clue);
     treasure.value = value;
 
-    if (write(treasureFile, &treasure, sizeof(Treasure)) != sizeof(Treasure))
-    {
-        perror("Error writing to treasure file.\n");
-        close(treasureFile);
-        return;
-    }
-    close(treasureFile);
-    printf("Treasure added successfully.\n");
-
-    char logPath[1024];
-    sprintf(logPath, "%s/log.txt", huntID);
-    int logFile = open(logPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
-    if (logFile == -1)
+    int id;
+    if (reserveTreasureIds(huntID, 1, &id) != 0)
     {
-        perror("Error opening log file.\n");
+        perror("Error reading treasure file.\n");
         return;
     }
-
-    char logEntry[1024];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(logEntry, sizeof(logEntry), "%Y-%m-%d %H:%M:%S", tm_info);
-
-    char logMessage[2048];
-    sprintf(logMessage, "%s - Added Treasure ID: %d, User: %s, Coordinate: (%.2f, %.2f), Clue: %s, Value: %d\n",
-            logEntry, id, userName, coord.x, coord.y, clue, value);
-    if (write(logFile, logMessage, strlen(logMessage)) != strlen(logMessage))
+    treasure.id = id;
+    if (commitTreasures(huntID, &treasure, 1) != 0)
     {
-        perror("Error writing to log file.\n");
-        close(logFile);
+        perror("Error writing to treasure file.\n");
         return;
     }
-
-    close(logFile);
+    printf("Treasure added successfully with ID %d.\n", id);
 
     char huntName[1024];
     // Extract just the hunt name from the path
@@ -211,12 +180,156 @@ void addTreasure(char *huntID, int id, char *userName, Coordinate coord, char *c
         // If there's no slash, use the entire huntID
         strcpy(huntName, huntID);
     }
+    logHuntEvent(huntName, "Added Treasure ID: %d, User: %s, Coordinate: (%.2f, %.2f), Clue: %s, Value: %d",
+                 id, userName, coord.x, coord.y, clue, value);
+
+    char logPath[1024];
+    sprintf(logPath, "%s/log.txt", huntID);
     char logPathLink[2048];
     sprintf(logPathLink, "log_%s.txt", huntName);
 
     makeSymbolicLink(logPath, logPathLink);
 }
 
+// Loads a CSV or NDJSON file into a hunt. The file is parsed once into
+// memory and every line checked before anything is written, so a bad line
+// leaves the hunt untouched; the records then go in with a single append,
+// whose manifest write makes all of them visible at once or none.
+void importTreasures(char *huntID, char *filePath)
+{
+    char huntPath[1024];
+    sprintf(huntPath, "Hunts/%s", huntID);
+
+    TreasureImport import;
+    if (openTreasureImport(filePath, &import) != 0)
+    {
+        perror("Error opening import file");
+        return;
+    }
+
+    Treasure *treasures = NULL;
+    char error[256];
+    int count = 0, capacity = 0, result;
+    while (1)
+    {
+        if (count == capacity)
+        {
+            int grown = capacity > 0 ? capacity * 2 : 1024;
+            Treasure *larger = realloc(treasures, grown * sizeof(Treasure));
+            if (larger == NULL)
+            {
+                perror("Error reading import file");
+                free(treasures);
+                closeTreasureImport(&import);
+                return;
+            }
+            treasures = larger;
+            capacity = grown;
+        }
+        if ((result = nextImportedTreasure(&import, &treasures[count], error, sizeof(error))) != 1)
+            break;
+        count++;
+    }
+    if (result == -1)
+    {
+        printf("Error on line %d of %s: %s. Nothing was imported.\n", import.lineNumber, filePath, error);
+        free(treasures);
+        closeTreasureImport(&import);
+        return;
+    }
+    closeTreasureImport(&import);
+    if (count == 0)
+    {
+        printf("No treasures found in %s.\n", filePath);
+        free(treasures);
+        return;
+    }
+
+    int firstId;
+    int *ids = malloc(count * sizeof(int));
+    if (ids == NULL || reserveTreasureIds(huntPath, count, &firstId) != 0)
+    {
+        perror("Error reading treasure file");
+        free(ids);
+        free(treasures);
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        treasures[i].id = firstId + i;
+        ids[i] = treasures[i].id;
+    }
+
+    int lockFile = lockHunt(huntPath, 1);
+    if (lockFile == -1)
+    {
+        perror("Error locking hunt");
+        free(ids);
+        free(treasures);
+        return;
+    }
+    off_t offset;
+    int imported = 0;
+    if (appendTreasures(huntPath, treasures, count, &offset) != 0)
+    {
+        perror("Error writing to treasure file");
+        printf("Nothing was imported.\n");
+    }
+    else
+    {
+        recordTreasureIndexes(huntPath, ids, count, offset, sizeof(HotRow));
+        imported = count;
+    }
+    unlockHunt(lockFile);
+    free(ids);
+    free(treasures);
+
+    if (imported == 0)
+    {
+        return;
+    }
+    printf("Imported %d treasure(s) into Hunt %s (IDs %d-%d).\n", imported, huntID, firstId, firstId + imported - 1);
+
+    logHuntEvent(huntID, "Imported %d treasures (IDs %d-%d) from %s.", imported, firstId, firstId + imported - 1, filePath);
+
+    char logPath[1024];
+    sprintf(logPath, "Hunts/%s/log.txt", huntID);
+    char logPathLink[2048];
+    sprintf(logPathLink, "log_%s.txt", huntID);
+    makeSymbolicLink(logPath, logPathLink);
+}
+
+#define COMPACT_MIN_DEAD 64
+
+// Reclaims removed records once they make up at least half of a segment.
+// The work runs in a detached grandchild so remove returns immediately.
+void startBackgroundCompaction(char *huntPath)
+{
+    if (!huntNeedsCompaction(huntPath, COMPACT_MIN_DEAD))
+    {
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        if (fork() == 0)
+        {
+            int lockFile = lockHunt(huntPath, 1);
+            if (lockFile != -1)
+            {
+                compactHunt(huntPath);
+                unlockHunt(lockFile);
+            }
+        }
+        _exit(0);
+    }
+    else if (pid > 0)
+    {
+        waitpid(pid, NULL, 0);
+    }
+}
+
 int isValidHuntID(char *huntID)
 {
     if (strncmp(huntID, "Hunt", 4) != 0)
@@ -243,23 +356,10 @@ int isValidHuntID(char *huntID)
     return 1;
 }
 
+// The ID is only known once addTreasure reserves it, since other writers
+// may take IDs while the prompts wait, so it is printed after the add.
 void getTreasureInfo(char *path)
 {
-    int id = 1;
-    char treasurePath[1024];
-    sprintf(treasurePath, "%s/treasures.dat", path);
-    int treasureFile = open(treasurePath, O_RDONLY);
-    if (treasureFile != -1)
-    {
-        Treasure temp;
-        while (read(treasureFile, &temp, sizeof(Treasure)) == sizeof(Treasure))
-        {
-            id++;
-        }
-        close(treasureFile);
-    }
-    printf("Treasure ID: %d (auto-generated)\n", id);
-
     char userName[20];
     int validUserName = 0;
     while (!validUserName)
@@ -335,14 +435,74 @@ void getTreasureInfo(char *path)
         }
     }
 
-    addTreasure(path, id, userName, coord, clue, value);
+    addTreasure(path, userName, coord, clue, value);
+}
+
+// add <HuntID> --user <name> --x <x> --y <y> --clue <clue> --value <value>,
+// for scripts: no prompts, same checks.
+void addFromArguments(char *path, int argc, char *argv[])
+{
+    static const char *flags[] = {"--user", "--x", "--y", "--clue", "--value"};
+    char *fields[5] = {NULL, NULL, NULL, NULL, NULL};
+    for (int i = 0; i < argc; i += 2)
+    {
+        int known = 0;
+        for (int f = 0; f < 5 && i + 1 < argc; f++)
+        {
+            if (strcmp(argv[i], flags[f]) == 0)
+            {
+                fields[f] = argv[i + 1];
+                known = 1;
+            }
+        }
+        if (!known)
+        {
+            printf("Invalid command. Usage: ./treasure_manager add <HuntID> [--user <name> --x <x> --y <y> --clue <clue> --value <value>]\n");
+            return;
+        }
+    }
+    for (int f = 0; f < 5; f++)
+    {
+        if (fields[f] == NULL)
+        {
+            printf("Error: Missing %s.\n", flags[f]);
+            return;
+        }
+    }
+
+    Treasure treasure;
+    char error[256];
+    if (parseTreasureFields(fields, &treasure, error, sizeof(error)) != 0)
+    {
+        printf("Error: Invalid treasure: %s.\n", error);
+        return;
+    }
+    addTreasure(path, treasure.userName, treasure.coord, treasure.clue, treasure.value);
+}
+
+// Parses count numeric arguments for the location searches.
+int parseCoordinates(char **args, int count, double *values)
+{
+    for (int i = 0; i < count; i++)
+    {
+        char *end;
+        errno = 0;
+        values[i] = strtod(args[i], &end);
+        if (end == args[i] || *end != '\0' || errno != 0 || !isfinite(values[i]))
+        {
+            printf("Error: '%s' is not a valid number.\n", args[i]);
+            return 0;
+        }
+    }
+    return 1;
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc == 1 || (strcmp(argv[1], "add") != 0 && strcmp(argv[1], "list") != 0 && strcmp(argv[1], "view") != 0 && strcmp(argv[1], "remove") != 0))
+    if (argc == 1 || (strcmp(argv[1], "add") != 0 && strcmp(argv[1], "list") != 0 && strcmp(argv[1], "view") != 0 && strcmp(argv[1], "remove") != 0 && strcmp(argv[1], "compact") != 0 && strcmp(argv[1], "migrate") != 0 && strcmp(argv[1], "import") != 0 &&
+                      strcmp(argv[1], "nearby") != 0 && strcmp(argv[1], "within") != 0 && strcmp(argv[1], "nearest") != 0 && strcmp(argv[1], "search") != 0))
     {
-        printf("Invalid command. Usage: ./treasure_manager <add | list | view | remove>\n");
+        printf("Invalid command. Usage: ./treasure_manager <add | list | view | remove | compact | migrate | import | nearby | within | nearest | search>\n");
         return 0;
     }
 
@@ -353,7 +513,7 @@ int main(int argc, char *argv[])
 
     if (strcmp(argv[1], "add") == 0 && argc == 2)
     {
-        printf("Invalid command. Usage: ./treasure_manager add <HuntID>\n");
+        printf("Invalid command. Usage: ./treasure_manager add <HuntID> [--user <name> --x <x> --y <y> --clue <clue> --value <value>]\n");
         return 0;
     }
     else if (strcmp(argv[1], "add") == 0 && argc == 3)
@@ -375,13 +535,34 @@ int main(int argc, char *argv[])
             getTreasureInfo(path);
         }
     }
+    else if (strcmp(argv[1], "add") == 0)
+    {
+        if (!isValidHuntID(argv[2]))
+        {
+            return 0;
+        }
+        else
+        {
+            char path[1024];
+            sprintf(path, "Hunts/%s", argv[2]);
+            
+            if (!ensureHuntDirectory(argv[2])) {
+                printf("Failed to ensure hunt directory is accessible. Exiting.\n");
+                return 1;
+            }
+            
+            addFromArguments(path, argc - 3, argv + 3);
+        }
+    }
 
-    if (strcmp(argv[1], "list") == 0 && argc != 3)
+    ListRequest listRequest;
+    if (strcmp(argv[1], "list") == 0 &&
+        (parseListRequest(argc - 2, argv + 2, &listRequest) != 0 || listRequest.huntID != argv[2]))
     {
-        printf("Invalid command. Usage: ./treasure_manager list <HuntID>\n");
+        printf("Invalid command. Usage: ./treasure_manager list <HuntID> [--offset N] [--limit N] [--user <name>] [--min-value V] [--fields id,user,coord,clue,value]\n");
         return 0;
     }
-    else if (strcmp(argv[1], "list") == 0 && argc == 3)
+    else if (strcmp(argv[1], "list") == 0)
     {
         if (!isValidHuntID(argv[2]))
         {
@@ -394,83 +575,7 @@ int main(int argc, char *argv[])
                 return 1;
             }
             
-            char treasuresPath[1024];
-            sprintf(treasuresPath, "Hunts/%s/treasures.dat", argv[2]);
-            int treasureFile = open(treasuresPath, O_RDONLY);
-            if (treasureFile == -1)
-            {
-                perror("Error opening treasure file.\n");
-                return 0;
-            }
-
-            char huntPath[1024];
-            sprintf(huntPath, "Hunts/%s", argv[2]);
-            struct stat huntStat;
-            if (stat(huntPath, &huntStat) != 0)
-            {
-                perror("Error getting hunt directory info.\n");
-                return 0;
-            }
-
-            if (!S_ISDIR(huntStat.st_mode))
-            {
-                printf("Hunt directory does not exist.\n");
-                return 0;
-            }
-
-            printf("Hunt: %s\n", argv[2]);
-            // Get the size of the treasures file
-            struct stat treasureStat;
-            if (fstat(treasureFile, &treasureStat) == 0)
-            {
-                printf("Total treasure file size: %ld bytes\n", treasureStat.st_size);
-            }
-            else
-            {
-                printf("Total treasure file size: unknown\n");
-            }
-            char timeStr[100];
-            struct tm *tm_info = localtime(&huntStat.st_mtime);
-            strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", tm_info);
-            printf("Last modified: %s\n", timeStr);
-
-            printf("\nTreasures:\n");
-            printf("ID\tUser\tCoordinate (x, y)\tClue\tValue\n");
-            printf("--------------------------------------------------------\n");
-
-            Treasure treasure;
-            while (read(treasureFile, &treasure, sizeof(Treasure)) == sizeof(Treasure))
-            {
-                printf("ID: %d, User: %s, Coordinate: (%.2f, %.2f), Clue: %s, Value: %d\n",
-                       treasure.id, treasure.userName, treasure.coord.x, treasure.coord.y,
-                       treasure.clue, treasure.value);
-            }
-            close(treasureFile);
-
-            char logPath[1024];
-            sprintf(logPath, "Hunts/%s/log.txt", argv[2]);
-            int logFile = open(logPath, O_WRONLY | O_APPEND | O_CREAT, 0644);
-            if (logFile == -1)
-            {
-                perror("Error opening log file.\n");
-                return 0;
-            }
-
-            char logEntry[1024];
-            time_t now = time(NULL);
-            tm_info = localtime(&now);
-            strftime(logEntry, sizeof(logEntry), "%Y-%m-%d %H:%M:%S", tm_info);
-
-            char logMessage[2048];
-            sprintf(logMessage, "%s - Listed treasures.\n", logEntry);
-            if (write(logFile, logMessage, strlen(logMessage)) != strlen(logMessage))
-            {
-                perror("Error writing to log file.\n");
-                close(logFile);
-                return 0;
-            }
-
-            close(logFile);
+            queryListTreasures(&listRequest, stdout);
         }
     }
 
@@ -487,73 +592,7 @@ int main(int argc, char *argv[])
         }
         else
         {
-            char huntPath[1024];
-            sprintf(huntPath, "Hunts/%s", argv[2]);
-            DIR *dir = opendir(huntPath);
-            if (dir == NULL) {
-                printf("Hunt directory does not exist or cannot be accessed.\n");
-                return 1;
-            }
-            closedir(dir);
-            
-            char treasuresPath[1024];
-            sprintf(treasuresPath, "Hunts/%s/treasures.dat", argv[2]);
-            int treasureFile = open(treasuresPath, O_RDONLY);
-            if (treasureFile == -1)
-            {
-                perror("Error opening treasure file.\n");
-                return 0;
-            }
-
-            int treasureID = atoi(argv[3]);
-            Treasure treasure;
-            int found = 0;
-            while (read(treasureFile, &treasure, sizeof(Treasure)) == sizeof(Treasure))
-            {
-                if (treasure.id == treasureID)
-                {
-                    found = 1;
-                    printf("ID: %d, User: %s, Coordinate: (%.2f, %.2f), Clue: %s, Value: %d\n",
-                           treasure.id, treasure.userName, treasure.coord.x, treasure.coord.y,
-                           treasure.clue, treasure.value);
-                    break;
-                }
-            }
-            if (!found)
-            {
-                printf("Treasure with ID %d not found in Hunt %s.\n", treasureID, argv[2]);
-            }
-            close(treasureFile);
-
-            if (!ensureHuntDirectory(argv[2])) {
-                printf("Warning: Cannot log this view operation due to permission issues.\n");
-                return 0;
-            }
-
-            char logPath[1024];
-            sprintf(logPath, "Hunts/%s/log.txt", argv[2]);
-            int logFile = open(logPath, O_WRONLY | O_APPEND | O_CREAT, 0644);
-            if (logFile == -1)
-            {
-                perror("Error opening log file.\n");
-                return 0;
-            }
-
-            char logEntry[1024];
-            time_t now = time(NULL);
-            struct tm *tm_info = localtime(&now);
-            strftime(logEntry, sizeof(logEntry), "%Y-%m-%d %H:%M:%S", tm_info);
-
-            char logMessage[2048];
-            sprintf(logMessage, "%s - Viewed Treasure ID: %d.\n", logEntry, treasureID);
-            if (write(logFile, logMessage, strlen(logMessage)) != strlen(logMessage))
-            {
-                perror("Error writing to log file.\n");
-                close(logFile);
-                return 0;
-            }
-
-            close(logFile);
+            queryViewTreasure(argv[2], atoi(argv[3]), stdout);
         }
     }
 
@@ -592,6 +631,7 @@ int main(int argc, char *argv[])
             DIR *dir2 = opendir(path);
             if (dir2 == NULL)
             {
+                updateHuntCatalog(path);
                 printf("Hunt %s removed successfully.\n", argv[2]);
                 return 0;
             }
@@ -612,93 +652,229 @@ int main(int argc, char *argv[])
                 return 1;
             }
             
-            char treasuresPath[1024];
-            sprintf(treasuresPath, "Hunts/%s/treasures.dat", argv[2]);
-            int treasureFile = open(treasuresPath, O_RDONLY);
-            if (treasureFile == -1)
+            char huntPath[1024];
+            sprintf(huntPath, "Hunts/%s", argv[2]);
+
+            int treasureID = atoi(argv[3]);
+            int lockFile = lockHunt(huntPath, 1);
+            if (lockFile == -1)
+            {
+                perror("Error locking hunt");
+                return 1;
+            }
+            int removed = removeTreasure(huntPath, treasureID);
+            unlockHunt(lockFile);
+            if (removed == -1)
             {
                 perror("Error opening treasure file.\n");
                 return 0;
             }
 
-            int treasureID = atoi(argv[3]);
-            Treasure treasure;
-            int found = 0;
+            if (!removed)
+            {
+                printf("Treasure with ID %d not found in Hunt %s.\n", treasureID, argv[2]);
+                return 0;
+            }
+
+            printf("Treasure with ID %d removed successfully from Hunt %s.\n", treasureID, argv[2]);
+
+            logHuntEvent(argv[2], "Removed Treasure ID: %d from Hunt %s.", treasureID, argv[2]);
+
+            startBackgroundCompaction(huntPath);
+        }
+    }
 
-            while (read(treasureFile, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+    if (strcmp(argv[1], "compact") == 0 && argc != 3)
+    {
+        printf("Invalid command. Usage: ./treasure_manager compact <HuntID>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "compact") == 0 && argc == 3)
+    {
+        if (!isValidHuntID(argv[2]))
+        {
+            return 0;
+        }
+        else
+        {
+            char huntPath[1024];
+            sprintf(huntPath, "Hunts/%s", argv[2]);
+            DIR *dir = opendir(huntPath);
+            if (dir == NULL)
             {
-                if (treasure.id == treasureID)
-                {
-                    found = 1;
-                    break;
-                }
+                printf("Hunt %s does not exist.\n", argv[2]);
+                return 0;
+            }
+            closedir(dir);
+
+            if (!hasWritePermission(huntPath)) {
+                printf("Cannot compact hunt - no write permission for hunt directory.\n");
+                return 1;
             }
 
-            if (!found)
+            int lockFile = lockHunt(huntPath, 1);
+            if (lockFile == -1)
             {
-                printf("Treasure with ID %d not found in Hunt %s.\n", treasureID, argv[2]);
-                close(treasureFile);
+                perror("Error locking hunt");
+                return 1;
+            }
+            long dropped = compactHunt(huntPath);
+            unlockHunt(lockFile);
+            if (dropped == -1)
+            {
+                perror("Error compacting treasure file.\n");
                 return 0;
             }
 
-            char tempPath[1024];
-            sprintf(tempPath, "Hunts/%s/temp.dat", argv[2]);
-            int tempFile = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (tempFile == -1)
+            printf("Compacted Hunt %s: reclaimed %ld removed treasure(s).\n", argv[2], dropped);
+
+            logHuntEvent(argv[2], "Compacted Hunt %s, reclaimed %ld treasure(s).", argv[2], dropped);
+        }
+    }
+    
+    if (strcmp(argv[1], "migrate") == 0 && argc != 3)
+    {
+        printf("Invalid command. Usage: ./treasure_manager migrate <HuntID>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "migrate") == 0 && argc == 3)
+    {
+        if (!isValidHuntID(argv[2]))
+        {
+            return 0;
+        }
+        else
+        {
+            char huntPath[1024];
+            sprintf(huntPath, "Hunts/%s", argv[2]);
+            DIR *dir = opendir(huntPath);
+            if (dir == NULL)
             {
-                perror("Error creating temporary file.\n");
-                close(treasureFile);
+                printf("Hunt %s does not exist.\n", argv[2]);
                 return 0;
             }
+            closedir(dir);
 
-            lseek(treasureFile, 0, SEEK_SET);
+            if (!hasWritePermission(huntPath)) {
+                printf("Cannot migrate hunt - no write permission for hunt directory.\n");
+                return 1;
+            }
 
-            while (read(treasureFile, &treasure, sizeof(Treasure)) == sizeof(Treasure))
+            int fromVersion = 0;
+            int lockFile = lockHunt(huntPath, 1);
+            if (lockFile == -1)
             {
-                if (treasure.id != treasureID)
-                {
-                    if (treasure.id > treasureID)
-                    {
-                        treasure.id--;
-                    }
-                    write(tempFile, &treasure, sizeof(Treasure));
-                }
+                perror("Error locking hunt");
+                return 1;
+            }
+            long migrated = migrateHunt(huntPath, &fromVersion);
+            unlockHunt(lockFile);
+            if (migrated == -1)
+            {
+                perror("Error migrating treasure file.\n");
+                return 0;
+            }
+
+            if (fromVersion == TREASURE_FORMAT_CURRENT)
+            {
+                printf("Hunt %s already uses format version %d.\n", argv[2], TREASURE_FORMAT_CURRENT);
+                return 0;
             }
 
-            close(treasureFile);
-            close(tempFile);
+            printf("Migrated Hunt %s from format version %d to %d: %ld treasure(s).\n",
+                   argv[2], fromVersion, TREASURE_FORMAT_CURRENT, migrated);
 
-            remove(treasuresPath);
-            rename(tempPath, treasuresPath);
+            logHuntEvent(argv[2], "Migrated Hunt %s to format version %d.", argv[2], TREASURE_FORMAT_CURRENT);
+        }
+    }
 
-            printf("Treasure with ID %d removed successfully from Hunt %s.\n", treasureID, argv[2]);
+    if (strcmp(argv[1], "import") == 0 && argc != 4)
+    {
+        printf("Invalid command. Usage: ./treasure_manager import <HuntID> <file.csv | file.ndjson>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "import") == 0 && argc == 4)
+    {
+        if (!isValidHuntID(argv[2]))
+        {
+            return 0;
+        }
+        else
+        {
+            if (!ensureHuntDirectory(argv[2])) {
+                printf("Failed to ensure hunt directory is accessible. Exiting.\n");
+                return 1;
+            }
 
-            char logPath[1024];
-            sprintf(logPath, "Hunts/%s/log.txt", argv[2]);
-            int logFile = open(logPath, O_WRONLY | O_APPEND | O_CREAT, 0644);
-            if (logFile == -1)
+            importTreasures(argv[2], argv[3]);
+        }
+    }
+
+    if (strcmp(argv[1], "nearby") == 0 && argc != 6)
+    {
+        printf("Invalid command. Usage: ./treasure_manager nearby <HuntID> <x> <y> <radius>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "nearby") == 0 && argc == 6)
+    {
+        double values[3];
+        if (isValidHuntID(argv[2]) && parseCoordinates(argv + 3, 3, values))
+        {
+            if (values[2] < 0)
             {
-                perror("Error opening log file.\n");
+                printf("Error: The radius cannot be negative.\n");
                 return 0;
             }
+            queryNearby(argv[2], values[0], values[1], values[2], stdout);
+        }
+    }
 
-            char logEntry[1024];
-            time_t now = time(NULL);
-            struct tm *tm_info = localtime(&now);
-            strftime(logEntry, sizeof(logEntry), "%Y-%m-%d %H:%M:%S", tm_info);
+    if (strcmp(argv[1], "within") == 0 && argc != 7)
+    {
+        printf("Invalid command. Usage: ./treasure_manager within <HuntID> <x1> <y1> <x2> <y2>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "within") == 0 && argc == 7)
+    {
+        double values[4];
+        if (isValidHuntID(argv[2]) && parseCoordinates(argv + 3, 4, values))
+        {
+            queryWithin(argv[2], values[0], values[1], values[2], values[3], stdout);
+        }
+    }
 
-            char logMessage[2048];
-            sprintf(logMessage, "%s - Removed Treasure ID: %d from Hunt %s.\n", logEntry, treasureID, argv[2]);
-            if (write(logFile, logMessage, strlen(logMessage)) != strlen(logMessage))
+    if (strcmp(argv[1], "nearest") == 0 && argc != 6)
+    {
+        printf("Invalid command. Usage: ./treasure_manager nearest <HuntID> <x> <y> <k>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "nearest") == 0 && argc == 6)
+    {
+        double values[2];
+        int k = atoi(argv[5]);
+        if (isValidHuntID(argv[2]) && parseCoordinates(argv + 3, 2, values))
+        {
+            if (k <= 0)
             {
-                perror("Error writing to log file.\n");
-                close(logFile);
+                printf("Error: k must be a positive number.\n");
                 return 0;
             }
+            queryNearest(argv[2], values[0], values[1], k, stdout);
+        }
+    }
 
-            close(logFile);
+    if (strcmp(argv[1], "search") == 0 && argc < 4)
+    {
+        printf("Invalid command. Usage: ./treasure_manager search <HuntID> <terms...>\n");
+        return 0;
+    }
+    else if (strcmp(argv[1], "search") == 0 && argc >= 4)
+    {
+        if (isValidHuntID(argv[2]))
+        {
+            querySearch(argv[2], argv + 3, argc - 3, stdout);
         }
     }
-    
+
     return 0;
 }
\ No newline at end of file
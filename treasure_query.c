@@ -0,0 +1,1245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "treasure_query.h"
+#include "treasure_store.h"
+#include "treasure_index.h"
+#include "treasure_scores.h"
+#include "treasure_grid.h"
+#include "treasure_terms.h"
+#include "treasure_log.h"
+#include "treasure_catalog.h"
+#include "treasure_cache.h"
+
+#define SCORE_BLOCK_SIZE 1024
+
+struct ScoreBlock {
+    struct ScoreBlock *next;
+    int used;
+    UserScore scores[SCORE_BLOCK_SIZE];
+};
+
+static uint32_t hashUserName(const char *userName, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (unsigned char)userName[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void initScoreTable(ScoreTable *table) {
+    memset(table, 0, sizeof(*table));
+}
+
+void freeScoreTable(ScoreTable *table) {
+    while (table->blocks != NULL) {
+        ScoreBlock *next = table->blocks->next;
+        free(table->blocks);
+        table->blocks = next;
+    }
+    free(table->slots);
+    free(table->hashes);
+    memset(table, 0, sizeof(*table));
+}
+
+static UserScore *allocateUserScore(ScoreTable *table) {
+    if (table->blocks == NULL || table->blocks->used == SCORE_BLOCK_SIZE) {
+        ScoreBlock *block = malloc(sizeof(ScoreBlock));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+        block->next = table->blocks;
+        table->blocks = block;
+    }
+    return &table->blocks->scores[table->blocks->used++];
+}
+
+static int growScoreTable(ScoreTable *table) {
+    size_t capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+    UserScore **slots = calloc(capacity, sizeof(UserScore *));
+    uint32_t *hashes = calloc(capacity, sizeof(uint32_t));
+    if (slots == NULL || hashes == NULL) {
+        free(slots);
+        free(hashes);
+        return -1;
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i] == NULL)
+            continue;
+        size_t slot = table->hashes[i] & (capacity - 1);
+        while (slots[slot] != NULL)
+            slot = (slot + 1) & (capacity - 1);
+        slots[slot] = table->slots[i];
+        hashes[slot] = table->hashes[i];
+    }
+
+    free(table->slots);
+    free(table->hashes);
+    table->slots = slots;
+    table->hashes = hashes;
+    table->capacity = capacity;
+    return 0;
+}
+
+UserScore *findOrAddUserScore(ScoreTable *table, const char *userName, int length) {
+    if (length >= (int)sizeof(((UserScore *)0)->userName))
+        length = sizeof(((UserScore *)0)->userName) - 1;
+
+    // Keep the load factor under 3/4 so probe sequences stay short.
+    if ((size_t)(table->count + 1) * 4 > table->capacity * 3 && growScoreTable(table) != 0) {
+        return NULL;
+    }
+
+    uint32_t hash = hashUserName(userName, length);
+    size_t slot = hash & (table->capacity - 1);
+    while (table->slots[slot] != NULL) {
+        UserScore *score = table->slots[slot];
+        if (table->hashes[slot] == hash && strncmp(score->userName, userName, length) == 0 &&
+            score->userName[length] == '\0') {
+            return score;
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    UserScore *score = allocateUserScore(table);
+    if (score == NULL) {
+        return NULL;
+    }
+    memcpy(score->userName, userName, length);
+    score->userName[length] = '\0';
+    score->totalValue = 0;
+    score->treasureCount = 0;
+    table->slots[slot] = score;
+    table->hashes[slot] = hash;
+    table->count++;
+    return score;
+}
+
+int addOrUpdateUserScore(ScoreTable *table, const char *userName, int length, int value) {
+    UserScore *score = findOrAddUserScore(table, userName, length);
+    if (score == NULL) {
+        return -1;
+    }
+    score->totalValue += value;
+    score->treasureCount++;
+    return 0;
+}
+
+int mergeScoreTable(ScoreTable *into, const ScoreTable *from) {
+    for (size_t i = 0; i < from->capacity; i++) {
+        const UserScore *source = from->slots[i];
+        if (source == NULL)
+            continue;
+        UserScore *score = findOrAddUserScore(into, source->userName, strlen(source->userName));
+        if (score == NULL) {
+            return -1;
+        }
+        score->totalValue += source->totalValue;
+        score->treasureCount += source->treasureCount;
+    }
+    return 0;
+}
+
+// Highest total first; ties are broken by name so the ranking (and the
+// result of --top) does not depend on hash table order.
+static int compareScores(const void *a, const void *b) {
+    const UserScore *userA = *(UserScore *const *)a;
+    const UserScore *userB = *(UserScore *const *)b;
+    
+    if (userA->totalValue != userB->totalValue)
+        return userA->totalValue < userB->totalValue ? 1 : -1;
+    return strcmp(userA->userName, userB->userName);
+}
+
+static void siftDownWorst(UserScore **heap, int count, int index) {
+    while (1) {
+        int worst = index;
+        int left = 2 * index + 1, right = left + 1;
+        if (left < count && compareScores(&heap[left], &heap[worst]) > 0)
+            worst = left;
+        if (right < count && compareScores(&heap[right], &heap[worst]) > 0)
+            worst = right;
+        if (worst == index)
+            return;
+        UserScore *swap = heap[index];
+        heap[index] = heap[worst];
+        heap[worst] = swap;
+        index = worst;
+    }
+}
+
+// Moves the k best scores to the front of the array in ranking order. The
+// front acts as a heap with the worst of the current top k at its root, so
+// this costs O(n log k) instead of sorting all n users.
+int selectTopScores(UserScore **scores, int count, int k) {
+    if (k >= count) {
+        qsort(scores, count, sizeof(UserScore *), compareScores);
+        return count;
+    }
+
+    for (int i = k / 2 - 1; i >= 0; i--)
+        siftDownWorst(scores, k, i);
+    for (int i = k; i < count; i++) {
+        if (compareScores(&scores[i], &scores[0]) < 0) {
+            UserScore *swap = scores[0];
+            scores[0] = scores[i];
+            scores[i] = swap;
+            siftDownWorst(scores, k, 0);
+        }
+    }
+
+    qsort(scores, k, sizeof(UserScore *), compareScores);
+    return k;
+}
+
+#define SCORE_OK 0
+#define SCORE_NO_HUNT 1
+#define SCORE_NO_FILE 2
+#define SCORE_NO_MEMORY 3
+
+typedef struct {
+    const char *huntID;
+    ScoreTable table;
+    int status;
+} HuntScores;
+
+static void addScoreEntries(HuntScores *hunt, const ScoreFileEntry *entries, int count) {
+    for (int i = 0; i < count; i++) {
+        const char *userName = entries[i].userName;
+        UserScore *score = findOrAddUserScore(&hunt->table, userName, strnlen(userName, sizeof(entries[i].userName)));
+        if (score == NULL) {
+            hunt->status = SCORE_NO_MEMORY;
+            break;
+        }
+        score->totalValue = entries[i].totalValue;
+        score->treasureCount = entries[i].treasureCount;
+    }
+}
+
+// Fills the table from scores.dat if it matches the hunt's generation.
+static int loadHuntScores(HuntScores *hunt, const char *huntPath, uint32_t generation) {
+    ScoreFileEntry *entries;
+    int count;
+    if (readHuntScores(huntPath, generation, &entries, &count) != 0) {
+        return -1;
+    }
+    
+    addScoreEntries(hunt, entries, count);
+    free(entries);
+    return 0;
+}
+
+static ScoreFileEntry *scoreTableEntries(const ScoreTable *table, int *count) {
+    ScoreFileEntry *entries = calloc(table->count > 0 ? table->count : 1, sizeof(ScoreFileEntry));
+    if (entries == NULL) {
+        return NULL;
+    }
+    *count = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        const UserScore *score = table->slots[i];
+        if (score == NULL)
+            continue;
+        memcpy(entries[*count].userName, score->userName, sizeof(entries[*count].userName));
+        entries[*count].totalValue = score->totalValue;
+        entries[*count].treasureCount = score->treasureCount;
+        (*count)++;
+    }
+    return entries;
+}
+
+// Stores a freshly scanned table for the next query. Nothing is held while
+// scanning, so it is only kept if the hunt is still at the same generation;
+// a writer that slips in after that check moves the header on and the
+// file is simply stale.
+static void saveHuntScores(const HuntScores *hunt, const char *huntPath, uint32_t generation) {
+    TreasureCounts counts;
+    if (readCurrentTreasureCounts(huntPath, &counts) != 0 || counts.generation != generation) {
+        return;
+    }
+    
+    int count;
+    ScoreFileEntry *entries = scoreTableEntries(&hunt->table, &count);
+    if (entries == NULL) {
+        return;
+    }
+    writeHuntScores(huntPath, generation, entries, count);
+    free(entries);
+}
+
+typedef struct {
+    ScoreTable table;
+    int failed;
+} SegmentScores;
+
+static void scoreSegment(const TreasureMap *map, int segment, void *context) {
+    SegmentScores *scores = context;
+    initScoreTable(&scores->table);
+    TreasureCursor cursor;
+    TreasureRecord treasure;
+    startSegmentCursor(map, segment, &cursor);
+    while (nextTreasure(&cursor, &treasure)) {
+        if (!TREASURE_IS_LIVE(&treasure))
+            continue;
+        if (addOrUpdateUserScore(&scores->table, treasure.userName, treasure.userNameLength, treasure.value) != 0) {
+            scores->failed = 1;
+            break;
+        }
+    }
+}
+
+// Each segment is totalled into its own table, in parallel, and the tables
+// are merged afterwards.
+static void scoreMap(HuntScores *hunt, const TreasureMap *map) {
+    SegmentScores *segments = calloc(map->segmentCount > 0 ? map->segmentCount : 1, sizeof(SegmentScores));
+    if (segments == NULL) {
+        hunt->status = SCORE_NO_MEMORY;
+        return;
+    }
+    scanTreasureSegments(map, scoreSegment, segments, sizeof(SegmentScores));
+    for (int i = 0; i < map->segmentCount; i++) {
+        if (segments[i].failed || mergeScoreTable(&hunt->table, &segments[i].table) != 0)
+            hunt->status = SCORE_NO_MEMORY;
+        freeScoreTable(&segments[i].table);
+    }
+    free(segments);
+}
+
+// A hunt held by the monitor's cache keeps its totals after the first
+// scan, so later queries only copy them out.
+static void scoreCachedHunt(HuntScores *hunt, CachedHunt *cached) {
+    hunt->status = SCORE_OK;
+    pthread_mutex_lock(&cached->lock);
+    if (cached->scores != NULL) {
+        addScoreEntries(hunt, cached->scores, cached->scoreCount);
+        pthread_mutex_unlock(&cached->lock);
+        return;
+    }
+    pthread_mutex_unlock(&cached->lock);
+    
+    scoreMap(hunt, &cached->map);
+    int count;
+    ScoreFileEntry *entries;
+    if (hunt->status == SCORE_OK && (entries = scoreTableEntries(&hunt->table, &count)) != NULL) {
+        setCachedScores(cached, entries, count);
+    }
+}
+
+static void scoreHunt(HuntScores *hunt) {
+    initScoreTable(&hunt->table);
+    
+    CachedHunt *cached = acquireCachedHunt(hunt->huntID);
+    if (cached != NULL) {
+        scoreCachedHunt(hunt, cached);
+        releaseCachedHunt(cached);
+        return;
+    }
+    
+    char huntPath[1024];
+    sprintf(huntPath, "Hunts/%s", hunt->huntID);
+    
+    if (access(huntPath, F_OK) != 0) {
+        hunt->status = SCORE_NO_HUNT;
+        return;
+    }
+    
+    // Most of the time scores.dat is current and this is O(users).
+    hunt->status = SCORE_OK;
+    TreasureCounts counts;
+    int current = readCurrentTreasureCounts(huntPath, &counts) == 0;
+    uint32_t generation = current ? counts.generation : 0;
+    if (current && loadHuntScores(hunt, huntPath, generation) == 0) {
+        return;
+    }
+    
+    char treasurePath[1024];
+    sprintf(treasurePath, "Hunts/%s/treasures.dat", hunt->huntID);
+    
+    TreasureMap map;
+    if (openTreasureMap(treasurePath, TREASURE_ACCESS_SEQUENTIAL, &map) != 0) {
+        hunt->status = SCORE_NO_FILE;
+        return;
+    }
+    
+    scoreMap(hunt, &map);
+    closeTreasureMap(&map);
+    if (current && hunt->status == SCORE_OK) {
+        saveHuntScores(hunt, huntPath, generation);
+    }
+}
+
+typedef struct {
+    HuntScores *hunts;
+    int huntCount;
+    int next;
+    pthread_mutex_t lock;
+} ScoreQueue;
+
+static void *scoreWorker(void *arg) {
+    ScoreQueue *queue = arg;
+    while (1) {
+        pthread_mutex_lock(&queue->lock);
+        int index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        
+        if (index >= queue->huntCount)
+            return NULL;
+        scoreHunt(&queue->hunts[index]);
+    }
+}
+
+// Scores every hunt on a pool of threads sized to the online cores. Each
+// worker pulls the next hunt off a shared counter and fills its own table,
+// so the workers never contend on anything but that counter.
+static void scoreHunts(HuntScores *hunts, int huntCount) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workerCount = cores > 0 ? (int)cores : 1;
+    if (workerCount > huntCount)
+        workerCount = huntCount;
+    
+    ScoreQueue queue;
+    queue.hunts = hunts;
+    queue.huntCount = huntCount;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    
+    pthread_t *workers = malloc(workerCount * sizeof(pthread_t));
+    int started = 0;
+    if (workers != NULL) {
+        for (; started < workerCount; started++) {
+            if (pthread_create(&workers[started], NULL, scoreWorker, &queue) != 0)
+                break;
+        }
+    }
+    if (started == 0) {
+        // No threads available: do the work here.
+        scoreWorker(&queue);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+}
+
+static int printRankings(const ScoreTable *table, int top, FILE *out) {
+    int scoreCount = table->count;
+    UserScore **scores = malloc((scoreCount > 0 ? scoreCount : 1) * sizeof(UserScore *));
+    if (scores == NULL) {
+        fprintf(out, "Error: Out of memory while calculating scores.\n");
+        return -1;
+    }
+    int collected = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i] != NULL)
+            scores[collected++] = table->slots[i];
+    }
+    
+    int shown = selectTopScores(scores, scoreCount, top > 0 ? top : scoreCount);
+    
+    fprintf(out, "User Rankings:\n");
+    fprintf(out, "%-20s %-15s %-15s\n", "Username", "Total Value", "# of Treasures");
+    fprintf(out, "------------------------------------------------\n");
+    
+    for (int i = 0; i < shown; i++) {
+        fprintf(out, "%-20s %-15d %-15d\n", 
+                scores[i]->userName, 
+                scores[i]->totalValue, 
+                scores[i]->treasureCount);
+    }
+    
+    fprintf(out, "\nTotal Users: %d\n", scoreCount);
+    free(scores);
+    return 0;
+}
+
+static void printHuntReport(const HuntScores *hunt, int top, FILE *out) {
+    fprintf(out, "=== Score Report for Hunt %s ===\n\n", hunt->huntID);
+    
+    if (hunt->table.count == 0) {
+        fprintf(out, "No treasures found in this hunt.\n");
+    } else {
+        printRankings(&hunt->table, top, out);
+    }
+}
+
+static int printHuntError(const HuntScores *hunt, FILE *out) {
+    switch (hunt->status) {
+    case SCORE_NO_HUNT:
+        fprintf(out, "Hunt %s does not exist.\n", hunt->huntID);
+        return 1;
+    case SCORE_NO_FILE:
+        fprintf(out, "Error: Could not open treasures file for hunt %s.\n", hunt->huntID);
+        return 1;
+    case SCORE_NO_MEMORY:
+        fprintf(out, "Error: Out of memory while calculating scores for hunt %s.\n", hunt->huntID);
+        return 1;
+    }
+    return 0;
+}
+
+// Hunt IDs come from the command line and from hub requests; never let one
+// name a path outside Hunts/.
+int isHuntName(const char *name) {
+    return strncmp(name, "Hunt", 4) == 0 && strchr(name, '/') == NULL;
+}
+
+// Lists the hunts that have a treasure file, sorted by name, from
+// Hunts/catalog. The names are kept in *names for the caller to free.
+static int listAllHunts(char ***names) {
+    *names = NULL;
+    CatalogEntry *entries;
+    int count;
+    if (readHuntCatalog("Hunts", &entries, &count) != 0) {
+        return -1;
+    }
+    
+    *names = malloc((count > 0 ? count : 1) * sizeof(char *));
+    if (*names == NULL) {
+        free(entries);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        (*names)[i] = strdup(entries[i].name);
+    }
+    free(entries);
+    return count;
+}
+
+static void freeHuntNames(char **names, int count) {
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+}
+
+int parseScoreRequest(int argc, char **argv, ScoreRequest *request) {
+    memset(request, 0, sizeof(*request));
+    request->huntIDs = malloc((argc > 0 ? argc : 1) * sizeof(char *));
+    int valid = request->huntIDs != NULL;
+    for (int i = 0; i < argc && valid; i++) {
+        if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            request->top = atoi(argv[++i]);
+            valid = request->top > 0;
+        } else if (strcmp(argv[i], "--all") == 0) {
+            request->all = 1;
+        } else if (strcmp(argv[i], "--breakdown") == 0) {
+            request->breakdown = 1;
+        } else if (argv[i][0] == '-') {
+            valid = 0;
+        } else {
+            request->huntIDs[request->huntCount++] = argv[i];
+        }
+    }
+    
+    if (!valid || (request->all && request->huntCount > 0) || (!request->all && request->huntCount == 0)) {
+        freeScoreRequest(request);
+        return -1;
+    }
+    return 0;
+}
+
+void freeScoreRequest(ScoreRequest *request) {
+    free(request->huntIDs);
+    memset(request, 0, sizeof(*request));
+}
+
+static int parseNumber(const char *text, long min, long *value) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || errno != 0 || parsed < min || parsed > INT32_MAX) {
+        return -1;
+    }
+    *value = parsed;
+    return 0;
+}
+
+static int parseListFields(const char *text, int *fields) {
+    static const char *names[] = {"id", "user", "coord", "clue", "value"};
+    char copy[128];
+    if (strlen(text) >= sizeof(copy)) {
+        return -1;
+    }
+    strcpy(copy, text);
+    *fields = 0;
+    char *save;
+    for (char *name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        int i = 0;
+        while (i < 5 && strcmp(name, names[i]) != 0)
+            i++;
+        if (i == 5)
+            return -1;
+        *fields |= 1 << i;
+    }
+    return *fields != 0 ? 0 : -1;
+}
+
+int parseListRequest(int argc, char **argv, ListRequest *request) {
+    memset(request, 0, sizeof(*request));
+    request->limit = -1;
+    request->fields = LIST_FIELDS_ALL;
+    int valid = 1;
+    for (int i = 0; i < argc && valid; i++) {
+        long number;
+        if (argv[i][0] != '-' && request->huntID == NULL) {
+            request->huntID = argv[i];
+        } else if (i + 1 >= argc) {
+            valid = 0;
+        } else if (strcmp(argv[i], "--offset") == 0) {
+            valid = parseNumber(argv[++i], 0, &request->offset) == 0;
+        } else if (strcmp(argv[i], "--limit") == 0) {
+            valid = parseNumber(argv[++i], 0, &request->limit) == 0;
+        } else if (strcmp(argv[i], "--user") == 0) {
+            request->user = argv[++i];
+        } else if (strcmp(argv[i], "--min-value") == 0) {
+            valid = parseNumber(argv[++i], INT32_MIN, &number) == 0;
+            request->minValue = number;
+            request->hasMinValue = 1;
+        } else if (strcmp(argv[i], "--fields") == 0) {
+            valid = parseListFields(argv[++i], &request->fields) == 0;
+        } else {
+            valid = 0;
+        }
+    }
+    return valid && request->huntID != NULL ? 0 : -1;
+}
+
+int queryScores(const ScoreRequest *request, FILE *out) {
+    int huntCount = request->huntCount;
+    char **allHunts = NULL;
+    if (request->all) {
+        huntCount = listAllHunts(&allHunts);
+        if (huntCount <= 0) {
+            fprintf(out, "No hunts found.\n");
+            free(allHunts);
+            return 0;
+        }
+    } else if (huntCount <= 0) {
+        fprintf(out, "No hunt IDs given.\n");
+        return 1;
+    }
+    
+    for (int i = 0; i < huntCount && !request->all; i++) {
+        if (!isHuntName(request->huntIDs[i])) {
+            fprintf(out, "Invalid hunt ID format. Hunt ID should start with 'Hunt'.\n");
+            return 1;
+        }
+    }
+    
+    HuntScores *hunts = calloc(huntCount, sizeof(HuntScores));
+    if (hunts == NULL) {
+        fprintf(out, "Error: Out of memory while calculating scores.\n");
+        freeHuntNames(allHunts, request->all ? huntCount : 0);
+        return 1;
+    }
+    for (int i = 0; i < huntCount; i++) {
+        hunts[i].huntID = request->all ? allHunts[i] : request->huntIDs[i];
+    }
+    
+    scoreHunts(hunts, huntCount);
+    
+    int failed = 0;
+    if (huntCount == 1 && !request->all) {
+        failed = printHuntError(&hunts[0], out);
+        if (!failed) {
+            printHuntReport(&hunts[0], request->top, out);
+        }
+    } else {
+        ScoreTable global;
+        initScoreTable(&global);
+        int scored = 0;
+        for (int i = 0; i < huntCount; i++) {
+            if (printHuntError(&hunts[i], out)) {
+                failed = 1;
+                continue;
+            }
+            if (mergeScoreTable(&global, &hunts[i].table) != 0) {
+                fprintf(out, "Error: Out of memory while calculating scores.\n");
+                failed = 1;
+                break;
+            }
+            scored++;
+        }
+        
+        fprintf(out, "=== Global Score Report (%d hunts) ===\n\n", scored);
+        if (global.count == 0) {
+            fprintf(out, "No treasures found in these hunts.\n");
+        } else {
+            printRankings(&global, request->top, out);
+        }
+        freeScoreTable(&global);
+        
+        for (int i = 0; i < huntCount && request->breakdown; i++) {
+            if (hunts[i].status == SCORE_OK) {
+                fprintf(out, "\n");
+                printHuntReport(&hunts[i], request->top, out);
+            }
+        }
+    }
+    
+    for (int i = 0; i < huntCount; i++) {
+        if (hunts[i].status == SCORE_OK) {
+            logHuntAccess(hunts[i].huntID, "Calculated scores for hunt %s.", hunts[i].huntID);
+        }
+        freeScoreTable(&hunts[i].table);
+    }
+    
+    free(hunts);
+    freeHuntNames(allHunts, request->all ? huntCount : 0);
+    return failed;
+}
+
+int queryListHunts(FILE *out) {
+    // One read of Hunts/catalog instead of a header read per hunt.
+    CatalogEntry *entries;
+    int count;
+    if (readHuntCatalog("Hunts", &entries, &count) != 0) {
+        fprintf(out, "No hunts found or error accessing directory.\n");
+        return 1;
+    }
+    
+    fprintf(out, "=== Available Hunts ===\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "Hunt: %s, Treasures: %d\n", entries[i].name, entries[i].treasures);
+    }
+    fprintf(out, "\nTotal Hunts: %d\n", count);
+    
+    free(entries);
+    return 0;
+}
+
+static int listMatches(const ListRequest *request, const TreasureRecord *treasure) {
+    if (!TREASURE_IS_LIVE(treasure))
+        return 0;
+    if (request->hasMinValue && treasure->value < request->minValue)
+        return 0;
+    if (request->user != NULL && (treasure->userNameLength != (int)strlen(request->user) ||
+                                  memcmp(treasure->userName, request->user, treasure->userNameLength) != 0))
+        return 0;
+    return 1;
+}
+
+static void printListRecord(const ListRequest *request, const TreasureRecord *treasure, FILE *out) {
+    const char *separator = "";
+    if (request->fields & LIST_FIELD_ID) {
+        fprintf(out, "ID: %d", treasure->id);
+        separator = ", ";
+    }
+    if (request->fields & LIST_FIELD_USER) {
+        fprintf(out, "%sUser: %.*s", separator, treasure->userNameLength, treasure->userName);
+        separator = ", ";
+    }
+    if (request->fields & LIST_FIELD_COORD) {
+        fprintf(out, "%sCoordinate: (%.2f, %.2f)", separator, treasure->coord.x, treasure->coord.y);
+        separator = ", ";
+    }
+    if (request->fields & LIST_FIELD_CLUE) {
+        fprintf(out, "%sClue: %.*s", separator, treasure->clueLength, treasure->clue);
+        separator = ", ";
+    }
+    if (request->fields & LIST_FIELD_VALUE)
+        fprintf(out, "%sValue: %d", separator, treasure->value);
+    fprintf(out, "\n");
+}
+
+static void printSegmentTreasures(const ListRequest *request, const TreasureMap *map, int segment, FILE *out) {
+    TreasureCursor cursor;
+    TreasureRecord treasure;
+    startSegmentCursor(map, segment, &cursor);
+    while (nextTreasure(&cursor, &treasure)) {
+        if (listMatches(request, &treasure))
+            printListRecord(request, &treasure, out);
+    }
+}
+
+#define LIST_WINDOW 8
+
+typedef struct {
+    char *text;
+    size_t length;
+    int segment; // -1 while the slot holds nothing ready to write
+} SegmentText;
+
+typedef struct {
+    const ListRequest *request;
+    const TreasureMap *map;
+    SegmentText slots[LIST_WINDOW];
+    int window;
+    int next;
+    int written;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} ListPipeline;
+
+// Formats segments into memory, never more than a window ahead of the
+// writer, so segment s always lands in the slot segment s - window left.
+static void *formatWorker(void *arg) {
+    ListPipeline *pipeline = arg;
+    pthread_mutex_lock(&pipeline->lock);
+    while (pipeline->next < pipeline->map->segmentCount) {
+        int segment = pipeline->next;
+        if (segment >= pipeline->written + pipeline->window) {
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+            continue;
+        }
+        pipeline->next++;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        char *text = NULL;
+        size_t length = 0;
+        FILE *out = open_memstream(&text, &length);
+        if (out != NULL) {
+            printSegmentTreasures(pipeline->request, pipeline->map, segment, out);
+            fclose(out);
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        SegmentText *slot = &pipeline->slots[segment % pipeline->window];
+        slot->text = out != NULL ? text : NULL;
+        slot->length = length;
+        slot->segment = segment;
+        pthread_cond_broadcast(&pipeline->changed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+// Without a page, a few workers format the next segments while this thread
+// writes them out in order, each one as soon as it is ready. Memory stays
+// bounded by the window and the first rows go out after one segment. A
+// segment that could not be buffered is printed directly.
+static void printAllTreasures(const ListRequest *request, const TreasureMap *map, FILE *out) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workerCount = cores > 0 ? (int)cores : 1;
+    if (workerCount > LIST_WINDOW)
+        workerCount = LIST_WINDOW;
+    if (workerCount > map->segmentCount)
+        workerCount = map->segmentCount;
+
+    ListPipeline pipeline;
+    pipeline.request = request;
+    pipeline.map = map;
+    pipeline.window = LIST_WINDOW;
+    pipeline.next = 0;
+    pipeline.written = 0;
+    for (int i = 0; i < LIST_WINDOW; i++) {
+        pipeline.slots[i].text = NULL;
+        pipeline.slots[i].segment = -1;
+    }
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.changed, NULL);
+
+    pthread_t workers[LIST_WINDOW];
+    int started = 0;
+    for (; workerCount > 1 && started < workerCount; started++) {
+        if (pthread_create(&workers[started], NULL, formatWorker, &pipeline) != 0)
+            break;
+    }
+
+    for (int segment = 0; segment < map->segmentCount; segment++) {
+        if (started == 0) {
+            // One segment, one core or no threads to be had.
+            printSegmentTreasures(request, map, segment, out);
+            continue;
+        }
+        SegmentText *slot = &pipeline.slots[segment % pipeline.window];
+        pthread_mutex_lock(&pipeline.lock);
+        while (slot->segment != segment)
+            pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+        char *text = slot->text;
+        size_t length = slot->length;
+        slot->segment = -1;
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (text != NULL) {
+            fwrite(text, 1, length, out);
+            free(text);
+        } else {
+            printSegmentTreasures(request, map, segment, out);
+        }
+
+        pthread_mutex_lock(&pipeline.lock);
+        pipeline.written++;
+        pthread_cond_broadcast(&pipeline.changed);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_cond_destroy(&pipeline.changed);
+    pthread_mutex_destroy(&pipeline.lock);
+}
+
+// A page is read in order and the scan stops one match past its end. With
+// no filters, whole segments before the page are skipped by the manifest's
+// live counts, so a page costs at most one segment more than its own rows.
+static void printTreasurePage(const ListRequest *request, const TreasureMap *map, FILE *out) {
+    long skip = request->offset;
+    int segment = 0;
+    if (request->user == NULL && !request->hasMinValue) {
+        while (segment < map->segmentCount && map->segments[segment].liveCount >= 0 &&
+               map->segments[segment].liveCount <= skip) {
+            skip -= map->segments[segment].liveCount;
+            segment++;
+        }
+    }
+
+    TreasureCursor cursor;
+    TreasureRecord treasure;
+    startSegmentCursor(map, segment, &cursor);
+    cursor.lastSegment = map->segmentCount - 1;
+    long shown = 0;
+    int more = 0;
+    while (nextTreasure(&cursor, &treasure)) {
+        if (!listMatches(request, &treasure))
+            continue;
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        if (request->limit >= 0 && shown == request->limit) {
+            more = 1;
+            break;
+        }
+        printListRecord(request, &treasure, out);
+        shown++;
+    }
+    fprintf(out, "\nShowing %ld treasure(s) from offset %ld%s.\n", shown, request->offset,
+            more ? "; more follow" : "");
+}
+
+static void printTreasureList(const ListRequest *request, const TreasureMap *map, time_t modified, FILE *out) {
+    fprintf(out, "Hunt: %s\n", request->huntID);
+    // Rows plus clue bytes; from version 4 these span several files.
+    fprintf(out, "Data size: %zu bytes\n", map->length + map->clueLength);
+    char timeStr[100];
+    struct tm tm_info;
+    localtime_r(&modified, &tm_info);
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &tm_info);
+    fprintf(out, "Last modified: %s\n", timeStr);
+    
+    static const char *columns[] = {"ID", "User", "Coordinate (x, y)", "Clue", "Value"};
+    fprintf(out, "\nTreasures:\n");
+    const char *separator = "";
+    for (int i = 0; i < 5; i++) {
+        if (request->fields & (1 << i)) {
+            fprintf(out, "%s%s", separator, columns[i]);
+            separator = "\t";
+        }
+    }
+    fprintf(out, "\n--------------------------------------------------------\n");
+    
+    if (request->offset == 0 && request->limit < 0) {
+        printAllTreasures(request, map, out);
+    } else {
+        printTreasurePage(request, map, out);
+    }
+}
+
+int queryListTreasures(const ListRequest *request, FILE *out) {
+    const char *huntID = request->huntID;
+    if (!isHuntName(huntID)) {
+        fprintf(out, "Invalid hunt ID format. Hunt ID should start with 'Hunt'.\n");
+        return 1;
+    }
+    
+    CachedHunt *cached = acquireCachedHunt(huntID);
+    if (cached != NULL) {
+        printTreasureList(request, &cached->map, cached->modified, out);
+        releaseCachedHunt(cached);
+        logHuntAccess(huntID, "Listed treasures.");
+        return 0;
+    }
+    
+    char huntPath[1024];
+    snprintf(huntPath, sizeof(huntPath), "Hunts/%s", huntID);
+    struct stat huntStat;
+    if (stat(huntPath, &huntStat) != 0 || !S_ISDIR(huntStat.st_mode)) {
+        fprintf(out, "Hunt directory does not exist.\n");
+        return 1;
+    }
+    
+    char treasuresPath[1100];
+    snprintf(treasuresPath, sizeof(treasuresPath), "%s/treasures.dat", huntPath);
+    TreasureMap map;
+    if (openTreasureMap(treasuresPath, TREASURE_ACCESS_SEQUENTIAL | TREASURE_WITH_CLUES, &map) != 0) {
+        fprintf(out, "Error opening treasure file: %s\n", strerror(errno));
+        return 1;
+    }
+    printTreasureList(request, &map, huntStat.st_mtime, out);
+    closeTreasureMap(&map);
+    
+    logHuntAccess(huntID, "Listed treasures.");
+    return 0;
+}
+
+int queryViewTreasure(const char *huntID, int treasureID, FILE *out) {
+    if (!isHuntName(huntID)) {
+        fprintf(out, "Invalid hunt ID format. Hunt ID should start with 'Hunt'.\n");
+        return 1;
+    }
+    
+    Treasure treasure;
+    int found;
+    CachedHunt *cached = acquireCachedHunt(huntID);
+    if (cached != NULL) {
+        found = findCachedTreasure(cached, treasureID, &treasure);
+        releaseCachedHunt(cached);
+    } else {
+        char huntPath[1024];
+        snprintf(huntPath, sizeof(huntPath), "Hunts/%s", huntID);
+        DIR *dir = opendir(huntPath);
+        if (dir == NULL) {
+            fprintf(out, "Hunt directory does not exist or cannot be accessed.\n");
+            return 1;
+        }
+        closedir(dir);
+        found = lookupTreasure(huntPath, treasureID, &treasure);
+    }
+    if (found == -1) {
+        fprintf(out, "Error opening treasure file: %s\n", strerror(errno));
+        return 1;
+    }
+    if (found) {
+        fprintf(out, "ID: %d, User: %s, Coordinate: (%.2f, %.2f), Clue: %s, Value: %d\n",
+                treasure.id, treasure.userName, treasure.coord.x, treasure.coord.y,
+                treasure.clue, treasure.value);
+    } else {
+        fprintf(out, "Treasure with ID %d not found in Hunt %s.\n", treasureID, huntID);
+    }
+    
+    logHuntAccess(huntID, "Viewed Treasure ID: %d.", treasureID);
+    return 0;
+}
+
+// Opens a hunt's records and coordinate grid for the location queries.
+static int openHuntSearch(const char *huntID, TreasureMap *map, TreasureGrid *grid, FILE *out) {
+    if (!isHuntName(huntID)) {
+        fprintf(out, "Invalid hunt ID format. Hunt ID should start with 'Hunt'.\n");
+        return -1;
+    }
+    
+    char huntPath[1024];
+    snprintf(huntPath, sizeof(huntPath), "Hunts/%s", huntID);
+    struct stat huntStat;
+    if (stat(huntPath, &huntStat) != 0 || !S_ISDIR(huntStat.st_mode)) {
+        fprintf(out, "Hunt directory does not exist.\n");
+        return -1;
+    }
+    
+    char treasuresPath[1100];
+    snprintf(treasuresPath, sizeof(treasuresPath), "%s/treasures.dat", huntPath);
+    if (openTreasureMap(treasuresPath, TREASURE_ACCESS_RANDOM | TREASURE_WITH_CLUES, map) != 0) {
+        fprintf(out, "Error opening treasure file: %s\n", strerror(errno));
+        return -1;
+    }
+    if (openTreasureGrid(huntPath, map, grid) != 0) {
+        fprintf(out, "Error: Out of memory while indexing coordinates for hunt %s.\n", huntID);
+        closeTreasureMap(map);
+        return -1;
+    }
+    return 0;
+}
+
+static void printMatches(const TreasureMap *map, const GridMatch *matches, int count, int withDistance, FILE *out) {
+    for (int i = 0; i < count; i++) {
+        TreasureCursor cursor;
+        TreasureRecord treasure;
+        seekTreasureCursor(map, matches[i].offset, &cursor);
+        if (!nextTreasure(&cursor, &treasure))
+            continue;
+        fprintf(out, "ID: %d, User: %.*s, Coordinate: (%.2f, %.2f), Clue: %.*s, Value: %d",
+                treasure.id, treasure.userNameLength, treasure.userName, treasure.coord.x, treasure.coord.y,
+                treasure.clueLength, treasure.clue, treasure.value);
+        if (withDistance)
+            fprintf(out, ", Distance: %.2f", matches[i].distance);
+        fprintf(out, "\n");
+    }
+    fprintf(out, "Found %d treasure(s).\n", count);
+}
+
+int queryNearby(const char *huntID, double x, double y, double radius, FILE *out) {
+    TreasureMap map;
+    TreasureGrid grid;
+    if (openHuntSearch(huntID, &map, &grid, out) != 0) {
+        return 1;
+    }
+    
+    GridMatch *matches;
+    int count;
+    int result = findTreasuresNearby(&grid, &map, x, y, radius, &matches, &count);
+    if (result == 0) {
+        fprintf(out, "Treasures within %.2f of (%.2f, %.2f) in Hunt %s:\n", radius, x, y, huntID);
+        printMatches(&map, matches, count, 1, out);
+        free(matches);
+        logHuntAccess(huntID, "Searched treasures within %.2f of (%.2f, %.2f).", radius, x, y);
+    } else {
+        fprintf(out, "Error: Out of memory while searching hunt %s.\n", huntID);
+    }
+    closeTreasureGrid(&grid);
+    closeTreasureMap(&map);
+    return result == 0 ? 0 : 1;
+}
+
+int queryWithin(const char *huntID, double x1, double y1, double x2, double y2, FILE *out) {
+    TreasureMap map;
+    TreasureGrid grid;
+    if (openHuntSearch(huntID, &map, &grid, out) != 0) {
+        return 1;
+    }
+    
+    GridMatch *matches;
+    int count;
+    int result = findTreasuresWithin(&grid, &map, x1, y1, x2, y2, &matches, &count);
+    if (result == 0) {
+        fprintf(out, "Treasures between (%.2f, %.2f) and (%.2f, %.2f) in Hunt %s:\n", x1, y1, x2, y2, huntID);
+        printMatches(&map, matches, count, 0, out);
+        free(matches);
+        logHuntAccess(huntID, "Searched treasures between (%.2f, %.2f) and (%.2f, %.2f).", x1, y1, x2, y2);
+    } else {
+        fprintf(out, "Error: Out of memory while searching hunt %s.\n", huntID);
+    }
+    closeTreasureGrid(&grid);
+    closeTreasureMap(&map);
+    return result == 0 ? 0 : 1;
+}
+
+int queryNearest(const char *huntID, double x, double y, int k, FILE *out) {
+    TreasureMap map;
+    TreasureGrid grid;
+    if (openHuntSearch(huntID, &map, &grid, out) != 0) {
+        return 1;
+    }
+    
+    GridMatch *matches;
+    int count;
+    int result = findNearestTreasures(&grid, &map, x, y, k, &matches, &count);
+    if (result == 0) {
+        fprintf(out, "Nearest %d treasure(s) to (%.2f, %.2f) in Hunt %s:\n", k, x, y, huntID);
+        printMatches(&map, matches, count, 1, out);
+        free(matches);
+        logHuntAccess(huntID, "Searched the %d treasures nearest to (%.2f, %.2f).", k, x, y);
+    } else {
+        fprintf(out, "Error: Out of memory while searching hunt %s.\n", huntID);
+    }
+    closeTreasureGrid(&grid);
+    closeTreasureMap(&map);
+    return result == 0 ? 0 : 1;
+}
+
+#define SEARCH_BATCH 256
+
+// Finds the IDs matching terms, from the index if it covers the current
+// header and by scanning the clues otherwise.
+static int findClueMatches(const char *huntPath, char **terms, int termCount, int **ids, int *count) {
+    TreasureCounts counts;
+    if (readCurrentTreasureCounts(huntPath, &counts) == 0 &&
+        searchClueIndex(huntPath, counts.nextId, terms, termCount, ids, count) == 0) {
+        return 0;
+    }
+    
+    char treasuresPath[1100];
+    snprintf(treasuresPath, sizeof(treasuresPath), "%s/treasures.dat", huntPath);
+    TreasureMap map;
+    if (openTreasureMap(treasuresPath, TREASURE_ACCESS_SEQUENTIAL | TREASURE_WITH_CLUES, &map) != 0) {
+        return -1;
+    }
+    int result = scanClues(&map, terms, termCount, ids, count);
+    closeTreasureMap(&map);
+    return result;
+}
+
+int querySearch(const char *huntID, char **terms, int termCount, FILE *out) {
+    if (!isHuntName(huntID)) {
+        fprintf(out, "Invalid hunt ID format. Hunt ID should start with 'Hunt'.\n");
+        return 1;
+    }
+    
+    char huntPath[1024];
+    snprintf(huntPath, sizeof(huntPath), "Hunts/%s", huntID);
+    struct stat huntStat;
+    if (stat(huntPath, &huntStat) != 0 || !S_ISDIR(huntStat.st_mode)) {
+        fprintf(out, "Hunt directory does not exist.\n");
+        return 1;
+    }
+    
+    // The arguments are split into words the same way the clues are.
+    char words[MAX_SEARCH_TERMS][MAX_TERM_LENGTH + 1];
+    char *wordList[MAX_SEARCH_TERMS];
+    char query[256] = "";
+    int wordCount = 0;
+    for (int i = 0; i < termCount; i++) {
+        const char *cursor = terms[i];
+        const char *end = cursor + strlen(cursor);
+        char word[MAX_TERM_LENGTH + 1];
+        while (nextClueTerm(&cursor, end, word) > 0) {
+            if (wordCount == MAX_SEARCH_TERMS) {
+                fprintf(out, "Error: A search can have at most %d words.\n", MAX_SEARCH_TERMS);
+                return 1;
+            }
+            strcpy(words[wordCount], word);
+            wordList[wordCount] = words[wordCount];
+            snprintf(query + strlen(query), sizeof(query) - strlen(query), "%s%s", wordCount > 0 ? " " : "", word);
+            wordCount++;
+        }
+    }
+    if (wordCount == 0) {
+        fprintf(out, "Error: The search terms contain no words.\n");
+        return 1;
+    }
+    
+    int *ids;
+    int count;
+    if (findClueMatches(huntPath, wordList, wordCount, &ids, &count) != 0) {
+        fprintf(out, "Error searching treasure file: %s\n", strerror(errno));
+        return 1;
+    }
+    
+    // Matches from the index may have been removed since; lookupTreasures
+    // skips those.
+    Treasure *treasures = malloc(SEARCH_BATCH * sizeof(Treasure));
+    if (treasures == NULL) {
+        fprintf(out, "Error: Out of memory while searching hunt %s.\n", huntID);
+        free(ids);
+        return 1;
+    }
+    fprintf(out, "Treasures matching \"%s\" in Hunt %s:\n", query, huntID);
+    int shown = 0;
+    for (int start = 0; start < count; start += SEARCH_BATCH) {
+        int batch = count - start < SEARCH_BATCH ? count - start : SEARCH_BATCH;
+        char found[SEARCH_BATCH];
+        if (lookupTreasures(huntPath, ids + start, batch, treasures, found) < 0) {
+            fprintf(out, "Error opening treasure file: %s\n", strerror(errno));
+            free(treasures);
+            free(ids);
+            return 1;
+        }
+        for (int i = 0; i < batch; i++) {
+            if (!found[i])
+                continue;
+            fprintf(out, "ID: %d, User: %s, Coordinate: (%.2f, %.2f), Clue: %s, Value: %d\n",
+                    treasures[i].id, treasures[i].userName, treasures[i].coord.x, treasures[i].coord.y,
+                    treasures[i].clue, treasures[i].value);
+            shown++;
+        }
+    }
+    fprintf(out, "Found %d treasure(s).\n", shown);
+    free(treasures);
+    free(ids);
+    
+    logHuntAccess(huntID, "Searched clues for \"%s\".", query);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef TREASURE_QUERY_H
+#define TREASURE_QUERY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// The read side of the tools: listing, viewing and scoring hunts. Results
+// are written as text to the given stream, so treasure_manager and
+// calculate_score pass stdout and the hub monitor answers requests
+// in-process without spawning either of them. Each query returns 0 on
+// success and 1 if it reported an error.
+
+typedef struct {
+    char userName[20];
+    int totalValue;
+    int treasureCount;
+} UserScore;
+
+typedef struct ScoreBlock ScoreBlock;
+
+// Users are found through an open-addressing table keyed by an FNV-1a hash
+// of the name. The UserScore entries themselves come from an arena of
+// fixed-size blocks, so they never move and are freed all at once.
+typedef struct {
+    UserScore **slots;
+    uint32_t *hashes;
+    size_t capacity;
+    int count;
+    ScoreBlock *blocks;
+} ScoreTable;
+
+void initScoreTable(ScoreTable *table);
+void freeScoreTable(ScoreTable *table);
+UserScore *findOrAddUserScore(ScoreTable *table, const char *userName, int length);
+int addOrUpdateUserScore(ScoreTable *table, const char *userName, int length, int value);
+int mergeScoreTable(ScoreTable *into, const ScoreTable *from);
+int selectTopScores(UserScore **scores, int count, int k);
+
+typedef struct {
+    char **huntIDs;
+    int huntCount;
+    int all;
+    int top;
+    int breakdown;
+} ScoreRequest;
+
+// Parses calculate_score arguments (without the program name). The hunt IDs
+// point into argv. Returns -1 if the arguments are not a valid request.
+int parseScoreRequest(int argc, char **argv, ScoreRequest *request);
+void freeScoreRequest(ScoreRequest *request);
+
+#define LIST_FIELD_ID 1
+#define LIST_FIELD_USER 2
+#define LIST_FIELD_COORD 4
+#define LIST_FIELD_CLUE 8
+#define LIST_FIELD_VALUE 16
+#define LIST_FIELDS_ALL 31
+
+// A page of a hunt's treasures: those by user (if set) worth at least
+// minValue (if hasMinValue), skipping the first offset of them and
+// showing at most limit (-1 for all), with only the given fields.
+typedef struct {
+    const char *huntID;
+    long offset;
+    long limit;
+    const char *user;
+    int minValue;
+    int hasMinValue;
+    int fields;
+} ListRequest;
+
+// Parses list arguments (the hunt ID, then --offset N --limit N --user NAME
+// --min-value V --fields id,user,coord,clue,value in any order). Strings
+// point into argv. Returns -1 if the arguments are not a valid request.
+int parseListRequest(int argc, char **argv, ListRequest *request);
+
+int isHuntName(const char *name);
+
+int queryListHunts(FILE *out);
+int queryListTreasures(const ListRequest *request, FILE *out);
+int queryViewTreasure(const char *huntID, int treasureID, FILE *out);
+int queryScores(const ScoreRequest *request, FILE *out);
+
+// Location searches, answered from the hunt's coordinate grid (see
+// treasure_grid.h). nearby and nearest list the closest treasures first.
+int queryNearby(const char *huntID, double x, double y, double radius, FILE *out);
+int queryWithin(const char *huntID, double x1, double y1, double x2, double y2, FILE *out);
+int queryNearest(const char *huntID, double x, double y, int k, FILE *out);
+
+// Lists the treasures whose clues contain every word of the given terms
+// (see treasure_terms.h), using the hunt's clue index when it is current
+// and a scan of the clues otherwise.
+int querySearch(const char *huntID, char **terms, int termCount, FILE *out);
+
+#endif
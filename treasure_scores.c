@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "treasure_scores.h"
+
+#define MAX_SCORE_NAME_LENGTH ((int)sizeof(((ScoreFileEntry *)0)->userName) - 1)
+
+static void scoresPath(const char *huntPath, char *path)
+{
+    sprintf(path, "%s/scores.dat", huntPath);
+}
+
+int readHuntScores(const char *huntPath, uint32_t generation, ScoreFileEntry **entries, int *count)
+{
+    char path[1100];
+    scoresPath(huntPath, path);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // A writer's rename swaps in a new inode, so the header and entries read
+    // through one descriptor always belong together.
+    struct stat st;
+    ScoreFileHeader header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, SCORES_MAGIC, 4) != 0 || header.generation != generation ||
+        (uint64_t)st.st_size != sizeof(header) + (uint64_t)header.userCount * sizeof(ScoreFileEntry)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t length = header.userCount * sizeof(ScoreFileEntry);
+    *entries = malloc(length > 0 ? length : 1);
+    if (*entries == NULL || (length > 0 && pread(fd, *entries, length, sizeof(header)) != (ssize_t)length)) {
+        free(*entries);
+        *entries = NULL;
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    *count = header.userCount;
+    return 0;
+}
+
+int writeHuntScores(const char *huntPath, uint32_t generation, const ScoreFileEntry *entries, int count)
+{
+    // Readers rebuild without the hunt lock, possibly several at once.
+    static unsigned int sequence = 0;
+    char path[1100], tempPath[1100];
+    scoresPath(huntPath, path);
+    sprintf(tempPath, "%s/scores.%d.%u.tmp", huntPath, (int)getpid(), __sync_fetch_and_add(&sequence, 1));
+
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ScoreFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCORES_MAGIC, 4);
+    header.generation = generation;
+    header.userCount = count;
+
+    size_t length = count * sizeof(ScoreFileEntry);
+    int result = 0;
+    if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+        (length > 0 && write(fd, entries, length) != (ssize_t)length)) {
+        result = -1;
+    }
+    if (close(fd) != 0)
+        result = -1;
+    if (result == 0 && rename(tempPath, path) != 0)
+        result = -1;
+    if (result != 0) {
+        int saved = errno;
+        unlink(tempPath);
+        errno = saved;
+    }
+    return result;
+}
+
+static uint32_t hashName(const char *userName)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < MAX_SCORE_NAME_LENGTH && userName[i] != '\0'; i++) {
+        hash ^= (unsigned char)userName[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Finds the entry for a user through an open-addressing table of indexes
+// into entries, appending a new entry when the user is not there yet.
+static ScoreFileEntry *findEntry(ScoreFileEntry *entries, int *count, int *slots, size_t mask,
+                                 const char *userName)
+{
+    size_t slot = hashName(userName) & mask;
+    while (slots[slot] != -1) {
+        ScoreFileEntry *entry = &entries[slots[slot]];
+        if (strncmp(entry->userName, userName, MAX_SCORE_NAME_LENGTH) == 0)
+            return entry;
+        slot = (slot + 1) & mask;
+    }
+
+    ScoreFileEntry *entry = &entries[*count];
+    memset(entry, 0, sizeof(*entry));
+    memcpy(entry->userName, userName, strnlen(userName, MAX_SCORE_NAME_LENGTH));
+    slots[slot] = (*count)++;
+    return entry;
+}
+
+void dropHuntScores(const char *huntPath)
+{
+    char path[1100];
+    scoresPath(huntPath, path);
+    unlink(path);
+}
+
+void updateHuntScores(const char *huntPath, uint32_t from, uint32_t to, const Treasure *treasures, int count,
+                      int sign)
+{
+    ScoreFileEntry *stored;
+    int storedCount;
+    if (readHuntScores(huntPath, from, &stored, &storedCount) != 0) {
+        dropHuntScores(huntPath);
+        return;
+    }
+
+    int capacity = storedCount + count;
+    size_t slotCount = 16;
+    while (slotCount < 2 * (size_t)capacity)
+        slotCount *= 2;
+    ScoreFileEntry *entries = realloc(stored, (capacity > 0 ? capacity : 1) * sizeof(ScoreFileEntry));
+    int *slots = malloc(slotCount * sizeof(int));
+    if (entries == NULL || slots == NULL) {
+        free(entries != NULL ? entries : stored);
+        free(slots);
+        dropHuntScores(huntPath);
+        return;
+    }
+    memset(slots, -1, slotCount * sizeof(int));
+
+    int entryCount = 0;
+    for (int i = 0; i < storedCount; i++) {
+        ScoreFileEntry entry = entries[i];
+        *findEntry(entries, &entryCount, slots, slotCount - 1, entry.userName) = entry;
+    }
+    for (int i = 0; i < count && sign != 0; i++) {
+        ScoreFileEntry *entry = findEntry(entries, &entryCount, slots, slotCount - 1, treasures[i].userName);
+        entry->totalValue += sign * treasures[i].value;
+        entry->treasureCount += sign;
+    }
+    free(slots);
+
+    // Users whose last treasure went are dropped.
+    int kept = 0;
+    for (int i = 0; i < entryCount; i++) {
+        if (entries[i].treasureCount > 0)
+            entries[kept++] = entries[i];
+    }
+
+    if (writeHuntScores(huntPath, to, entries, kept) != 0)
+        dropHuntScores(huntPath);
+    free(entries);
+}
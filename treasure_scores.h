@@ -0,0 +1,46 @@
+#ifndef TREASURE_SCORES_H
+#define TREASURE_SCORES_H
+
+#include <stdint.h>
+
+#include "treasure_store.h"
+
+// scores.dat sits next to treasures.dat and holds every user's total over
+// the hunt's live treasures, so scoring a hunt reads one entry per user
+// instead of every record. It is tagged with the treasures.dat generation
+// it describes and only trusted while the two match. Writers update it
+// under the hunt lock before they touch treasures.dat, so a crash in
+// between leaves the tags apart and the next reader rebuilds it.
+#define SCORES_MAGIC "TSCR"
+
+typedef struct
+{
+    char magic[4];
+    uint32_t generation;
+    uint32_t userCount;
+    uint32_t reserved;
+} ScoreFileHeader;
+
+typedef struct
+{
+    char userName[20];
+    int32_t totalValue;
+    int32_t treasureCount;
+} ScoreFileEntry;
+
+// Returns 0 with a malloc'd array of entries if scores.dat describes the
+// given generation, -1 if it is missing, stale or unreadable.
+int readHuntScores(const char *huntPath, uint32_t generation, ScoreFileEntry **entries, int *count);
+
+// Replaces scores.dat in one rename, so readers never see half of it.
+int writeHuntScores(const char *huntPath, uint32_t generation, const ScoreFileEntry *entries, int count);
+
+// Moves scores.dat from generation `from` to `to`, adding (sign 1) or
+// taking away (sign -1) the given treasures; sign 0 only retags it. If it
+// was not at `from`, or cannot be rewritten, it is deleted for the next
+// reader to rebuild. The caller must hold the hunt lock.
+void updateHuntScores(const char *huntPath, uint32_t from, uint32_t to, const Treasure *treasures, int count,
+                      int sign);
+void dropHuntScores(const char *huntPath);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "treasure_stats.h"
+
+#define LATENCY_MAX_MICROS ((1ULL << 44) - 1)
+
+static int latencyBucket(uint64_t micros)
+{
+    if (micros > LATENCY_MAX_MICROS)
+        micros = LATENCY_MAX_MICROS;
+    if (micros < LATENCY_SUB_BUCKETS)
+        return micros;
+    int power = 63 - __builtin_clzll(micros); // at least 4
+    int shift = power - 4;
+    return LATENCY_SUB_BUCKETS + shift * LATENCY_SUB_BUCKETS + (int)(micros >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+// The largest value that lands in a bucket.
+static uint64_t bucketLimit(int bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+    int shift = (bucket - LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS;
+    uint64_t sub = (bucket - LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+void recordLatency(LatencyHistogram *histogram, uint64_t micros)
+{
+    histogram->counts[latencyBucket(micros)]++;
+    histogram->count++;
+    histogram->total += micros;
+    if (micros > histogram->max)
+        histogram->max = micros;
+}
+
+uint64_t latencyPercentile(const LatencyHistogram *histogram, double fraction)
+{
+    if (histogram->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(fraction * histogram->count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += histogram->counts[bucket];
+        if (seen >= rank) {
+            uint64_t limit = bucketLimit(bucket);
+            return limit < histogram->max ? limit : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void resetMonitorStats(MonitorStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->since = time(NULL);
+}
+
+CommandStats *findCommandStats(MonitorStats *stats, const char *name)
+{
+    for (int i = 0; i < stats->count; i++) {
+        if (strcmp(stats->commands[i].name, name) == 0)
+            return &stats->commands[i];
+    }
+    if (stats->count == MAX_STATS_COMMANDS - 1 && strcmp(name, "other") != 0)
+        return findCommandStats(stats, "other");
+
+    CommandStats *command = &stats->commands[stats->count++];
+    memset(command, 0, sizeof(*command));
+    snprintf(command->name, sizeof(command->name), "%s", name);
+    return command;
+}
+
+void recordCommand(MonitorStats *stats, const char *name, int failed, uint64_t bytes, uint64_t micros)
+{
+    CommandStats *command = findCommandStats(stats, name);
+    command->calls++;
+    if (failed)
+        command->errors++;
+    command->bytes += bytes;
+    recordLatency(&command->latency, micros);
+}
+
+void printMonitorStats(const MonitorStats *stats, FILE *out)
+{
+    char since[64];
+    struct tm tm_info;
+    localtime_r(&stats->since, &tm_info);
+    strftime(since, sizeof(since), "%Y-%m-%d %H:%M:%S", &tm_info);
+
+    uint64_t total = 0;
+    for (int i = 0; i < stats->count; i++)
+        total += stats->commands[i].calls;
+    fprintf(out, "Monitor statistics since %s (%llu request(s)):\n", since, (unsigned long long)total);
+    fprintf(out, "%-16s %8s %7s %12s %9s %9s %9s %9s\n", "Command", "Calls", "Errors", "Bytes", "p50 us",
+            "p90 us", "p99 us", "max us");
+    for (int i = 0; i < stats->count; i++) {
+        const CommandStats *command = &stats->commands[i];
+        fprintf(out, "%-16s %8llu %7llu %12llu %9llu %9llu %9llu %9llu\n", command->name,
+                (unsigned long long)command->calls, (unsigned long long)command->errors,
+                (unsigned long long)command->bytes,
+                (unsigned long long)latencyPercentile(&command->latency, 0.50),
+                (unsigned long long)latencyPercentile(&command->latency, 0.90),
+                (unsigned long long)latencyPercentile(&command->latency, 0.99),
+                (unsigned long long)command->latency.max);
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef TREASURE_STATS_H
+#define TREASURE_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+// Request statistics kept by the hub monitor: per command, how often it
+// ran, how often it failed, how many reply bytes it sent and how long it
+// took. Latencies go into a log-linear histogram in the style of
+// HdrHistogram: values below LATENCY_SUB_BUCKETS microseconds are exact,
+// and every power of two above that is split into LATENCY_SUB_BUCKETS
+// equal buckets, so any reported percentile is within about 6% of the
+// real one while a histogram stays a fixed few kilobytes.
+#define LATENCY_SUB_BUCKETS 16
+#define LATENCY_BUCKETS (LATENCY_SUB_BUCKETS + 40 * LATENCY_SUB_BUCKETS)
+#define MAX_STATS_COMMANDS 24
+
+typedef struct
+{
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} LatencyHistogram;
+
+void recordLatency(LatencyHistogram *histogram, uint64_t micros);
+// The smallest bucket bound below which the given fraction of samples
+// falls, capped at the largest sample seen.
+uint64_t latencyPercentile(const LatencyHistogram *histogram, double fraction);
+
+typedef struct
+{
+    char name[32];
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes;
+    LatencyHistogram latency;
+} CommandStats;
+
+typedef struct
+{
+    time_t since;
+    int count;
+    CommandStats commands[MAX_STATS_COMMANDS];
+} MonitorStats;
+
+void resetMonitorStats(MonitorStats *stats);
+// Finds or adds the entry for a command. Past MAX_STATS_COMMANDS names
+// everything else is counted under "other".
+CommandStats *findCommandStats(MonitorStats *stats, const char *name);
+void recordCommand(MonitorStats *stats, const char *name, int failed, uint64_t bytes, uint64_t micros);
+void printMonitorStats(const MonitorStats *stats, FILE *out);
+
+#endif
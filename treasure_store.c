@@ -0,0 +1,1686 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_store.h"
+#include "treasure_scores.h"
+#include "treasure_terms.h"
+#include "treasure_catalog.h"
+
+#define MAX_USER_NAME_LENGTH ((int)sizeof(((Treasure *)0)->userName) - 1)
+#define MAX_CLUE_LENGTH ((int)sizeof(((Treasure *)0)->clue) - 1)
+
+// Used when the file cannot be mapped (e.g. some network filesystems):
+// pull the whole file into memory with a few large reads instead.
+static int readWholeFile(int fd, size_t length, void **base, size_t *readLength)
+{
+    char *buffer = malloc(length);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        ssize_t bytes = read(fd, buffer + done, length - done);
+        if (bytes < 0) {
+            if (errno == EINTR)
+                continue;
+            free(buffer);
+            return -1;
+        }
+        if (bytes == 0)
+            break;
+        done += bytes;
+    }
+
+    *base = buffer;
+    *readLength = done;
+    return 0;
+}
+
+static int mapFile(int fd, int flags, void **base, size_t *length, int *mapped)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+
+    *base = NULL;
+    *length = st.st_size;
+    *mapped = 0;
+    if (*length == 0) {
+        return 0;
+    }
+
+    int random = flags & TREASURE_ACCESS_RANDOM;
+    posix_fadvise(fd, 0, 0, random ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+    if (flags & TREASURE_RESIDENT) {
+        return readWholeFile(fd, *length, base, length);
+    }
+
+    void *mapping = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+        madvise(mapping, *length, random ? MADV_RANDOM : MADV_SEQUENTIAL);
+        *base = mapping;
+        *mapped = 1;
+        return 0;
+    }
+    return readWholeFile(fd, *length, base, length);
+}
+
+static void unmapFile(void *base, size_t length, int mapped)
+{
+    if (base == NULL) {
+        return;
+    }
+    if (mapped) {
+        munmap(base, length);
+    } else {
+        free(base);
+    }
+}
+
+int preadFull(int fd, void *buffer, size_t length, off_t offset)
+{
+    size_t done = 0;
+    while (done < length) {
+        ssize_t bytes = pread(fd, (char *)buffer + done, length - done, offset + done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        done += bytes;
+    }
+    return 0;
+}
+
+int pwriteFull(int fd, const void *buffer, size_t length, off_t offset)
+{
+    size_t done = 0;
+    while (done < length) {
+        ssize_t bytes = pwrite(fd, (const char *)buffer + done, length - done, offset + done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        done += bytes;
+    }
+    return 0;
+}
+
+int writeFull(int fd, const void *buffer, size_t length)
+{
+    size_t done = 0;
+    while (done < length) {
+        ssize_t bytes = write(fd, (const char *)buffer + done, length - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        done += bytes;
+    }
+    return 0;
+}
+
+static void clueHeapPath(const char *huntPath, int clueHeap, char *path)
+{
+    sprintf(path, "%s/clues-%d.dat", huntPath, clueHeap);
+}
+
+static void segmentRowsPath(const char *huntPath, uint32_t number, char *path)
+{
+    sprintf(path, "%s/rows-%u.dat", huntPath, number);
+}
+
+static int openClueHeap(const char *huntPath, int clueHeap)
+{
+    char path[1100];
+    clueHeapPath(huntPath, clueHeap, path);
+    return open(path, O_RDONLY);
+}
+
+static void huntPathOf(const char *dataPath, char *huntPath)
+{
+    snprintf(huntPath, 1024, "%s", dataPath);
+    char *slash = strrchr(huntPath, '/');
+    if (slash != NULL)
+        *slash = '\0';
+    else
+        strcpy(huntPath, ".");
+}
+
+// Reads a version 4 manifest. The entries in the file are what counts for
+// finding records; the header's segmentCount only tells whether the last
+// update to them finished.
+static int readManifest(int fd, TreasureFileHeader *header, SegmentEntry **entries, int *count)
+{
+    struct stat st;
+    *entries = NULL;
+    *count = 0;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*header) ||
+        preadFull(fd, header, sizeof(*header), 0) != 0 || memcmp(header->magic, TREASURE_MAGIC, 4) != 0 ||
+        header->version != TREASURE_FORMAT_V4 || header->headerSize < sizeof(*header) ||
+        header->headerSize > st.st_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    *count = (st.st_size - header->headerSize) / sizeof(SegmentEntry);
+    *entries = malloc((*count > 0 ? *count : 1) * sizeof(SegmentEntry));
+    if (*entries == NULL || preadFull(fd, *entries, *count * sizeof(SegmentEntry), header->headerSize) != 0) {
+        free(*entries);
+        *entries = NULL;
+        *count = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static int manifestCountsValid(const TreasureFileHeader *header, const SegmentEntry *entries, int count)
+{
+    uint32_t rows = 0, live = 0;
+    for (int i = 0; i < count; i++) {
+        if (entries[i].liveCount > entries[i].rowCount || entries[i].rowCount > TREASURE_SEGMENT_ROWS)
+            return 0;
+        rows += entries[i].rowCount;
+        live += entries[i].liveCount;
+    }
+    return header->nextId != 0 && header->segmentCount == (uint32_t)count && header->rowCount == rows &&
+           header->liveCount == live;
+}
+
+// Entries go first: a reader that catches the manifest half written sees
+// rows that are already on disk, and counters that do not add up.
+static int writeManifest(int fd, const TreasureFileHeader *header, const SegmentEntry *entries, int count)
+{
+    if (pwriteFull(fd, entries, count * sizeof(SegmentEntry), header->headerSize) != 0 ||
+        pwriteFull(fd, header, sizeof(*header), 0) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static int addSegment(TreasureMap *map)
+{
+    TreasureSegment *grown = realloc(map->segments, (map->segmentCount + 1) * sizeof(TreasureSegment));
+    if (grown == NULL) {
+        return -1;
+    }
+    map->segments = grown;
+    memset(&map->segments[map->segmentCount], 0, sizeof(TreasureSegment));
+    map->segmentCount++;
+    return 0;
+}
+
+// Maps the clue heap of segment into it. A heap that is gone usually means
+// a compaction replaced it after treasures.dat was read: returns 1 to try
+// again, unless this is the last try, which goes on without clues.
+static int mapClues(const char *huntPath, int clueHeap, int flags, int lastTry, TreasureSegment *segment)
+{
+    int clueFile = openClueHeap(huntPath, clueHeap);
+    if (clueFile == -1) {
+        return errno == ENOENT && !lastTry ? 1 : 0;
+    }
+    if (mapFile(clueFile, flags, &segment->clueBase, &segment->clueLength, &segment->cluesMapped) != 0) {
+        segment->clueBase = NULL;
+        segment->clueLength = 0;
+    }
+    close(clueFile);
+    return 0;
+}
+
+// Maps every segment a manifest lists, laid out one after another from
+// the end of the header. Returns 1 if a segment's files are gone.
+static int mapSegments(int fd, const char *huntPath, int flags, int lastTry, TreasureMap *map)
+{
+    TreasureFileHeader header;
+    SegmentEntry *entries;
+    int count;
+    if (readManifest(fd, &header, &entries, &count) != 0) {
+        return -1;
+    }
+    map->version = TREASURE_FORMAT_V4;
+    map->dataStart = header.headerSize;
+    map->clueHeap = header.clueHeap;
+    map->length = header.headerSize;
+    int countsValid = manifestCountsValid(&header, entries, count);
+
+    for (int i = 0; i < count; i++) {
+        if (addSegment(map) != 0) {
+            free(entries);
+            return -1;
+        }
+        TreasureSegment *segment = &map->segments[i];
+        size_t rowBytes = (size_t)entries[i].rowCount * sizeof(HotRow);
+        segment->start = map->length;
+        segment->liveCount = countsValid ? (int)entries[i].liveCount : -1;
+        map->length += rowBytes;
+
+        char rowsPath[1100];
+        segmentRowsPath(huntPath, entries[i].number, rowsPath);
+        int rowsFile = open(rowsPath, O_RDONLY);
+        if (rowsFile == -1) {
+            free(entries);
+            return errno == ENOENT ? 1 : -1;
+        }
+        int result = mapFile(rowsFile, flags, &segment->base, &segment->length, &segment->mapped);
+        close(rowsFile);
+        if (result != 0) {
+            free(entries);
+            return -1;
+        }
+        // Rows past the manifest's count are from an append that never
+        // finished, and a file cut short only ends its segment early.
+        size_t visible = segment->length < rowBytes ? segment->length - segment->length % sizeof(HotRow) : rowBytes;
+        segment->end = segment->start + visible;
+
+        if ((flags & TREASURE_WITH_CLUES) && mapClues(huntPath, entries[i].number, flags, lastTry, segment) != 0) {
+            free(entries);
+            return 1;
+        }
+        map->clueLength += segment->clueLength;
+    }
+    free(entries);
+    return 0;
+}
+
+// Opens treasures.dat and whatever it points to. Returns 1 if a file it
+// names has gone, so the caller can try again.
+static int openDataFile(const char *path, int flags, int lastTry, TreasureMap *map)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    TreasureFileHeader header;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    map->inode = st.st_ino;
+    char huntPath[1024];
+    huntPathOf(path, huntPath);
+
+    if ((size_t)st.st_size >= sizeof(header) && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, TREASURE_MAGIC, 4) == 0 && header.version == TREASURE_FORMAT_V4) {
+        int result = mapSegments(fd, huntPath, flags, lastTry, map);
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return result;
+    }
+
+    if (addSegment(map) != 0) {
+        close(fd);
+        return -1;
+    }
+    TreasureSegment *segment = &map->segments[0];
+    segment->liveCount = -1;
+    if (mapFile(fd, flags, &segment->base, &segment->length, &segment->mapped) != 0) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    close(fd);
+    segment->end = segment->length;
+    map->length = segment->length;
+
+    if (segment->length >= sizeof(header) && memcmp(segment->base, TREASURE_MAGIC, 4) == 0) {
+        memcpy(&header, segment->base, sizeof(header));
+        if (header.version < TREASURE_FORMAT_V2 || header.version > TREASURE_FORMAT_V3 ||
+            header.headerSize < sizeof(header) || header.headerSize > segment->length) {
+            errno = EINVAL;
+            return -1;
+        }
+        map->version = header.version;
+        map->dataStart = header.headerSize;
+        map->clueHeap = header.clueHeap;
+    } else if (segment->length > 0) {
+        map->version = TREASURE_FORMAT_V1;
+    }
+
+    if (map->version == TREASURE_FORMAT_V3 && (flags & TREASURE_WITH_CLUES)) {
+        if (mapClues(huntPath, map->clueHeap, flags, lastTry, segment) != 0) {
+            return 1;
+        }
+        map->clueLength = segment->clueLength;
+    }
+    return 0;
+}
+
+int openTreasureMap(const char *path, int flags, TreasureMap *map)
+{
+    // A compaction may swap in new segments or a new clue heap and delete
+    // the old ones between opening treasures.dat and them; just try again.
+    for (int attempt = 0; attempt < 3; attempt++) {
+        memset(map, 0, sizeof(*map));
+        map->version = TREASURE_FORMAT_CURRENT;
+
+        int result = openDataFile(path, flags, attempt == 2, map);
+        if (result == 0) {
+            return 0;
+        }
+        int saved = errno;
+        closeTreasureMap(map);
+        if (result < 0) {
+            errno = saved;
+            return -1;
+        }
+    }
+    errno = ENOENT;
+    return -1;
+}
+
+void closeTreasureMap(TreasureMap *map)
+{
+    for (int i = 0; i < map->segmentCount; i++) {
+        TreasureSegment *segment = &map->segments[i];
+        unmapFile(segment->base, segment->length, segment->mapped);
+        unmapFile(segment->clueBase, segment->clueLength, segment->cluesMapped);
+    }
+    free(map->segments);
+    memset(map, 0, sizeof(*map));
+}
+
+void startSegmentCursor(const TreasureMap *map, int segment, TreasureCursor *cursor)
+{
+    cursor->map = map;
+    cursor->segment = segment;
+    cursor->lastSegment = segment;
+    cursor->position = map->dataStart;
+    if (segment < map->segmentCount && map->segments[segment].start > map->dataStart)
+        cursor->position = map->segments[segment].start;
+}
+
+void startTreasureCursor(const TreasureMap *map, TreasureCursor *cursor)
+{
+    startSegmentCursor(map, 0, cursor);
+    cursor->lastSegment = map->segmentCount - 1;
+}
+
+static int findSegment(const TreasureMap *map, off_t offset)
+{
+    int low = 0, high = map->segmentCount - 1;
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        const TreasureSegment *segment = &map->segments[middle];
+        if ((size_t)offset < segment->start)
+            high = middle - 1;
+        else if ((size_t)offset >= segment->end)
+            low = middle + 1;
+        else
+            return middle;
+    }
+    return -1;
+}
+
+void seekTreasureCursor(const TreasureMap *map, off_t offset, TreasureCursor *cursor)
+{
+    int segment = offset >= 0 ? findSegment(map, offset) : -1;
+    cursor->map = map;
+    cursor->segment = segment >= 0 ? segment : map->segmentCount;
+    cursor->lastSegment = map->segmentCount - 1;
+    cursor->position = offset;
+}
+
+const void *treasureRecordAt(const TreasureMap *map, off_t offset)
+{
+    int index = offset >= 0 ? findSegment(map, offset) : -1;
+    if (index < 0) {
+        return NULL;
+    }
+    const TreasureSegment *segment = &map->segments[index];
+    if ((size_t)offset + sizeof(int32_t) > segment->end) {
+        return NULL;
+    }
+    return (const char *)segment->base + (offset - segment->start);
+}
+
+static void decodeClue(const TreasureSegment *segment, uint32_t clueOffset, TreasureRecord *record)
+{
+    uint16_t length;
+    record->clue = "";
+    record->clueLength = 0;
+    if (segment->clueBase == NULL || (size_t)clueOffset + sizeof(length) > segment->clueLength) {
+        return;
+    }
+    memcpy(&length, (const char *)segment->clueBase + clueOffset, sizeof(length));
+    if ((size_t)clueOffset + sizeof(length) + length > segment->clueLength) {
+        return;
+    }
+    record->clue = (const char *)segment->clueBase + clueOffset + sizeof(length);
+    record->clueLength = length;
+}
+
+// Decodes the record at position in segment; 0 if none fits before its end.
+static int decodeRecord(const TreasureMap *map, const TreasureSegment *segment, size_t position,
+                        TreasureRecord *record)
+{
+    const char *at = (const char *)segment->base + (position - segment->start);
+    size_t remaining = segment->end - position;
+
+    if (map->version >= TREASURE_FORMAT_V3) {
+        if (remaining < sizeof(HotRow))
+            return 0;
+        const HotRow *row = (const HotRow *)at;
+        record->id = row->id;
+        record->coord.x = row->x;
+        record->coord.y = row->y;
+        record->value = row->value;
+        record->userName = row->userName;
+        record->userNameLength = strnlen(row->userName, sizeof(row->userName));
+        decodeClue(segment, row->clueOffset, record);
+        record->size = sizeof(HotRow);
+    } else if (map->version == TREASURE_FORMAT_V1) {
+        if (remaining < sizeof(Treasure))
+            return 0;
+        const Treasure *treasure = (const Treasure *)at;
+        record->id = treasure->id;
+        record->coord = treasure->coord;
+        record->value = treasure->value;
+        record->userName = treasure->userName;
+        record->userNameLength = strnlen(treasure->userName, sizeof(treasure->userName));
+        record->clue = treasure->clue;
+        record->clueLength = strnlen(treasure->clue, sizeof(treasure->clue));
+        record->size = sizeof(Treasure);
+    } else {
+        RecordHeader header;
+        if (remaining < sizeof(header))
+            return 0;
+        memcpy(&header, at, sizeof(header));
+        size_t size = sizeof(header) + header.userNameLength + header.clueLength;
+        if (remaining < size)
+            return 0;
+        record->id = header.id;
+        record->coord.x = header.x;
+        record->coord.y = header.y;
+        record->value = header.value;
+        record->userName = at + sizeof(header);
+        record->userNameLength = header.userNameLength;
+        record->clue = record->userName + header.userNameLength;
+        record->clueLength = header.clueLength;
+        record->size = size;
+    }
+    return 1;
+}
+
+int nextTreasure(TreasureCursor *cursor, TreasureRecord *record)
+{
+    const TreasureMap *map = cursor->map;
+    while (cursor->segment <= cursor->lastSegment) {
+        const TreasureSegment *segment = &map->segments[cursor->segment];
+        if (cursor->position >= segment->start && cursor->position < segment->end &&
+            decodeRecord(map, segment, cursor->position, record)) {
+            record->offset = cursor->position;
+            cursor->position += record->size;
+            return 1;
+        }
+        // This segment is done; a trailing partial record is ignored.
+        if (++cursor->segment <= cursor->lastSegment)
+            cursor->position = map->segments[cursor->segment].start;
+    }
+    return 0;
+}
+
+typedef struct
+{
+    const TreasureMap *map;
+    TreasureSegmentScan scan;
+    char *contexts;
+    size_t contextSize;
+    int next;
+    pthread_mutex_t lock;
+} SegmentScan;
+
+static void *segmentScanWorker(void *arg)
+{
+    SegmentScan *work = arg;
+    while (1) {
+        pthread_mutex_lock(&work->lock);
+        int segment = work->next++;
+        pthread_mutex_unlock(&work->lock);
+
+        if (segment >= work->map->segmentCount)
+            return NULL;
+        work->scan(work->map, segment, work->contexts + segment * work->contextSize);
+    }
+}
+
+// Workers pull the next segment off a shared counter, as the score workers
+// do with hunts, so a slow segment never holds up the others.
+void scanTreasureSegments(const TreasureMap *map, TreasureSegmentScan scan, void *contexts, size_t contextSize)
+{
+    SegmentScan work;
+    work.map = map;
+    work.scan = scan;
+    work.contexts = contexts;
+    work.contextSize = contextSize;
+    work.next = 0;
+    pthread_mutex_init(&work.lock, NULL);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workerCount = cores > 0 ? (int)cores : 1;
+    if (workerCount > map->segmentCount)
+        workerCount = map->segmentCount;
+
+    pthread_t workers[64];
+    if (workerCount > 64)
+        workerCount = 64;
+    int started = 0;
+    for (; workerCount > 1 && started < workerCount; started++) {
+        if (pthread_create(&workers[started], NULL, segmentScanWorker, &work) != 0)
+            break;
+    }
+    if (started == 0) {
+        // One segment, one core or no threads to be had: scan them here.
+        segmentScanWorker(&work);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&work.lock);
+}
+
+void recordToTreasure(const TreasureRecord *record, Treasure *treasure)
+{
+    int userNameLength = record->userNameLength < MAX_USER_NAME_LENGTH ? record->userNameLength : MAX_USER_NAME_LENGTH;
+    int clueLength = record->clueLength < MAX_CLUE_LENGTH ? record->clueLength : MAX_CLUE_LENGTH;
+
+    treasure->id = record->id;
+    treasure->coord = record->coord;
+    treasure->value = record->value;
+    memcpy(treasure->userName, record->userName, userNameLength);
+    treasure->userName[userNameLength] = '\0';
+    memcpy(treasure->clue, record->clue, clueLength);
+    treasure->clue[clueLength] = '\0';
+}
+
+static ssize_t preadRetry(int fd, void *buffer, size_t length, off_t offset)
+{
+    ssize_t bytes;
+    do {
+        bytes = pread(fd, buffer, length, offset);
+    } while (bytes < 0 && errno == EINTR);
+    return bytes;
+}
+
+static int readHotRowAt(int dataFile, int clueFile, off_t offset, Treasure *treasure)
+{
+    HotRow row;
+    if (preadRetry(dataFile, &row, sizeof(row), offset) != sizeof(row)) {
+        return -1;
+    }
+
+    char clue[sizeof(uint16_t) + sizeof(treasure->clue)];
+    uint16_t clueLength = 0;
+    ssize_t bytes = clueFile == -1 ? -1 : preadRetry(clueFile, clue, sizeof(clue), row.clueOffset);
+    if (bytes >= (ssize_t)sizeof(clueLength)) {
+        memcpy(&clueLength, clue, sizeof(clueLength));
+        if (clueLength > MAX_CLUE_LENGTH || (size_t)bytes < sizeof(clueLength) + clueLength)
+            clueLength = 0;
+    }
+
+    treasure->id = row.id;
+    memcpy(treasure->userName, row.userName, sizeof(row.userName));
+    treasure->userName[MAX_USER_NAME_LENGTH] = '\0';
+    treasure->coord.x = row.x;
+    treasure->coord.y = row.y;
+    treasure->value = row.value;
+    memcpy(treasure->clue, clue + sizeof(clueLength), clueLength);
+    treasure->clue[clueLength] = '\0';
+    return 0;
+}
+
+// Reads one record in the old row formats with a single pread.
+static int readOldRecordAt(int dataFile, int version, off_t offset, Treasure *treasure)
+{
+    char buffer[MAX_RECORD_SIZE];
+    ssize_t bytes = preadRetry(dataFile, buffer, sizeof(buffer), offset);
+    if (bytes < 0) {
+        return -1;
+    }
+
+    if (version == TREASURE_FORMAT_V1) {
+        if ((size_t)bytes < sizeof(Treasure))
+            return -1;
+        memcpy(treasure, buffer, sizeof(Treasure));
+        treasure->userName[MAX_USER_NAME_LENGTH] = '\0';
+        treasure->clue[MAX_CLUE_LENGTH] = '\0';
+        return 0;
+    }
+
+    RecordHeader header;
+    if ((size_t)bytes < sizeof(header))
+        return -1;
+    memcpy(&header, buffer, sizeof(header));
+    if ((size_t)bytes < sizeof(header) + header.userNameLength + header.clueLength ||
+        header.userNameLength > MAX_USER_NAME_LENGTH || header.clueLength > MAX_CLUE_LENGTH)
+        return -1;
+
+    treasure->id = header.id;
+    treasure->coord.x = header.x;
+    treasure->coord.y = header.y;
+    treasure->value = header.value;
+    memcpy(treasure->userName, buffer + sizeof(header), header.userNameLength);
+    treasure->userName[header.userNameLength] = '\0';
+    memcpy(treasure->clue, buffer + sizeof(header) + header.userNameLength, header.clueLength);
+    treasure->clue[header.clueLength] = '\0';
+    return 0;
+}
+
+// Up to version 3 the reader has a single segment, treasures.dat itself,
+// starting at offset 0.
+int openTreasureReader(const char *huntPath, int writable, TreasureReader *reader)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->dataFile = -1;
+    snprintf(reader->huntPath, sizeof(reader->huntPath), "%s", huntPath);
+    reader->writable = writable;
+    char dataPath[1100];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+    reader->dataFile = open(dataPath, writable ? O_RDWR : O_RDONLY);
+    if (reader->dataFile == -1) {
+        return -1;
+    }
+
+    struct stat st;
+    TreasureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    if (fstat(reader->dataFile, &st) != 0) {
+        closeTreasureReader(reader);
+        return -1;
+    }
+    reader->inode = st.st_ino;
+    reader->length = st.st_size;
+    reader->version = TREASURE_FORMAT_V1;
+    if (pread(reader->dataFile, &header, sizeof(header), 0) == sizeof(header) &&
+        memcmp(header.magic, TREASURE_MAGIC, 4) == 0) {
+        reader->version = header.version;
+        reader->dataStart = header.headerSize;
+        reader->clueHeap = header.clueHeap;
+    }
+
+    if (reader->version == TREASURE_FORMAT_V4) {
+        if (readManifest(reader->dataFile, &header, &reader->segments, &reader->segmentCount) != 0) {
+            int saved = errno;
+            closeTreasureReader(reader);
+            errno = saved;
+            return -1;
+        }
+        reader->length = header.headerSize;
+        for (int i = 0; i < reader->segmentCount; i++)
+            reader->length += (int64_t)reader->segments[i].rowCount * sizeof(HotRow);
+    } else {
+        reader->segments = calloc(1, sizeof(SegmentEntry));
+        reader->segmentCount = 1;
+    }
+    reader->rowFiles = malloc(reader->segmentCount * sizeof(int));
+    reader->clueFiles = malloc(reader->segmentCount * sizeof(int));
+    if (reader->segments == NULL || reader->rowFiles == NULL || reader->clueFiles == NULL) {
+        closeTreasureReader(reader);
+        return -1;
+    }
+    for (int i = 0; i < reader->segmentCount; i++) {
+        reader->rowFiles[i] = -1;
+        reader->clueFiles[i] = -1;
+    }
+    if (reader->version != TREASURE_FORMAT_V4) {
+        reader->rowFiles[0] = reader->dataFile;
+        if (reader->version == TREASURE_FORMAT_V3)
+            reader->clueFiles[0] = openClueHeap(huntPath, reader->clueHeap);
+    }
+    return 0;
+}
+
+void closeTreasureReader(TreasureReader *reader)
+{
+    for (int i = 0; i < reader->segmentCount && reader->rowFiles != NULL; i++) {
+        if (reader->rowFiles[i] != -1 && reader->rowFiles[i] != reader->dataFile)
+            close(reader->rowFiles[i]);
+        if (reader->clueFiles[i] != -1)
+            close(reader->clueFiles[i]);
+    }
+    if (reader->dataFile != -1)
+        close(reader->dataFile);
+    free(reader->segments);
+    free(reader->rowFiles);
+    free(reader->clueFiles);
+    memset(reader, 0, sizeof(*reader));
+    reader->dataFile = -1;
+}
+
+// Finds the segment holding offset and opens its files if this is the
+// first record read from it. *local is the offset within its rows file.
+static int readerSegment(TreasureReader *reader, off_t offset, off_t *local)
+{
+    if (reader->version != TREASURE_FORMAT_V4) {
+        *local = offset;
+        return offset >= 0 ? 0 : -1;
+    }
+
+    off_t start = reader->dataStart;
+    for (int i = 0; i < reader->segmentCount; i++) {
+        off_t end = start + (off_t)reader->segments[i].rowCount * sizeof(HotRow);
+        if (offset >= start && offset < end) {
+            *local = offset - start;
+            if (reader->rowFiles[i] == -1) {
+                char path[1100];
+                segmentRowsPath(reader->huntPath, reader->segments[i].number, path);
+                reader->rowFiles[i] = open(path, reader->writable ? O_RDWR : O_RDONLY);
+                if (reader->rowFiles[i] == -1)
+                    return -1;
+                reader->clueFiles[i] = openClueHeap(reader->huntPath, reader->segments[i].number);
+            }
+            return i;
+        }
+        start = end;
+    }
+    return -1;
+}
+
+int readTreasureAt(TreasureReader *reader, off_t offset, Treasure *treasure)
+{
+    off_t local;
+    int segment = readerSegment(reader, offset, &local);
+    if (segment < 0) {
+        return -1;
+    }
+    if (reader->version >= TREASURE_FORMAT_V3) {
+        return readHotRowAt(reader->rowFiles[segment], reader->clueFiles[segment], local, treasure);
+    }
+    return readOldRecordAt(reader->dataFile, reader->version, local, treasure);
+}
+
+int readTreasureIdAt(TreasureReader *reader, off_t offset, int *id)
+{
+    off_t local;
+    int segment = readerSegment(reader, offset, &local);
+    if (segment < 0 || preadFull(reader->rowFiles[segment], id, sizeof(*id), local) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static void initFileHeader(TreasureFileHeader *header, int clueHeap)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, TREASURE_MAGIC, 4);
+    header->version = TREASURE_FORMAT_CURRENT;
+    header->headerSize = sizeof(*header);
+    header->clueHeap = clueHeap;
+    header->nextId = 1;
+}
+
+// The version 3 counters are rewritten as one block, nextId through
+// generation.
+#define COUNTERS_OFFSET offsetof(TreasureFileHeader, nextId)
+#define COUNTERS_SIZE (offsetof(TreasureFileHeader, segmentCount) - COUNTERS_OFFSET)
+
+static int headerCountsValid(const TreasureFileHeader *header, off_t fileSize)
+{
+    return memcmp(header->magic, TREASURE_MAGIC, 4) == 0 && header->version == TREASURE_FORMAT_V3 &&
+           header->nextId != 0 && fileSize >= header->headerSize &&
+           (uint64_t)(fileSize - header->headerSize) / sizeof(HotRow) == header->rowCount;
+}
+
+// Reads the header of treasures.dat, returning whether its counters are
+// current.
+static int readHeaderCounts(int dataFile, TreasureFileHeader *header)
+{
+    struct stat st;
+    memset(header, 0, sizeof(*header));
+    if (fstat(dataFile, &st) != 0 || pread(dataFile, header, sizeof(*header), 0) != sizeof(*header)) {
+        return 0;
+    }
+    if (memcmp(header->magic, TREASURE_MAGIC, 4) == 0 && header->version == TREASURE_FORMAT_V4) {
+        SegmentEntry *entries;
+        int count;
+        if (readManifest(dataFile, header, &entries, &count) != 0) {
+            return 0;
+        }
+        int valid = manifestCountsValid(header, entries, count);
+        free(entries);
+        return valid;
+    }
+    return headerCountsValid(header, st.st_size);
+}
+
+static void headerToCounts(const TreasureFileHeader *header, TreasureCounts *counts)
+{
+    counts->nextId = header->nextId;
+    counts->liveCount = header->liveCount;
+    counts->deadCount = header->rowCount - header->liveCount;
+    counts->generation = header->generation;
+}
+
+// The slow path for old or stale headers: walk every record once.
+static int scanTreasureCounts(const char *dataPath, TreasureCounts *counts)
+{
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL, &map) != 0) {
+        return -1;
+    }
+
+    int maxId = 0;
+    TreasureCursor cursor;
+    TreasureRecord record;
+    counts->liveCount = 0;
+    counts->deadCount = 0;
+    startTreasureCursor(&map, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (abs(record.id) > maxId)
+            maxId = abs(record.id);
+        if (TREASURE_IS_LIVE(&record))
+            counts->liveCount++;
+        else
+            counts->deadCount++;
+    }
+    counts->nextId = maxId + 1;
+    closeTreasureMap(&map);
+    return 0;
+}
+
+static int writeHeaderCounts(int dataFile, const TreasureCounts *counts)
+{
+    TreasureFileHeader header;
+    header.nextId = counts->nextId;
+    header.liveCount = counts->liveCount;
+    header.rowCount = counts->liveCount + counts->deadCount;
+    header.generation = counts->generation;
+    if (pwrite(dataFile, (char *)&header + COUNTERS_OFFSET, COUNTERS_SIZE, COUNTERS_OFFSET) != COUNTERS_SIZE) {
+        return -1;
+    }
+    return 0;
+}
+
+int readTreasureCounts(const char *huntPath, TreasureCounts *counts)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+
+    memset(counts, 0, sizeof(*counts));
+    counts->nextId = 1;
+    int dataFile = open(dataPath, O_RDONLY);
+    if (dataFile == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    TreasureFileHeader header;
+    int valid = readHeaderCounts(dataFile, &header);
+    close(dataFile);
+    if (valid) {
+        headerToCounts(&header, counts);
+        return 0;
+    }
+
+    if (scanTreasureCounts(dataPath, counts) != 0) {
+        return -1;
+    }
+    if (memcmp(header.magic, TREASURE_MAGIC, 4) == 0 && header.version >= TREASURE_FORMAT_V3) {
+        counts->generation = header.generation;
+        if ((int)header.nextId > counts->nextId)
+            counts->nextId = header.nextId;
+    }
+    return 0;
+}
+
+int readCurrentTreasureCounts(const char *huntPath, TreasureCounts *counts)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+    int dataFile = open(dataPath, O_RDONLY);
+    if (dataFile == -1) {
+        return -1;
+    }
+
+    TreasureFileHeader header;
+    int valid = readHeaderCounts(dataFile, &header);
+    close(dataFile);
+    if (!valid) {
+        return -1;
+    }
+    headerToCounts(&header, counts);
+    return 0;
+}
+
+// Removes the record at offset by negating its ID, with the hunt lock
+// held. scores.dat moves first and the header counters last, so a crash
+// part way leaves them disagreeing and they are rebuilt. Headers that are
+// already stale are left for the next writer to recount.
+int tombstoneTreasure(TreasureReader *reader, off_t offset, int id)
+{
+    off_t local;
+    int segment = readerSegment(reader, offset, &local);
+    if (segment < 0) {
+        return -1;
+    }
+    int rowFile = reader->rowFiles[segment];
+    TreasureFileHeader header;
+    int valid = readHeaderCounts(reader->dataFile, &header);
+
+    HotRow row;
+    if (valid && preadRetry(rowFile, &row, sizeof(row), local) == sizeof(row)) {
+        Treasure treasure;
+        memset(&treasure, 0, sizeof(treasure));
+        memcpy(treasure.userName, row.userName, MAX_USER_NAME_LENGTH);
+        treasure.value = row.value;
+        updateHuntScores(reader->huntPath, header.generation, header.generation + 1, &treasure, 1, -1);
+    } else {
+        dropHuntScores(reader->huntPath);
+    }
+
+    int tombstone = -id;
+    if (pwrite(rowFile, &tombstone, sizeof(tombstone), local) != sizeof(tombstone)) {
+        dropHuntScores(reader->huntPath);
+        return -1;
+    }
+    int result = 0;
+    if (valid && reader->version == TREASURE_FORMAT_V4) {
+        // Only the segment's entry and the header change.
+        SegmentEntry entry;
+        off_t entryOffset = header.headerSize + segment * sizeof(SegmentEntry);
+        result = preadFull(reader->dataFile, &entry, sizeof(entry), entryOffset);
+        if (result == 0 && entry.number == reader->segments[segment].number && entry.liveCount > 0) {
+            entry.liveCount--;
+            header.liveCount--;
+            header.generation++;
+            result = pwriteFull(reader->dataFile, &entry, sizeof(entry), entryOffset);
+            if (result == 0)
+                result = pwriteFull(reader->dataFile, &header, sizeof(header), 0);
+        }
+    } else if (valid) {
+        TreasureCounts counts;
+        headerToCounts(&header, &counts);
+        counts.liveCount--;
+        counts.deadCount++;
+        counts.generation++;
+        result = writeHeaderCounts(reader->dataFile, &counts);
+    }
+    updateHuntCatalog(reader->huntPath);
+    return result;
+}
+
+// Writes through a large buffer so rewrites cost a handful of syscalls.
+typedef struct
+{
+    int fd;
+    size_t used;
+    int failed;
+    char data[1 << 16];
+} OutputBuffer;
+
+static OutputBuffer *openOutput(const char *path)
+{
+    OutputBuffer *out = malloc(sizeof(OutputBuffer));
+    if (out == NULL) {
+        return NULL;
+    }
+    out->used = 0;
+    out->failed = 0;
+    out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out->fd == -1) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static void bufferWrite(OutputBuffer *out, const void *bytes, size_t length)
+{
+    if (out->used + length > sizeof(out->data)) {
+        if (writeFull(out->fd, out->data, out->used) != 0)
+            out->failed = 1;
+        out->used = 0;
+    }
+    if (length > sizeof(out->data)) {
+        if (writeFull(out->fd, bytes, length) != 0)
+            out->failed = 1;
+        return;
+    }
+    memcpy(out->data + out->used, bytes, length);
+    out->used += length;
+}
+
+// Flushes, syncs and closes; returns -1 if any write along the way failed.
+static int closeOutput(OutputBuffer *out)
+{
+    if (out == NULL) {
+        return -1;
+    }
+    if (out->used > 0 && writeFull(out->fd, out->data, out->used) != 0)
+        out->failed = 1;
+    if (fdatasync(out->fd) != 0)
+        out->failed = 1;
+    close(out->fd);
+
+    int result = out->failed ? -1 : 0;
+    free(out);
+    return result;
+}
+
+// Recounts one mapped segment into entry, raising *nextId past its IDs.
+static void countSegment(const TreasureMap *map, int segment, SegmentEntry *entry, uint32_t *nextId)
+{
+    TreasureCursor cursor;
+    TreasureRecord record;
+    entry->rowCount = 0;
+    entry->liveCount = 0;
+    startSegmentCursor(map, segment, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if ((uint32_t)abs(record.id) >= *nextId)
+            *nextId = abs(record.id) + 1;
+        if (TREASURE_IS_LIVE(&record))
+            entry->liveCount++;
+        entry->rowCount++;
+    }
+}
+
+static int addEntry(SegmentEntry **entries, int *count, const SegmentEntry *entry)
+{
+    SegmentEntry *grown = realloc(*entries, (*count + 1) * sizeof(SegmentEntry));
+    if (grown == NULL) {
+        return -1;
+    }
+    *entries = grown;
+    (*entries)[(*count)++] = *entry;
+    return 0;
+}
+
+// A segment being written by rewriteHunt. Its files are created with the
+// first row, under the next free segment number.
+typedef struct
+{
+    OutputBuffer *rows;
+    OutputBuffer *clues;
+    SegmentEntry entry;
+    uint32_t clueOffset;
+} SegmentWriter;
+
+static int finishSegment(SegmentWriter *writer, SegmentEntry **entries, int *count)
+{
+    if (writer->rows == NULL) {
+        return 0;
+    }
+    // The heap must be complete before the rows that point into it appear.
+    int result = closeOutput(writer->clues);
+    if (closeOutput(writer->rows) != 0)
+        result = -1;
+    writer->rows = NULL;
+    writer->clues = NULL;
+    if (result == 0)
+        result = addEntry(entries, count, &writer->entry);
+    return result;
+}
+
+static int writeSegmentRow(const char *huntPath, SegmentWriter *writer, TreasureFileHeader *header,
+                           const TreasureRecord *record)
+{
+    if (writer->rows == NULL) {
+        char rowsPath[1100], cluesPath[1100];
+        memset(&writer->entry, 0, sizeof(writer->entry));
+        writer->entry.number = ++header->clueHeap;
+        writer->clueOffset = 0;
+        segmentRowsPath(huntPath, writer->entry.number, rowsPath);
+        clueHeapPath(huntPath, writer->entry.number, cluesPath);
+        writer->rows = openOutput(rowsPath);
+        writer->clues = openOutput(cluesPath);
+        if (writer->rows == NULL || writer->clues == NULL) {
+            int saved = errno;
+            closeOutput(writer->rows);
+            closeOutput(writer->clues);
+            writer->rows = NULL;
+            writer->clues = NULL;
+            errno = saved;
+            return -1;
+        }
+    }
+
+    HotRow row;
+    memset(&row, 0, sizeof(row));
+    row.id = record->id;
+    memcpy(row.userName, record->userName,
+           record->userNameLength < MAX_USER_NAME_LENGTH ? record->userNameLength : MAX_USER_NAME_LENGTH);
+    row.x = record->coord.x;
+    row.y = record->coord.y;
+    row.value = record->value;
+    row.clueOffset = writer->clueOffset;
+    bufferWrite(writer->rows, &row, sizeof(row));
+
+    uint16_t clueLength = record->clueLength < MAX_CLUE_LENGTH ? record->clueLength : MAX_CLUE_LENGTH;
+    bufferWrite(writer->clues, &clueLength, sizeof(clueLength));
+    bufferWrite(writer->clues, record->clue, clueLength);
+    writer->clueOffset += sizeof(clueLength) + clueLength;
+    writer->entry.rowCount++;
+    writer->entry.liveCount++;
+    return 0;
+}
+
+// Copies the live records of cursor into new segments, starting another
+// one every TREASURE_SEGMENT_ROWS rows. Returns the tombstones skipped.
+static long copyLiveRecords(const char *huntPath, TreasureCursor *cursor, TreasureFileHeader *header,
+                            SegmentEntry **entries, int *count, long *kept)
+{
+    SegmentWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    TreasureRecord record;
+    long dropped = 0;
+    while (nextTreasure(cursor, &record)) {
+        if (!TREASURE_IS_LIVE(&record)) {
+            dropped++;
+            continue;
+        }
+        if (writer.entry.rowCount == TREASURE_SEGMENT_ROWS && finishSegment(&writer, entries, count) != 0)
+            return -1;
+        if (writeSegmentRow(huntPath, &writer, header, &record) != 0) {
+            int saved = errno;
+            finishSegment(&writer, entries, count);
+            errno = saved;
+            return -1;
+        }
+        (*kept)++;
+    }
+    if (finishSegment(&writer, entries, count) != 0) {
+        return -1;
+    }
+    return dropped;
+}
+
+static void removeSegmentFiles(const char *huntPath, uint32_t number)
+{
+    char path[1100];
+    segmentRowsPath(huntPath, number, path);
+    unlink(path);
+    clueHeapPath(huntPath, number, path);
+    unlink(path);
+}
+
+// Writes a complete manifest next to treasures.dat and renames it over it.
+static int replaceManifest(const char *huntPath, const TreasureFileHeader *header, const SegmentEntry *entries,
+                           int count)
+{
+    char dataPath[1024], tempPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+    sprintf(tempPath, "%s/rewrite.tmp", huntPath);
+    OutputBuffer *out = openOutput(tempPath);
+    if (out == NULL) {
+        return -1;
+    }
+    bufferWrite(out, header, sizeof(*header));
+    bufferWrite(out, entries, count * sizeof(SegmentEntry));
+    if (closeOutput(out) != 0 || rename(tempPath, dataPath) != 0) {
+        int saved = errno;
+        unlink(tempPath);
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+// Rewrites a hunt in any format into version 4 without its tombstones, and
+// swaps the new manifest in. In a version 4 hunt only the segments holding
+// removed records are rewritten (under new numbers, so readers of the old
+// manifest keep theirs until they close); segments with nothing removed
+// are kept as they are and fully removed ones dropped. Older formats are
+// streamed into fresh segments. The caller must hold the hunt lock.
+// Returns the number of tombstones dropped.
+static long rewriteHunt(const char *huntPath, int *fromVersion, long *kept)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+
+    TreasureFileHeader oldHeader;
+    SegmentEntry *oldEntries = NULL;
+    int oldCount = 0;
+    memset(&oldHeader, 0, sizeof(oldHeader));
+    int dataFile = open(dataPath, O_RDONLY);
+    if (dataFile == -1) {
+        return -1;
+    }
+    int oldCountsValid = readHeaderCounts(dataFile, &oldHeader);
+    if (oldHeader.version == TREASURE_FORMAT_V4 &&
+        readManifest(dataFile, &oldHeader, &oldEntries, &oldCount) != 0) {
+        close(dataFile);
+        return -1;
+    }
+    close(dataFile);
+
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL | TREASURE_WITH_CLUES, &map) != 0) {
+        free(oldEntries);
+        return -1;
+    }
+    *fromVersion = map.version;
+    if (map.version == TREASURE_FORMAT_V4 && map.segmentCount != oldCount) {
+        closeTreasureMap(&map);
+        free(oldEntries);
+        errno = EINVAL;
+        return -1;
+    }
+    if (map.version < TREASURE_FORMAT_V3)
+        memset(&oldHeader, 0, sizeof(oldHeader));
+
+    // IDs keep counting from the old nextId, so compaction never hands a
+    // removed ID out again, and new segment numbers from the old heap's.
+    TreasureFileHeader header;
+    initFileHeader(&header, map.version >= TREASURE_FORMAT_V3 ? map.clueHeap : 0);
+    uint32_t firstNew = header.clueHeap + 1;
+    SegmentEntry *entries = NULL;
+    int count = 0;
+    long dropped = 0;
+    *kept = 0;
+
+    TreasureCursor cursor;
+    if (map.version == TREASURE_FORMAT_V4) {
+        for (int i = 0; i < map.segmentCount && dropped >= 0; i++) {
+            SegmentEntry entry = oldEntries[i];
+            countSegment(&map, i, &entry, &header.nextId);
+            if (entry.liveCount == entry.rowCount) {
+                if (entry.rowCount > 0 && addEntry(&entries, &count, &entry) != 0)
+                    dropped = -1;
+                *kept += entry.liveCount;
+                continue;
+            }
+            startSegmentCursor(&map, i, &cursor);
+            long segmentDropped = copyLiveRecords(huntPath, &cursor, &header, &entries, &count, kept);
+            dropped = segmentDropped < 0 ? -1 : dropped + segmentDropped;
+        }
+    } else {
+        startTreasureCursor(&map, &cursor);
+        for (TreasureRecord record; nextTreasure(&cursor, &record);) {
+            if ((uint32_t)abs(record.id) >= header.nextId)
+                header.nextId = abs(record.id) + 1;
+        }
+        startTreasureCursor(&map, &cursor);
+        dropped = copyLiveRecords(huntPath, &cursor, &header, &entries, &count, kept);
+    }
+    closeTreasureMap(&map);
+
+    if (oldHeader.nextId > header.nextId)
+        header.nextId = oldHeader.nextId;
+    header.liveCount = *kept;
+    header.rowCount = *kept;
+    header.generation = oldHeader.generation + 1;
+    header.segmentCount = count;
+
+    int result = dropped < 0 ? -1 : 0;
+    if (result == 0) {
+        // Dropping tombstones leaves every user's total as it was.
+        if (oldCountsValid)
+            updateHuntScores(huntPath, oldHeader.generation, header.generation, NULL, 0, 0);
+        else
+            dropHuntScores(huntPath);
+        result = replaceManifest(huntPath, &header, entries, count);
+    }
+    if (result != 0) {
+        int saved = errno;
+        for (uint32_t number = firstNew; number <= header.clueHeap; number++)
+            removeSegmentFiles(huntPath, number);
+        free(entries);
+        free(oldEntries);
+        errno = saved;
+        return -1;
+    }
+
+    // The old files nothing points to any more.
+    if (*fromVersion == TREASURE_FORMAT_V4) {
+        for (int i = 0; i < oldCount; i++) {
+            int stillUsed = 0;
+            for (int j = 0; j < count && !stillUsed; j++)
+                stillUsed = entries[j].number == oldEntries[i].number;
+            if (!stillUsed)
+                removeSegmentFiles(huntPath, oldEntries[i].number);
+        }
+    } else if (*fromVersion == TREASURE_FORMAT_V3 && firstNew > 1) {
+        char oldHeapPath[1100];
+        clueHeapPath(huntPath, firstNew - 1, oldHeapPath);
+        unlink(oldHeapPath);
+    }
+    free(entries);
+    free(oldEntries);
+    updateHuntCatalog(huntPath);
+    return dropped;
+}
+
+// Appends count treasures to one segment: one write to its clue heap, then
+// one to its rows file at the row after the last the manifest counts, so
+// whatever an unfinished append left there is overwritten.
+static int appendToSegment(const char *huntPath, const SegmentEntry *entry, const Treasure *treasures, int count)
+{
+    char rowsPath[1100], heapPath[1100];
+    segmentRowsPath(huntPath, entry->number, rowsPath);
+    clueHeapPath(huntPath, entry->number, heapPath);
+    int clueFile = open(heapPath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (clueFile == -1) {
+        return -1;
+    }
+    int rowsFile = open(rowsPath, O_WRONLY | O_CREAT, 0644);
+    if (rowsFile == -1) {
+        close(clueFile);
+        return -1;
+    }
+
+    size_t clueBytes = 0;
+    for (int i = 0; i < count; i++) {
+        clueBytes += sizeof(uint16_t) + strnlen(treasures[i].clue, MAX_CLUE_LENGTH);
+    }
+    char *clues = malloc(clueBytes > 0 ? clueBytes : 1);
+    HotRow *rows = calloc(count > 0 ? count : 1, sizeof(HotRow));
+    struct stat heapStat;
+    if (clues == NULL || rows == NULL || fstat(clueFile, &heapStat) != 0) {
+        free(clues);
+        free(rows);
+        close(clueFile);
+        close(rowsFile);
+        return -1;
+    }
+
+    // Clues go first, so a row never points past the end of the heap.
+    size_t used = 0;
+    for (int i = 0; i < count; i++) {
+        const Treasure *treasure = &treasures[i];
+        uint16_t clueLength = strnlen(treasure->clue, MAX_CLUE_LENGTH);
+        HotRow *row = &rows[i];
+        row->id = treasure->id;
+        memcpy(row->userName, treasure->userName, strnlen(treasure->userName, MAX_USER_NAME_LENGTH));
+        row->x = treasure->coord.x;
+        row->y = treasure->coord.y;
+        row->value = treasure->value;
+        row->clueOffset = heapStat.st_size + used;
+
+        memcpy(clues + used, &clueLength, sizeof(clueLength));
+        memcpy(clues + used + sizeof(clueLength), treasure->clue, clueLength);
+        used += sizeof(clueLength) + clueLength;
+    }
+
+    int result = writeFull(clueFile, clues, clueBytes);
+    if (result == 0) {
+        result = pwriteFull(rowsFile, rows, count * sizeof(HotRow), (off_t)entry->rowCount * sizeof(HotRow));
+    }
+    close(clueFile);
+    close(rowsFile);
+    free(clues);
+    free(rows);
+    return result;
+}
+
+// Recounts every segment after an append to a hunt whose counters were
+// already stale.
+static int recountSegments(const char *dataPath, TreasureFileHeader *header, SegmentEntry *entries, int count)
+{
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL, &map) != 0) {
+        return -1;
+    }
+    if (map.segmentCount != count) {
+        closeTreasureMap(&map);
+        errno = EINVAL;
+        return -1;
+    }
+    header->liveCount = 0;
+    header->rowCount = 0;
+    for (int i = 0; i < count; i++) {
+        countSegment(&map, i, &entries[i], &header->nextId);
+        header->liveCount += entries[i].liveCount;
+        header->rowCount += entries[i].rowCount;
+    }
+    closeTreasureMap(&map);
+    return 0;
+}
+
+// Appends count treasures to the tail segment, starting new segments as
+// each fills up. The rows are numbered back to back, so *offset (the
+// first row) plus i * sizeof(HotRow) locates treasure i. Only the tail
+// segments' files and the manifest are written; hunts still in an older
+// format are converted first. The caller must hold the hunt lock.
+int appendTreasures(const char *huntPath, const Treasure *treasures, int count, off_t *offset)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+
+    int dataFile = -1;
+    TreasureFileHeader header;
+    SegmentEntry *entries = NULL;
+    int segmentCount = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        dataFile = open(dataPath, O_RDWR | O_CREAT, 0666);
+        if (dataFile == -1) {
+            return -1;
+        }
+
+        struct stat st;
+        if (fstat(dataFile, &st) != 0) {
+            close(dataFile);
+            return -1;
+        }
+        if (st.st_size == 0) {
+            initFileHeader(&header, 0);
+            if (pwriteFull(dataFile, &header, sizeof(header), 0) != 0) {
+                close(dataFile);
+                return -1;
+            }
+            writeHuntScores(huntPath, header.generation, NULL, 0);
+            break;
+        }
+        if (readManifest(dataFile, &header, &entries, &segmentCount) == 0) {
+            break;
+        }
+
+        close(dataFile);
+        dataFile = -1;
+        int fromVersion;
+        long kept;
+        if (rewriteHunt(huntPath, &fromVersion, &kept) < 0) {
+            return -1;
+        }
+    }
+    if (dataFile == -1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // scores.dat and the clue index go first, as in tombstoneTreasure.
+    int valid = manifestCountsValid(&header, entries, segmentCount);
+    int nextId = header.nextId;
+    for (int i = 0; i < count; i++) {
+        if (treasures[i].id >= nextId)
+            nextId = treasures[i].id + 1;
+    }
+    if (valid) {
+        updateHuntScores(huntPath, header.generation, header.generation + 1, treasures, count, 1);
+        updateClueIndex(huntPath, header.nextId, nextId, treasures, count);
+    } else {
+        dropHuntScores(huntPath);
+        dropClueIndex(huntPath);
+    }
+
+    off_t rowsBefore = 0;
+    for (int i = 0; i < segmentCount; i++) {
+        rowsBefore += entries[i].rowCount;
+    }
+    *offset = header.headerSize + rowsBefore * sizeof(HotRow);
+
+    int result = 0;
+    for (int done = 0; done < count && result == 0;) {
+        if (segmentCount == 0 || entries[segmentCount - 1].rowCount >= TREASURE_SEGMENT_ROWS) {
+            SegmentEntry fresh;
+            memset(&fresh, 0, sizeof(fresh));
+            fresh.number = ++header.clueHeap;
+            if (addEntry(&entries, &segmentCount, &fresh) != 0) {
+                result = -1;
+                break;
+            }
+        }
+        SegmentEntry *tail = &entries[segmentCount - 1];
+        int batch = count - done;
+        if (batch > (int)(TREASURE_SEGMENT_ROWS - tail->rowCount))
+            batch = TREASURE_SEGMENT_ROWS - tail->rowCount;
+        result = appendToSegment(huntPath, tail, treasures + done, batch);
+        tail->rowCount += batch;
+        tail->liveCount += batch;
+        done += batch;
+    }
+
+    if (result == 0) {
+        header.liveCount += count;
+        header.rowCount += count;
+        header.nextId = nextId;
+        header.segmentCount = segmentCount;
+        if (!valid) {
+            // Make the new rows visible, then count everything once.
+            result = writeManifest(dataFile, &header, entries, segmentCount);
+            if (result == 0)
+                result = recountSegments(dataPath, &header, entries, segmentCount);
+        }
+    }
+    if (result == 0) {
+        header.generation++;
+        result = writeManifest(dataFile, &header, entries, segmentCount);
+    }
+    close(dataFile);
+    free(entries);
+    if (result != 0) {
+        // scores.dat and the clue index already describe the new rows.
+        dropHuntScores(huntPath);
+        dropClueIndex(huntPath);
+    }
+    updateHuntCatalog(huntPath);
+    return result;
+}
+
+int lockHunt(const char *huntPath, int exclusive)
+{
+    char lockPath[1024];
+    sprintf(lockPath, "%s/treasures.lock", huntPath);
+    int lockFile = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lockFile == -1) {
+        return -1;
+    }
+    while (flock(lockFile, exclusive ? LOCK_EX : LOCK_SH) != 0) {
+        if (errno != EINTR) {
+            close(lockFile);
+            return -1;
+        }
+    }
+    return lockFile;
+}
+
+void unlockHunt(int lockFile)
+{
+    if (lockFile != -1) {
+        close(lockFile);
+    }
+}
+
+// The counter is the first 8 bytes of treasures.lock, guarded by an fcntl
+// record lock. That lock is independent of the flock lockHunt takes, so
+// writers get their IDs while another one is committing. The counter never
+// falls behind the header's nextId, so hunts written before it existed
+// carry on from their highest ID.
+int reserveTreasureIds(const char *huntPath, int count, int *firstId)
+{
+    char lockPath[1024];
+    sprintf(lockPath, "%s/treasures.lock", huntPath);
+    int lockFile = open(lockPath, O_RDWR | O_CREAT, 0644);
+    if (lockFile == -1) {
+        return -1;
+    }
+    struct flock range;
+    memset(&range, 0, sizeof(range));
+    range.l_type = F_WRLCK;
+    range.l_whence = SEEK_SET;
+    range.l_len = sizeof(int64_t);
+    while (fcntl(lockFile, F_SETLKW, &range) != 0) {
+        if (errno != EINTR) {
+            close(lockFile);
+            return -1;
+        }
+    }
+
+    int64_t next;
+    if (pread(lockFile, &next, sizeof(next), 0) != sizeof(next))
+        next = 0;
+    TreasureCounts counts;
+    int result = readTreasureCounts(huntPath, &counts);
+    if (result == 0) {
+        if (counts.nextId > next)
+            next = counts.nextId;
+        *firstId = next;
+        next += count;
+        if (pwrite(lockFile, &next, sizeof(next), 0) != sizeof(next))
+            result = -1;
+    }
+    // Closing the descriptor drops the record lock.
+    close(lockFile);
+    return result;
+}
+
+// Reclaims tombstones and the clue bytes they pointed at. The caller must
+// hold the hunt lock. Returns the number of records dropped.
+long compactHunt(const char *huntPath)
+{
+    int fromVersion;
+    long kept;
+    return rewriteHunt(huntPath, &fromVersion, &kept);
+}
+
+// Converts a hunt in an older format to the current one. Returns the number
+// of records written, or 0 with *fromVersion set to the current format when
+// there was nothing to do. The caller must hold the hunt lock.
+long migrateHunt(const char *huntPath, int *fromVersion)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL, &map) != 0) {
+        return -1;
+    }
+    *fromVersion = map.version;
+    closeTreasureMap(&map);
+    if (*fromVersion == TREASURE_FORMAT_CURRENT) {
+        return 0;
+    }
+
+    long kept;
+    if (rewriteHunt(huntPath, fromVersion, &kept) < 0) {
+        return -1;
+    }
+    return kept;
+}
+
+int huntNeedsCompaction(const char *huntPath, int minDead)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+    int dataFile = open(dataPath, O_RDONLY);
+    if (dataFile == -1) {
+        return 0;
+    }
+    TreasureFileHeader header;
+    SegmentEntry *entries;
+    int count;
+    int manifest = readHeaderCounts(dataFile, &header) && header.version == TREASURE_FORMAT_V4 &&
+                   readManifest(dataFile, &header, &entries, &count) == 0;
+    close(dataFile);
+    if (!manifest) {
+        TreasureCounts counts;
+        return readTreasureCounts(huntPath, &counts) == 0 && counts.deadCount >= minDead &&
+               counts.deadCount >= counts.liveCount;
+    }
+
+    int needed = 0;
+    for (int i = 0; i < count && !needed; i++) {
+        int dead = entries[i].rowCount - entries[i].liveCount;
+        needed = dead >= minDead && dead >= (int)entries[i].liveCount;
+    }
+    free(entries);
+    return needed;
+}
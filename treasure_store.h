@@ -0,0 +1,242 @@
+#ifndef TREASURE_STORE_H
+#define TREASURE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct
+{
+    float x, y;
+} Coordinate;
+
+// The version 1 on-disk record, and the in-memory form used when a whole
+// treasure is needed (add, view).
+typedef struct
+{
+    int id;
+    char userName[20];
+    Coordinate coord;
+    char clue[1024];
+    int value;
+} Treasure;
+
+// treasures.dat formats:
+//   1: bare Treasure structs, no header.
+//   2: TreasureFileHeader, then per record a RecordHeader followed by the
+//      user name and clue bytes (read-only, kept for old hunts).
+//   3: TreasureFileHeader, then fixed-size HotRows. Clues live in a separate
+//      heap, Hunts/<id>/clues-<clueHeap>.dat, as a uint16_t length followed
+//      by the bytes, so scans that do not print clues never read them.
+//   4: treasures.dat is only a manifest: the TreasureFileHeader, then one
+//      SegmentEntry per segment. Segment n keeps its HotRows in rows-<n>.dat
+//      and their clues in clues-<n>.dat, at most TREASURE_SEGMENT_ROWS rows.
+//      Appends fill the last segment and start a new one once it is full;
+//      compaction rewrites only the segments holding removed rows, under new
+//      numbers, and swaps in a new manifest.
+#define TREASURE_MAGIC "TRSR"
+#define TREASURE_FORMAT_V1 1
+#define TREASURE_FORMAT_V2 2
+#define TREASURE_FORMAT_V3 3
+#define TREASURE_FORMAT_V4 4
+#define TREASURE_FORMAT_CURRENT TREASURE_FORMAT_V4
+
+#define TREASURE_SEGMENT_ROWS 16384
+
+// In version 3 the header also carries the hunt's counters, rewritten under
+// the hunt lock by every append, remove and rewrite. They are trusted only
+// while rowCount matches the file size (in version 4, the segments' rows
+// and live rows add up to them); nextId == 0 marks a header written before
+// the counters existed. Either way the next writer recounts once. In
+// version 4 clueHeap is the highest segment number handed out so far.
+typedef struct
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    uint32_t clueHeap;
+    uint32_t nextId;
+    uint32_t liveCount;
+    uint32_t rowCount;
+    uint32_t generation;
+    uint32_t segmentCount;
+} TreasureFileHeader;
+
+typedef struct
+{
+    uint32_t number;
+    uint32_t rowCount;
+    uint32_t liveCount;
+    uint32_t reserved;
+} SegmentEntry;
+
+typedef struct
+{
+    int32_t id;
+    float x, y;
+    int32_t value;
+    uint16_t clueLength;
+    uint8_t userNameLength;
+    uint8_t flags;
+} RecordHeader;
+
+typedef struct
+{
+    int32_t id;
+    char userName[20];
+    float x, y;
+    int32_t value;
+    uint32_t clueOffset;
+} HotRow;
+
+#define MAX_RECORD_SIZE (sizeof(RecordHeader) + sizeof(((Treasure *)0)->userName) + sizeof(((Treasure *)0)->clue))
+
+// A decoded record. The strings point into the map and are not terminated;
+// print them with "%.*s". The clue is empty when a version 3 map was opened
+// without TREASURE_WITH_CLUES.
+typedef struct
+{
+    int id;
+    Coordinate coord;
+    int value;
+    const char *userName;
+    int userNameLength;
+    const char *clue;
+    int clueLength;
+    off_t offset;
+    size_t size;
+} TreasureRecord;
+
+// Removed treasures stay in place with their ID negated until the hunt is
+// compacted, so a delete is a single 4-byte write.
+#define TREASURE_IS_LIVE(treasure) ((treasure)->id > 0)
+
+#define TREASURE_ACCESS_SEQUENTIAL 0
+#define TREASURE_ACCESS_RANDOM 1
+#define TREASURE_WITH_CLUES 2
+// Read the files into memory instead of mapping them, so the map stays
+// valid and resident however the files change afterwards.
+#define TREASURE_RESIDENT 4
+
+// One file of records: all of treasures.dat up to version 3, or one
+// segment's rows-<n>.dat. Offsets count through a hunt's segments as if
+// they were a single file, so the records of [start, end) sit at
+// base + (offset - start), and the offsets kept in treasures.idx and the
+// grid stay valid as segments are added.
+typedef struct
+{
+    void *base;
+    size_t length;
+    int mapped;
+    size_t start;
+    size_t end;
+    void *clueBase;
+    size_t clueLength;
+    int cluesMapped;
+    // Live records in [start, end) as the manifest counts them, or -1 when
+    // its counts are not current (and before version 4).
+    int liveCount;
+} TreasureSegment;
+
+// Read-only view over a hunt's records in any version. Nothing is copied;
+// a trailing partial record is ignored. length is where the last record
+// ends, counted as above.
+typedef struct
+{
+    TreasureSegment *segments;
+    int segmentCount;
+    size_t length;
+    size_t clueLength;
+    uint64_t inode;
+    int version;
+    size_t dataStart;
+    int clueHeap;
+} TreasureMap;
+
+typedef struct
+{
+    const TreasureMap *map;
+    int segment;
+    int lastSegment;
+    size_t position;
+} TreasureCursor;
+
+int openTreasureMap(const char *path, int flags, TreasureMap *map);
+void closeTreasureMap(TreasureMap *map);
+void startTreasureCursor(const TreasureMap *map, TreasureCursor *cursor);
+// Like startTreasureCursor, but stops at the end of one segment.
+void startSegmentCursor(const TreasureMap *map, int segment, TreasureCursor *cursor);
+// Positions the cursor on the record at offset, as found in record.offset.
+void seekTreasureCursor(const TreasureMap *map, off_t offset, TreasureCursor *cursor);
+int nextTreasure(TreasureCursor *cursor, TreasureRecord *record);
+// The raw bytes of the record at offset (its int32_t ID comes first in
+// every version), or NULL past the end of its segment.
+const void *treasureRecordAt(const TreasureMap *map, off_t offset);
+
+// Runs scan once for each segment of map, on up to one thread per core,
+// and returns when all are done. contexts holds one contextSize-byte
+// context per segment; each call gets its own, so the caller merges the
+// results afterwards in segment order.
+typedef void (*TreasureSegmentScan)(const TreasureMap *map, int segment, void *context);
+void scanTreasureSegments(const TreasureMap *map, TreasureSegmentScan scan, void *contexts, size_t contextSize);
+
+// Reads single records by offset, opening a segment's files only when one
+// of its records is asked for. inode and length identify the records as
+// treasures.idx remembers them.
+typedef struct
+{
+    char huntPath[1024];
+    int version;
+    int dataFile;
+    int writable;
+    uint64_t inode;
+    int64_t length;
+    size_t dataStart;
+    int clueHeap;
+    SegmentEntry *segments;
+    int segmentCount;
+    int *rowFiles;
+    int *clueFiles;
+} TreasureReader;
+
+int openTreasureReader(const char *huntPath, int writable, TreasureReader *reader);
+void closeTreasureReader(TreasureReader *reader);
+int readTreasureAt(TreasureReader *reader, off_t offset, Treasure *treasure);
+int readTreasureIdAt(TreasureReader *reader, off_t offset, int *id);
+
+void recordToTreasure(const TreasureRecord *record, Treasure *treasure);
+int appendTreasures(const char *huntPath, const Treasure *treasures, int count, off_t *offset);
+
+// generation changes whenever the hunt's contents do.
+typedef struct
+{
+    int nextId;
+    int liveCount;
+    int deadCount;
+    uint32_t generation;
+} TreasureCounts;
+
+int readTreasureCounts(const char *huntPath, TreasureCounts *counts);
+// Like readTreasureCounts, but fails instead of scanning when the header
+// counters are not current.
+int readCurrentTreasureCounts(const char *huntPath, TreasureCounts *counts);
+// reader must have been opened writable, with the hunt lock held.
+int tombstoneTreasure(TreasureReader *reader, off_t offset, int id);
+
+int lockHunt(const char *huntPath, int exclusive);
+void unlockHunt(int lockFile);
+// Hands out count consecutive IDs, never the same one twice, without
+// taking the hunt lock.
+int reserveTreasureIds(const char *huntPath, int count, int *firstId);
+long compactHunt(const char *huntPath);
+// Whether some segment (the whole hunt before version 4) has at least
+// minDead removed records and no more live ones than removed.
+int huntNeedsCompaction(const char *huntPath, int minDead);
+long migrateHunt(const char *huntPath, int *fromVersion);
+
+// pread/pwrite/write that retry on EINTR and short transfers; 0 or -1.
+int preadFull(int fd, void *buffer, size_t length, off_t offset);
+int pwriteFull(int fd, const void *buffer, size_t length, off_t offset);
+int writeFull(int fd, const void *buffer, size_t length);
+
+#endif
@@ -0,0 +1,706 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "treasure_terms.h"
+
+#define TERMS_MAGIC 0x4d525454 // "TTRM"
+#define TERMS_LOG_MAGIC 0x474c5454 // "TTLG"
+#define TERMS_VERSION 1
+#define TERMS_MERGE_MIN 4096
+
+// terms.dat: the header, termCount TermEntries sorted by term, then the
+// ID lists they point into, then the term bytes.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stamp;
+    uint32_t termCount;
+    uint32_t postingCount;
+    uint32_t stringBytes;
+} TermFileHeader;
+
+typedef struct
+{
+    uint32_t stringOffset;
+    uint32_t length;
+    uint32_t postingStart;
+    uint32_t postingCount;
+} TermEntry;
+
+// terms.log: the header, then `length` bytes of records, each an int32_t
+// ID, a one-byte term length and the term. Bytes past `length` are left
+// over from an append that never finished and are ignored.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t baseStamp;
+    uint32_t coveredNextId;
+    uint32_t length;
+    uint32_t postingCount;
+} TermLogHeader;
+
+#define LOG_RECORD_SIZE(length) (sizeof(int32_t) + 1 + (length))
+
+typedef struct
+{
+    void *base;
+    size_t length;
+    const TermFileHeader *header;
+    const TermEntry *terms;
+    const int32_t *postings;
+    const char *strings;
+    TermLogHeader logHeader;
+    char *log;
+} ClueIndex;
+
+static int isTermByte(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+int nextClueTerm(const char **cursor, const char *end, char *term)
+{
+    const char *at = *cursor;
+    while (at < end && !isTermByte(*at))
+        at++;
+
+    int length = 0;
+    while (at < end && isTermByte(*at)) {
+        unsigned char c = *at++;
+        if (length < MAX_TERM_LENGTH)
+            term[length++] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    term[length] = '\0';
+    *cursor = at;
+    return length;
+}
+
+static void termPaths(const char *huntPath, char *basePath, char *logPath)
+{
+    sprintf(basePath, "%s/terms.dat", huntPath);
+    sprintf(logPath, "%s/terms.log", huntPath);
+}
+
+static void closeClueIndex(ClueIndex *index)
+{
+    if (index->base != NULL)
+        munmap(index->base, index->length);
+    free(index->log);
+    memset(index, 0, sizeof(*index));
+}
+
+// Opens the log before terms.dat: a merge renames terms.dat first, so a
+// log that names the new terms.dat is never paired with the old one.
+static int openClueIndex(const char *huntPath, ClueIndex *index)
+{
+    char basePath[1100], logPath[1100];
+    termPaths(huntPath, basePath, logPath);
+    memset(index, 0, sizeof(*index));
+
+    int logFile = open(logPath, O_RDONLY);
+    if (logFile == -1) {
+        return -1;
+    }
+    struct stat st;
+    TermLogHeader *logHeader = &index->logHeader;
+    if (fstat(logFile, &st) != 0 || preadFull(logFile, logHeader, sizeof(*logHeader), 0) != 0 ||
+        logHeader->magic != TERMS_LOG_MAGIC || logHeader->version != TERMS_VERSION ||
+        sizeof(*logHeader) + (uint64_t)logHeader->length > (uint64_t)st.st_size ||
+        (index->log = malloc(logHeader->length + 1)) == NULL ||
+        preadFull(logFile, index->log, logHeader->length, sizeof(*logHeader)) != 0) {
+        close(logFile);
+        closeClueIndex(index);
+        return -1;
+    }
+    close(logFile);
+
+    int baseFile = open(basePath, O_RDONLY);
+    if (baseFile == -1 || fstat(baseFile, &st) != 0 || (size_t)st.st_size < sizeof(TermFileHeader)) {
+        if (baseFile != -1)
+            close(baseFile);
+        closeClueIndex(index);
+        return -1;
+    }
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, baseFile, 0);
+    close(baseFile);
+    if (base == MAP_FAILED) {
+        closeClueIndex(index);
+        return -1;
+    }
+    index->base = base;
+    index->length = st.st_size;
+
+    const TermFileHeader *header = base;
+    uint64_t expected = sizeof(*header) + (uint64_t)header->termCount * sizeof(TermEntry) +
+                        (uint64_t)header->postingCount * sizeof(int32_t) + header->stringBytes;
+    if (header->magic != TERMS_MAGIC || header->version != TERMS_VERSION ||
+        header->stamp != logHeader->baseStamp || expected != (uint64_t)st.st_size) {
+        closeClueIndex(index);
+        return -1;
+    }
+    index->header = header;
+    index->terms = (const TermEntry *)(header + 1);
+    index->postings = (const int32_t *)(index->terms + header->termCount);
+    index->strings = (const char *)(index->postings + header->postingCount);
+    return 0;
+}
+
+// A stamp neither file has used, so a crash between the two renames of a
+// rebuild can never leave them agreeing by accident.
+static uint32_t nextStamp(const char *huntPath)
+{
+    char basePath[1100], logPath[1100];
+    termPaths(huntPath, basePath, logPath);
+
+    uint32_t stamp = 0;
+    TermFileHeader header;
+    TermLogHeader logHeader;
+    int fd = open(basePath, O_RDONLY);
+    if (fd != -1) {
+        if (preadFull(fd, &header, sizeof(header), 0) == 0 && header.stamp > stamp)
+            stamp = header.stamp;
+        close(fd);
+    }
+    fd = open(logPath, O_RDONLY);
+    if (fd != -1) {
+        if (preadFull(fd, &logHeader, sizeof(logHeader), 0) == 0 && logHeader.baseStamp > stamp)
+            stamp = logHeader.baseStamp;
+        close(fd);
+    }
+    return stamp + 1;
+}
+
+// Postings collected for a rebuild or merge. Terms are kept in one pool
+// and referred to by offset, so the pool can grow.
+typedef struct
+{
+    uint32_t term;
+    uint32_t length;
+    int32_t id;
+} Posting;
+
+typedef struct
+{
+    Posting *items;
+    size_t count;
+    size_t capacity;
+    char *pool;
+    size_t poolUsed;
+    size_t poolCapacity;
+} PostingList;
+
+static int addPosting(PostingList *list, const char *term, int length, int id)
+{
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? list->capacity * 2 : 4096;
+        Posting *items = realloc(list->items, capacity * sizeof(Posting));
+        if (items == NULL) {
+            return -1;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    if (list->poolUsed + length > list->poolCapacity) {
+        size_t capacity = list->poolCapacity > 0 ? list->poolCapacity * 2 : 65536;
+        while (capacity < list->poolUsed + length)
+            capacity *= 2;
+        char *pool = realloc(list->pool, capacity);
+        if (pool == NULL) {
+            return -1;
+        }
+        list->pool = pool;
+        list->poolCapacity = capacity;
+    }
+
+    Posting *posting = &list->items[list->count++];
+    posting->term = list->poolUsed;
+    posting->length = length;
+    posting->id = id;
+    memcpy(list->pool + list->poolUsed, term, length);
+    list->poolUsed += length;
+    return 0;
+}
+
+static int addCluePostings(PostingList *list, const char *clue, int clueLength, int id)
+{
+    char term[MAX_TERM_LENGTH + 1];
+    const char *cursor = clue, *end = clue + clueLength;
+    int length;
+    while ((length = nextClueTerm(&cursor, end, term)) > 0) {
+        if (addPosting(list, term, length, id) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void freePostingList(PostingList *list)
+{
+    free(list->items);
+    free(list->pool);
+    memset(list, 0, sizeof(*list));
+}
+
+static int compareTerms(const char *left, uint32_t leftLength, const char *right, uint32_t rightLength)
+{
+    int order = memcmp(left, right, leftLength < rightLength ? leftLength : rightLength);
+    if (order != 0)
+        return order;
+    return (leftLength > rightLength) - (leftLength < rightLength);
+}
+
+static int comparePostings(const void *a, const void *b, void *pool)
+{
+    const Posting *left = a, *right = b;
+    int order = compareTerms((const char *)pool + left->term, left->length, (const char *)pool + right->term,
+                             right->length);
+    if (order != 0)
+        return order;
+    return (left->id > right->id) - (left->id < right->id);
+}
+
+static int writeFile(const char *path, const void *buffer, size_t length)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = pwriteFull(fd, buffer, length, 0);
+    if (close(fd) != 0)
+        result = -1;
+    return result;
+}
+
+// Sorts the postings and writes them out as a new terms.dat with an empty
+// log covering coveredNextId. The caller must hold the hunt lock.
+static int writeClueIndex(const char *huntPath, PostingList *list, uint32_t stamp, int coveredNextId)
+{
+    char basePath[1100], logPath[1100], baseTemp[1200], logTemp[1200];
+    termPaths(huntPath, basePath, logPath);
+    sprintf(baseTemp, "%s.tmp", basePath);
+    sprintf(logTemp, "%s.tmp", logPath);
+
+    qsort_r(list->items, list->count, sizeof(Posting), comparePostings, list->pool);
+
+    // Sizes are bounded by the raw postings; duplicates shrink them.
+    size_t maxLength = sizeof(TermFileHeader) + list->count * (sizeof(TermEntry) + sizeof(int32_t)) + list->poolUsed;
+    char *image = malloc(maxLength);
+    TermEntry *terms = malloc((list->count > 0 ? list->count : 1) * sizeof(TermEntry));
+    int32_t *postings = malloc((list->count > 0 ? list->count : 1) * sizeof(int32_t));
+    char *strings = malloc(list->poolUsed > 0 ? list->poolUsed : 1);
+    if (image == NULL || terms == NULL || postings == NULL || strings == NULL) {
+        free(image);
+        free(terms);
+        free(postings);
+        free(strings);
+        return -1;
+    }
+
+    uint32_t termCount = 0, postingCount = 0, stringBytes = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        const Posting *posting = &list->items[i];
+        const char *term = list->pool + posting->term;
+        TermEntry *last = termCount > 0 ? &terms[termCount - 1] : NULL;
+        if (last == NULL || compareTerms(strings + last->stringOffset, last->length, term, posting->length) != 0) {
+            last = &terms[termCount++];
+            last->stringOffset = stringBytes;
+            last->length = posting->length;
+            last->postingStart = postingCount;
+            last->postingCount = 0;
+            memcpy(strings + stringBytes, term, posting->length);
+            stringBytes += posting->length;
+        } else if (postings[postingCount - 1] == posting->id) {
+            continue; // The same word twice in one clue
+        }
+        postings[postingCount++] = posting->id;
+        last->postingCount++;
+    }
+
+    TermFileHeader header = {TERMS_MAGIC, TERMS_VERSION, stamp, termCount, postingCount, stringBytes};
+    size_t length = 0;
+    memcpy(image, &header, sizeof(header));
+    length += sizeof(header);
+    memcpy(image + length, terms, termCount * sizeof(TermEntry));
+    length += termCount * sizeof(TermEntry);
+    memcpy(image + length, postings, postingCount * sizeof(int32_t));
+    length += postingCount * sizeof(int32_t);
+    memcpy(image + length, strings, stringBytes);
+    length += stringBytes;
+    free(terms);
+    free(postings);
+    free(strings);
+
+    TermLogHeader logHeader = {TERMS_LOG_MAGIC, TERMS_VERSION, stamp, coveredNextId, 0, 0};
+    int result = writeFile(baseTemp, image, length);
+    free(image);
+    if (result == 0)
+        result = writeFile(logTemp, &logHeader, sizeof(logHeader));
+    if (result == 0 && rename(baseTemp, basePath) != 0)
+        result = -1;
+    if (result == 0 && rename(logTemp, logPath) != 0)
+        result = -1;
+    if (result != 0) {
+        unlink(baseTemp);
+        unlink(logTemp);
+    }
+    return result;
+}
+
+static int rebuildClueIndex(const char *huntPath, int coveredNextId)
+{
+    char dataPath[1024];
+    sprintf(dataPath, "%s/treasures.dat", huntPath);
+    TreasureMap map;
+    if (openTreasureMap(dataPath, TREASURE_ACCESS_SEQUENTIAL | TREASURE_WITH_CLUES, &map) != 0) {
+        return -1;
+    }
+
+    PostingList list;
+    memset(&list, 0, sizeof(list));
+    int result = 0;
+    TreasureCursor cursor;
+    TreasureRecord record;
+    startTreasureCursor(&map, &cursor);
+    while (result == 0 && nextTreasure(&cursor, &record)) {
+        if (TREASURE_IS_LIVE(&record))
+            result = addCluePostings(&list, record.clue, record.clueLength, record.id);
+    }
+    closeTreasureMap(&map);
+
+    if (result == 0)
+        result = writeClueIndex(huntPath, &list, nextStamp(huntPath), coveredNextId);
+    freePostingList(&list);
+    return result;
+}
+
+// Folds the log into a new terms.dat.
+static int mergeClueIndex(const char *huntPath, const ClueIndex *index)
+{
+    PostingList list;
+    memset(&list, 0, sizeof(list));
+    int result = 0;
+    for (uint32_t i = 0; i < index->header->termCount && result == 0; i++) {
+        const TermEntry *term = &index->terms[i];
+        for (uint32_t j = 0; j < term->postingCount && result == 0; j++) {
+            result = addPosting(&list, index->strings + term->stringOffset, term->length,
+                                index->postings[term->postingStart + j]);
+        }
+    }
+    for (uint32_t at = 0; at < index->logHeader.length && result == 0;) {
+        int32_t id;
+        memcpy(&id, index->log + at, sizeof(id));
+        int length = (unsigned char)index->log[at + sizeof(id)];
+        result = addPosting(&list, index->log + at + sizeof(id) + 1, length, id);
+        at += LOG_RECORD_SIZE(length);
+    }
+
+    if (result == 0)
+        result = writeClueIndex(huntPath, &list, nextStamp(huntPath), index->logHeader.coveredNextId);
+    freePostingList(&list);
+    return result;
+}
+
+// Writes the records past the current end of the log, then the header
+// that takes them in.
+static int appendClueLog(const char *huntPath, ClueIndex *index, const Treasure *treasures, int count, int toNextId)
+{
+    char basePath[1100], logPath[1100];
+    termPaths(huntPath, basePath, logPath);
+
+    size_t capacity = 0;
+    for (int i = 0; i < count; i++) {
+        capacity += strnlen(treasures[i].clue, sizeof(treasures[i].clue)) / 2 * LOG_RECORD_SIZE(MAX_TERM_LENGTH) +
+                    LOG_RECORD_SIZE(MAX_TERM_LENGTH);
+    }
+    char *records = malloc(capacity > 0 ? capacity : 1);
+    if (records == NULL) {
+        return -1;
+    }
+
+    size_t length = 0;
+    uint32_t postingCount = 0;
+    char term[MAX_TERM_LENGTH + 1];
+    for (int i = 0; i < count; i++) {
+        const char *cursor = treasures[i].clue;
+        const char *end = cursor + strnlen(cursor, sizeof(treasures[i].clue));
+        int termLength;
+        while ((termLength = nextClueTerm(&cursor, end, term)) > 0) {
+            int32_t id = treasures[i].id;
+            memcpy(records + length, &id, sizeof(id));
+            records[length + sizeof(id)] = (char)termLength;
+            memcpy(records + length + sizeof(id) + 1, term, termLength);
+            length += LOG_RECORD_SIZE(termLength);
+            postingCount++;
+        }
+    }
+
+    TermLogHeader *header = &index->logHeader;
+    int logFile = open(logPath, O_WRONLY);
+    int result = logFile == -1 ? -1 : 0;
+    if (result == 0 && pwriteFull(logFile, records, length, sizeof(*header) + header->length) != 0)
+        result = -1;
+    free(records);
+    if (result == 0) {
+        header->length += length;
+        header->postingCount += postingCount;
+        header->coveredNextId = toNextId;
+        result = pwriteFull(logFile, header, sizeof(*header), 0);
+    }
+    if (logFile != -1)
+        close(logFile);
+    return result;
+}
+
+void updateClueIndex(const char *huntPath, int fromNextId, int toNextId, const Treasure *treasures, int count)
+{
+    ClueIndex index;
+    if (openClueIndex(huntPath, &index) != 0 || index.logHeader.coveredNextId != (uint32_t)fromNextId) {
+        closeClueIndex(&index);
+        if (rebuildClueIndex(huntPath, fromNextId) != 0 || openClueIndex(huntPath, &index) != 0) {
+            dropClueIndex(huntPath);
+            return;
+        }
+    }
+
+    if (appendClueLog(huntPath, &index, treasures, count, toNextId) != 0) {
+        closeClueIndex(&index);
+        dropClueIndex(huntPath);
+        return;
+    }
+    // Merging once the log passes a quarter of terms.dat keeps searches
+    // from scanning much log, and the work done per treasure added bounded.
+    if (index.logHeader.postingCount >= TERMS_MERGE_MIN &&
+        index.logHeader.postingCount > index.header->postingCount / 4) {
+        closeClueIndex(&index);
+        if (openClueIndex(huntPath, &index) != 0 || mergeClueIndex(huntPath, &index) != 0)
+            dropClueIndex(huntPath);
+    }
+    closeClueIndex(&index);
+}
+
+void dropClueIndex(const char *huntPath)
+{
+    char basePath[1100], logPath[1100];
+    termPaths(huntPath, basePath, logPath);
+    unlink(logPath);
+    unlink(basePath);
+}
+
+static int compareIds(const void *a, const void *b)
+{
+    int left = *(const int *)a, right = *(const int *)b;
+    return (left > right) - (left < right);
+}
+
+static int sortUnique(int *ids, int count)
+{
+    qsort(ids, count, sizeof(int), compareIds);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (kept == 0 || ids[kept - 1] != ids[i])
+            ids[kept++] = ids[i];
+    }
+    return kept;
+}
+
+// The IDs for one term: its list in terms.dat, found by binary search,
+// plus its records in the log.
+static int findTerm(const ClueIndex *index, const char *term, int **ids, int *count)
+{
+    uint32_t length = strlen(term);
+    const TermEntry *found = NULL;
+    uint32_t low = 0, high = index->header->termCount;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        const TermEntry *entry = &index->terms[middle];
+        int order = compareTerms(index->strings + entry->stringOffset, entry->length, term, length);
+        if (order == 0) {
+            found = entry;
+            break;
+        }
+        if (order < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    int baseCount = found != NULL ? found->postingCount : 0;
+    int capacity = baseCount + index->logHeader.postingCount;
+    *ids = malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+    if (*ids == NULL) {
+        return -1;
+    }
+    if (found != NULL)
+        memcpy(*ids, index->postings + found->postingStart, baseCount * sizeof(int));
+
+    int total = baseCount;
+    for (uint32_t at = 0; at < index->logHeader.length;) {
+        uint32_t recordLength = (unsigned char)index->log[at + sizeof(int32_t)];
+        if (recordLength == length && memcmp(index->log + at + sizeof(int32_t) + 1, term, length) == 0)
+            memcpy(&(*ids)[total++], index->log + at, sizeof(int32_t));
+        at += LOG_RECORD_SIZE(recordLength);
+    }
+    *count = sortUnique(*ids, total);
+    return 0;
+}
+
+// Keeps the IDs of into that also appear in other; both are sorted.
+static int intersectIds(int *into, int intoCount, const int *other, int otherCount)
+{
+    int kept = 0, j = 0;
+    for (int i = 0; i < intoCount; i++) {
+        while (j < otherCount && other[j] < into[i])
+            j++;
+        if (j < otherCount && other[j] == into[i])
+            into[kept++] = into[i];
+    }
+    return kept;
+}
+
+int searchClueIndex(const char *huntPath, int nextId, char **terms, int termCount, int **ids, int *count)
+{
+    ClueIndex index;
+    if (openClueIndex(huntPath, &index) != 0) {
+        return -1;
+    }
+    if (index.logHeader.coveredNextId != (uint32_t)nextId) {
+        closeClueIndex(&index);
+        return -1;
+    }
+
+    int *result = NULL;
+    int resultCount = 0;
+    for (int i = 0; i < termCount; i++) {
+        int *termIds, matchCount;
+        if (findTerm(&index, terms[i], &termIds, &matchCount) != 0) {
+            free(result);
+            closeClueIndex(&index);
+            return -1;
+        }
+        if (result == NULL) {
+            result = termIds;
+            resultCount = matchCount;
+        } else {
+            resultCount = intersectIds(result, resultCount, termIds, matchCount);
+            free(termIds);
+        }
+    }
+    closeClueIndex(&index);
+
+    *ids = result != NULL ? result : malloc(sizeof(int));
+    *count = resultCount;
+    return *ids != NULL ? 0 : -1;
+}
+
+// Written without branches so the compiler can vectorize it.
+static void lowerCase(char *to, const char *from, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = from[i];
+        to[i] = c | ((unsigned char)(c - 'A') < 26) << 5;
+    }
+}
+
+typedef struct
+{
+    char **terms;
+    int termCount;
+    int *ids;
+    int count;
+    int capacity;
+    int failed;
+} ClueScan;
+
+// memmem (vectorized in glibc) rules out almost every clue cheaply; the
+// few left are split into words so the answer matches the index exactly.
+static void scanSegmentClues(const TreasureMap *map, int segment, void *context)
+{
+    ClueScan *scan = context;
+    char clue[sizeof(((Treasure *)0)->clue)];
+    char term[MAX_TERM_LENGTH + 1];
+    TreasureCursor cursor;
+    TreasureRecord record;
+    startSegmentCursor(map, segment, &cursor);
+    while (nextTreasure(&cursor, &record)) {
+        if (!TREASURE_IS_LIVE(&record))
+            continue;
+        size_t length = record.clueLength < (int)sizeof(clue) ? (size_t)record.clueLength : sizeof(clue);
+        lowerCase(clue, record.clue, length);
+
+        int candidate = 1;
+        for (int i = 0; i < scan->termCount && candidate; i++) {
+            candidate = memmem(clue, length, scan->terms[i], strlen(scan->terms[i])) != NULL;
+        }
+        if (!candidate)
+            continue;
+
+        uint32_t seen = 0;
+        const char *at = clue;
+        while (nextClueTerm(&at, clue + length, term) > 0) {
+            for (int i = 0; i < scan->termCount; i++) {
+                if (strcmp(term, scan->terms[i]) == 0)
+                    seen |= 1u << i;
+            }
+        }
+        if (seen != (scan->termCount < 32 ? (1u << scan->termCount) - 1 : ~0u))
+            continue;
+
+        if (scan->count == scan->capacity) {
+            int capacity = scan->capacity == 0 ? 256 : scan->capacity * 2;
+            int *grown = realloc(scan->ids, capacity * sizeof(int));
+            if (grown == NULL) {
+                scan->failed = 1;
+                return;
+            }
+            scan->ids = grown;
+            scan->capacity = capacity;
+        }
+        scan->ids[scan->count++] = record.id;
+    }
+}
+
+// Segments are scanned in parallel and their matches joined afterwards.
+int scanClues(const TreasureMap *map, char **terms, int termCount, int **ids, int *count)
+{
+    int segmentCount = map->segmentCount > 0 ? map->segmentCount : 1;
+    ClueScan *scans = calloc(segmentCount, sizeof(ClueScan));
+    if (scans == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < segmentCount; i++) {
+        scans[i].terms = terms;
+        scans[i].termCount = termCount;
+    }
+    scanTreasureSegments(map, scanSegmentClues, scans, sizeof(ClueScan));
+
+    int found = 0, failed = 0;
+    for (int i = 0; i < map->segmentCount; i++) {
+        found += scans[i].count;
+        failed |= scans[i].failed;
+    }
+    int *result = failed ? NULL : malloc((found > 0 ? found : 1) * sizeof(int));
+    found = 0;
+    for (int i = 0; i < map->segmentCount; i++) {
+        if (result != NULL)
+            memcpy(result + found, scans[i].ids, scans[i].count * sizeof(int));
+        found += scans[i].count;
+        free(scans[i].ids);
+    }
+    free(scans);
+    if (result == NULL) {
+        return -1;
+    }
+
+    *ids = result;
+    *count = sortUnique(result, found);
+    return 0;
+}
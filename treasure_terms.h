@@ -0,0 +1,42 @@
+#ifndef TREASURE_TERMS_H
+#define TREASURE_TERMS_H
+
+#include "treasure_store.h"
+
+// The clue search index: every word of every clue mapped to the IDs of the
+// treasures using it. A word is a run of ASCII letters and digits (bytes
+// above 0x7f count as letters, so UTF-8 words stay whole), compared without
+// case and cut to MAX_TERM_LENGTH bytes.
+//
+// It lives in two files next to treasures.dat. terms.dat is the bulk of
+// it: a sorted term table with a sorted ID list per term, searched in
+// place. terms.log collects the words of treasures added since, and is
+// folded into a new terms.dat once it grows past a quarter of it. The log
+// header names the terms.dat it extends and the next free ID it covers;
+// the index is only used while that matches the treasures.dat header.
+// IDs are never handed out twice, so removes and compaction leave it
+// valid: removed treasures are dropped when the matches are read.
+#define MAX_TERM_LENGTH 31
+#define MAX_SEARCH_TERMS 16
+
+// Copies the next word between *cursor and end into term (lower case,
+// terminated) and returns its length, or 0 when there are none left.
+int nextClueTerm(const char **cursor, const char *end, char *term);
+
+// Adds treasures to the index as the header's next free ID moves from
+// fromNextId to toNextId. An index that does not cover fromNextId is
+// rebuilt from treasures.dat first. Called under the hunt lock before the
+// rows are written, so a failed append leaves the index ahead of the
+// header and unused.
+void updateClueIndex(const char *huntPath, int fromNextId, int toNextId, const Treasure *treasures, int count);
+void dropClueIndex(const char *huntPath);
+
+// Finds the treasures whose clues hold every term, as a malloc'd sorted
+// array of IDs that may include removed treasures. Returns -1 if the index
+// does not cover nextId.
+int searchClueIndex(const char *huntPath, int nextId, char **terms, int termCount, int **ids, int *count);
+
+// The same answer without the index: a scan over every clue in the map.
+int scanClues(const TreasureMap *map, char **terms, int termCount, int **ids, int *count);
+
+#endif